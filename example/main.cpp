@@ -1,9 +1,12 @@
 #include <cstdio>
 #include "../library/source/CASIOClient.h"
 
+#include <chrono>
 #include <cmath>
+#include <cstring>
 #include <numbers>
 #include <memory>
+#include <thread>
 
 auto SELECTED_DEVICENAME = "Focusrite USB ASIO";
 constexpr double TONE_FREQ = 200.0;
@@ -18,7 +21,7 @@ struct MyDeviceStruct {
     double samplePeriod;
 };
 
-int CDECL asioCallback(CASIO_Event *event, CASIO_Device device, void *userData)
+int CASIO_CDECL asioCallback(CASIO_Event *event, CASIO_Device /*device*/, void *userData)
 {
     event->handled = true;
     switch (event->eventType) {
@@ -91,7 +94,7 @@ int main()
         CASIO_Start(devs[i].handle);
     }
 
-    Sleep(5000);
+    std::this_thread::sleep_for(std::chrono::seconds(5));
 
     printf("stopping\n");
     for (int i = 0; i < deviceCount; i++) {
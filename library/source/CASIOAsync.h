@@ -0,0 +1,818 @@
+#pragma once
+
+// header-only C++20 coroutine layer over the C API, for non-realtime (control-plane) code.
+//
+//     casio::Runtime runtime; // owns CASIO_Init, a control thread and a worker pool
+//     casio::Task<> monitor(casio::Runtime &rt, CASIO_DeviceID id, std::stop_token stop) {
+//         auto device = co_await rt.open(id, stop); // closed on the control thread when the handle goes away
+//         co_await device->start(stop);
+//         while (true) {
+//             auto block = co_await device->next_block(stop); // throws casio::Cancelled on stop, or when the device stops
+//             ...
+//         }
+//     }
+//     casio::sync_wait(monitor(runtime, id, source.get_token()));
+//
+// every driver call (open/start/stop/close, enumeration) runs on the runtime's control thread, which is also the
+// thread that initialized COM. coroutines always resume on the worker pool.
+//
+// the audio thread runs the device's realtime handler (if any), copies the inputs into a small ring of preallocated
+// block slots, and hands waiting coroutines over to the pool through a lock-free queue: no locks, no allocation.
+// a coroutine that falls more than ASYNC_BLOCK_SLOTS buffers behind sees its block overwritten (Block::read() tells).
+
+#include "CASIOClient.h"
+#include "util/lockfree.h"
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define ASYNC_BLOCK_SLOTS 8
+#define ASYNC_MAX_WAITERS 16 // coroutines waiting on next_block() of one device at the same time
+#define ASYNC_QUEUE_SIZE 4096 // pending resumptions per pool
+
+namespace casio {
+
+// the operation was cancelled through its stop token, or the device stopped / closed underneath it
+class Cancelled : public std::exception {
+public:
+    const char *what() const noexcept override { return "cancelled"; }
+};
+
+// a C API call failed
+class Error : public std::runtime_error {
+public:
+    Error(const char *call, int code) : std::runtime_error(std::string(call) + " failed"), code(code) {}
+    int code;
+};
+
+//============ worker pool ===================================================
+
+// resumes coroutine handles on a fixed set of threads. post() is lock-free and never blocks
+// (the wakeup is a futex / WakeByAddress), so the audio thread can use it.
+class ThreadPool {
+    BoundedQueue<void *, ASYNC_QUEUE_SIZE> queue;
+    std::atomic<uint32_t> signal = 0;
+    std::atomic<bool> running = true;
+    std::vector<std::thread> threads;
+
+    void work() {
+        while (true) {
+            auto ticket = signal.load(std::memory_order_acquire);
+            void *address;
+            if (queue.pop(address)) {
+                std::coroutine_handle<>::from_address(address).resume();
+                continue;
+            }
+            if (!running.load()) {
+                return;
+            }
+            signal.wait(ticket, std::memory_order_acquire);
+        }
+    }
+
+public:
+    explicit ThreadPool(int numThreads) {
+        for (int i = 0; i < numThreads; i++) {
+            threads.emplace_back([this] { work(); });
+        }
+    }
+    ~ThreadPool() {
+        running = false;
+        signal.fetch_add(1, std::memory_order_release);
+        signal.notify_all();
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // false only if the queue is full
+    bool post(std::coroutine_handle<> handle) {
+        if (!queue.push(handle.address())) {
+            return false;
+        }
+        signal.fetch_add(1, std::memory_order_release);
+        signal.notify_one();
+        return true;
+    }
+
+    // co_await pool.schedule() to hop onto the pool
+    auto schedule() {
+        struct Awaiter {
+            ThreadPool *pool;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) {
+                while (!pool->post(h)) {
+                    std::this_thread::yield();
+                }
+            }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{this};
+    }
+};
+
+//============ task ==========================================================
+
+template<typename T = void>
+class Task;
+
+namespace detail {
+
+// a finished task carries straight on with whoever awaited it
+struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template<typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+        auto next = h.promise().continuation;
+        return next ? next : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+};
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template<typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+    Task<T> get_return_object();
+    template<typename U>
+    void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+    T result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+template<>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+    void result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+} // namespace detail
+
+// lazily started coroutine; co_await it from another coroutine, or run it with sync_wait()
+template<typename T>
+class Task {
+public:
+    using promise_type = detail::Promise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+        handle.promise().continuation = continuation;
+        return handle; // (symmetric transfer, no stack growth on long chains)
+    }
+    T await_resume() { return handle.promise().result(); }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+
+template<typename T>
+Task<T> Promise<T>::get_return_object() { return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this)); }
+inline Task<void> Promise<void>::get_return_object() { return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this)); }
+
+// the outermost frame of sync_wait: runs the task, then flags the waiting thread
+struct SyncFrame {
+    struct promise_type {
+        std::mutex *mutex;
+        std::condition_variable *cv;
+        bool *done;
+        SyncFrame get_return_object() { return SyncFrame{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        auto final_suspend() noexcept {
+            struct Notify {
+                promise_type *p;
+                bool await_ready() const noexcept { return false; }
+                void await_suspend(std::coroutine_handle<>) const noexcept {
+                    std::lock_guard lock(*p->mutex);
+                    *p->done = true;
+                    p->cv->notify_one();
+                }
+                void await_resume() const noexcept {}
+            };
+            return Notify{this};
+        }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); } // (the task's own exceptions are caught inside)
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+template<typename T>
+SyncFrame syncRun(Task<T> &task, std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> &result, std::exception_ptr &error) {
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await task;
+            result.emplace(true);
+        }
+        else {
+            result.emplace(co_await task);
+        }
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+}
+
+} // namespace detail
+
+// block the calling thread until the task is done (it starts on this thread, and resumes wherever it suspends to)
+template<typename T>
+T sync_wait(Task<T> task) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> result;
+    std::exception_ptr error;
+
+    auto frame = detail::syncRun(task, result, error);
+    frame.handle.promise().mutex = &mutex;
+    frame.handle.promise().cv = &cv;
+    frame.handle.promise().done = &done;
+    frame.handle.resume();
+    {
+        std::unique_lock lock(mutex);
+        cv.wait(lock, [&] { return done; });
+    }
+    frame.handle.destroy();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if constexpr (!std::is_void_v<T>) {
+        return std::move(*result);
+    }
+}
+
+//============ blocks ========================================================
+
+namespace detail {
+
+struct BlockSlot {
+    std::atomic<uint64_t> sequence = 0; // 0 while being written
+    unsigned int timeFlags = 0;
+    uint64_t nanoSeconds = 0, samples = 0;
+    uint64_t activeInputs = 0;
+    std::unique_ptr<uint8_t[]> inputs; // [numInputs][bytesPerChannel]
+};
+
+} // namespace detail
+
+// one device buffer, as seen from a coroutine. the input data lives in a shared ring slot:
+// read() it, or check valid() after looking at input(), since a slot is reused ASYNC_BLOCK_SLOTS buffers later
+class Block {
+public:
+    uint64_t sequence; // counts bufferSwitches since the device was started, from 1. gaps = blocks this waiter missed
+    unsigned int timeFlags; // CASIO_TimeFlags
+    uint64_t nanoSeconds, samples;
+    uint64_t activeInputs;
+    int numInputs, frames, bytesPerChannel;
+    CASIO_SampleFormat format;
+
+    const void *input(int channel) const { return slot->inputs.get() + (size_t)channel * bytesPerChannel; }
+    bool valid() const { return slot->sequence.load(std::memory_order_acquire) == sequence; }
+    bool read(int channel, void *dst) const {
+        memcpy(dst, input(channel), bytesPerChannel);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return valid();
+    }
+
+private:
+    friend class Device;
+    const detail::BlockSlot *slot;
+};
+
+//============ device ========================================================
+
+class Runtime;
+class Device;
+
+// what Runtime::open hands out. dropping it doesn't wait: the driver keeps calling back into the Device until
+// it's closed, so the close and then the delete are posted to the control thread. (drop devices before the Runtime)
+struct DeviceDeleter {
+    void operator()(Device *device) const;
+};
+using DeviceHandle = std::unique_ptr<Device, DeviceDeleter>;
+
+class Device {
+public:
+    Device(const Device &) = delete;
+    Device &operator=(const Device &) = delete;
+
+    CASIO_Device handle() const { return device; }
+    const CASIO_DeviceProperties &properties() const { return props; }
+    double sampleRate() const { return rate; }
+
+    // runs on the audio thread for every event of this device (bufferSwitch, sample rate change, ...).
+    // without one, outputs are zeroed. set it before start()
+    void setHandler(std::function<void(CASIO_Event &)> handler) { realtimeHandler = std::move(handler); }
+
+    // awaitable driver calls, run on the runtime's control thread. throw Error or Cancelled
+    Task<void> start(std::stop_token stop = {});
+    Task<void> stop(std::stop_token stop = {});
+    Task<void> close(); // (optional, to know when it's done: the handle closes the device anyway)
+
+    // the next buffer the device delivers after this call
+    auto next_block(std::stop_token stop = {}) {
+        return BlockAwaiter{this, published.load(), std::move(stop)};
+    }
+
+private:
+    friend class Runtime;
+    friend struct DeviceDeleter;
+    explicit Device(Runtime *runtime) : runtime(runtime) {}
+    ~Device();
+
+    struct BlockAwaiter;
+    struct CancelWaiter {
+        BlockAwaiter *awaiter;
+        void operator()() const noexcept { awaiter->device->cancel(awaiter); }
+    };
+
+    // whoever takes the awaiter out of its waiter slot (audio thread, stop callback, cancelAll) also resumes it.
+    // unless await_suspend hasn't finished yet: then it just marks it Claimed, and await_suspend resumes inline
+    enum WaiterState { Registering, Waiting, Claimed };
+
+    struct BlockAwaiter {
+        Device *device;
+        uint64_t after;
+        std::stop_token stop;
+        std::coroutine_handle<> handle;
+        std::atomic<int> state = Registering;
+        bool cancelled = false, overflow = false;
+        std::atomic<int> slotIndex = -1; // moves if the audio thread has to park it again (see requeue)
+        std::optional<std::stop_callback<CancelWaiter>> onStop;
+
+        BlockAwaiter(Device *device, uint64_t after, std::stop_token stop) : device(device), after(after), stop(std::move(stop)) {}
+        BlockAwaiter(BlockAwaiter &&other) noexcept : device(other.device), after(other.after), stop(std::move(other.stop)) {}
+
+        bool await_ready() const noexcept { return device->published.load() > after; }
+        bool await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            if (!device->accepting.load() || stop.stop_requested()) {
+                cancelled = true;
+                return false;
+            }
+            int index = -1;
+            for (int i = 0; i < ASYNC_MAX_WAITERS && index < 0; i++) {
+                BlockAwaiter *expected = nullptr;
+                slotIndex.store(i);
+                if (device->waiters[i].compare_exchange_strong(expected, this)) {
+                    index = i;
+                }
+            }
+            if (index < 0) {
+                overflow = true;
+                return false;
+            }
+            // a block may have landed between await_ready and registering, or stop()/close() may have swept the
+            // slots before we got into one (both sides seq_cst: either it saw us, or we see accepting cleared).
+            // take the slot back if we still can, otherwise whoever took it resumes us
+            auto stopped = !device->accepting.load();
+            if (stopped || device->published.load() > after) {
+                BlockAwaiter *expected = this;
+                if (device->waiters[index].compare_exchange_strong(expected, nullptr)) {
+                    cancelled = stopped;
+                    return false;
+                }
+            }
+            if (stop.stop_possible()) {
+                onStop.emplace(stop, CancelWaiter{this}); // (runs right here if stop was requested in the meantime)
+            }
+            int expected = Registering;
+            return state.compare_exchange_strong(expected, Waiting);
+        }
+        Block await_resume() {
+            onStop.reset(); // (waits for a cancellation in flight on another thread to finish)
+            if (cancelled) {
+                throw Cancelled();
+            }
+            if (overflow) {
+                throw Error("next_block (too many waiters)", -1);
+            }
+            return device->makeBlock(device->published.load());
+        }
+    };
+
+    Runtime *runtime;
+    CASIO_Device device = nullptr;
+    CASIO_DeviceProperties props = {};
+    double rate = 0;
+    std::function<void(CASIO_Event &)> realtimeHandler;
+
+    detail::BlockSlot slots[ASYNC_BLOCK_SLOTS];
+    std::atomic<uint64_t> published = 0;
+    std::atomic<BlockAwaiter *> waiters[ASYNC_MAX_WAITERS] = {};
+    std::atomic<bool> accepting = false; // waiters are welcome: started and not stopping
+
+    void allocate() {
+        for (auto &slot : slots) {
+            slot.inputs.reset(new uint8_t[(size_t)(props.numInputs ? props.numInputs : 1) * props.bufferByteLength]());
+        }
+    }
+
+    Block makeBlock(uint64_t sequence) const {
+        auto &slot = slots[sequence % ASYNC_BLOCK_SLOTS];
+        Block block;
+        block.sequence = sequence;
+        block.timeFlags = slot.timeFlags;
+        block.nanoSeconds = slot.nanoSeconds;
+        block.samples = slot.samples;
+        block.activeInputs = slot.activeInputs;
+        block.numInputs = props.numInputs;
+        block.frames = props.bufferSampleLength;
+        block.bytesPerChannel = props.bufferByteLength;
+        block.format = props.sampleFormat;
+        block.slot = &slot;
+        return block;
+    }
+
+    // hand a waiter taken out of its slot back to its coroutine (see WaiterState). false if the pool was full
+    bool wake(BlockAwaiter *awaiter);
+    // audio thread: park a waiter that couldn't be woken until the next buffer
+    void requeue(BlockAwaiter *awaiter);
+    // off the audio thread: a waiter's stop token fired
+    void cancel(BlockAwaiter *awaiter);
+    // once the audio thread is quiet: fail everybody still waiting
+    void cancelAll();
+
+    // audio thread
+    void onEvent(CASIO_Event *event);
+};
+
+//============ runtime =======================================================
+
+struct DeviceInfo {
+    CASIO_DeviceID id;
+    std::string name;
+};
+
+// one per process (the C API has a single global callback)
+class Runtime {
+public:
+    explicit Runtime(int workers = 2) : workerPool(workers) {
+        instance() = this;
+        control = std::thread([this] { controlLoop(); });
+        auto result = sync_wait(onControl([] { return CASIO_Init(&Runtime::callback); }));
+        if (result != 0) {
+            shutdown();
+            throw Error("CASIO_Init", result);
+        }
+    }
+    ~Runtime() {
+        sync_wait(onControl([] { return CASIO_Shutdown(); }));
+        shutdown();
+    }
+    Runtime(const Runtime &) = delete;
+    Runtime &operator=(const Runtime &) = delete;
+
+    ThreadPool &pool() { return workerPool; }
+
+    // library log messages, called on whatever thread logged
+    void setLogHandler(std::function<void(const char *)> handler) { logHandler = std::move(handler); }
+
+    Task<std::vector<DeviceInfo>> enumerate() {
+        co_return co_await onControl([] {
+            CASIO_DeviceInfo *infos;
+            int count = 0;
+            std::vector<DeviceInfo> result;
+            if (CASIO_EnumerateDevices(&infos, &count) == 0) {
+                for (int i = 0; i < count; i++) {
+                    result.push_back({infos[i].id, infos[i].name});
+                }
+            }
+            return result;
+        });
+    }
+
+    Task<DeviceHandle> open(CASIO_DeviceID id, std::stop_token stop = {}) {
+        DeviceHandle device(new Device(this));
+        auto raw = device.get();
+        co_await onControl([raw, id] {
+            auto result = CASIO_OpenDevice(id, raw, &raw->device);
+            if (result != 0) {
+                throw Error("CASIO_OpenDevice", result);
+            }
+            CASIO_GetProperties(raw->device, &raw->props, &raw->rate);
+            return 0;
+        }, stop);
+        if (stop.stop_requested()) {
+            co_await device->close(); // (cancelled while the driver was opening)
+            throw Cancelled();
+        }
+        device->allocate();
+        co_return std::move(device);
+    }
+
+    // run fn on the control thread, and resume the awaiting coroutine on the pool with its result
+    template<typename F>
+    Task<std::invoke_result_t<F>> onControl(F fn, std::stop_token stop = {}) {
+        using R = std::invoke_result_t<F>;
+        struct Awaiter {
+            Runtime *runtime;
+            F &fn;
+            std::stop_token &stop;
+            std::optional<std::conditional_t<std::is_void_v<R>, bool, R>> result;
+            std::exception_ptr error;
+
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) {
+                runtime->post([this, h] {
+                    if (stop.stop_requested()) {
+                        error = std::make_exception_ptr(Cancelled());
+                    }
+                    else {
+                        try {
+                            if constexpr (std::is_void_v<R>) {
+                                fn();
+                                result.emplace(true);
+                            }
+                            else {
+                                result.emplace(fn());
+                            }
+                        }
+                        catch (...) {
+                            error = std::current_exception();
+                        }
+                    }
+                    while (!runtime->workerPool.post(h)) {
+                        std::this_thread::yield();
+                    }
+                });
+            }
+            R await_resume() {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+                if constexpr (!std::is_void_v<R>) {
+                    return std::move(*result);
+                }
+            }
+        };
+        co_return co_await Awaiter{this, fn, stop, std::nullopt, nullptr};
+    }
+
+private:
+    friend class Device;
+    friend struct DeviceDeleter;
+
+    ThreadPool workerPool;
+    std::thread control;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> jobs;
+    bool quitting = false;
+    std::function<void(const char *)> logHandler;
+
+    static Runtime *&instance() {
+        static Runtime *runtime = nullptr;
+        return runtime;
+    }
+
+    static int CASIO_CDECL callback(CASIO_Event *event, CASIO_Device /*device*/, void *userData) {
+        if (event->eventType == CASIO_EventType_Log) {
+            if (auto runtime = instance(); runtime && runtime->logHandler) {
+                runtime->logHandler(event->logEvent.message);
+            }
+            return 0;
+        }
+        if (userData) {
+            ((Device *)userData)->onEvent(event);
+        }
+        return 0;
+    }
+
+    void post(std::function<void()> job) {
+        {
+            std::lock_guard lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        cv.notify_one();
+    }
+
+    void controlLoop() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock lock(mutex);
+                cv.wait(lock, [this] { return quitting || !jobs.empty(); });
+                if (jobs.empty()) {
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    void shutdown() {
+        {
+            std::lock_guard lock(mutex);
+            quitting = true;
+        }
+        cv.notify_one();
+        control.join();
+        instance() = nullptr;
+    }
+};
+
+//============ device, out of line ===========================================
+
+inline void DeviceDeleter::operator()(Device *device) const {
+    // (not waiting for it: that deadlocks when the handle goes away on the control thread itself, or on a pool
+    // thread the close would need to resume on)
+    device->runtime->post([device] {
+        device->accepting = false;
+        if (device->device) {
+            CASIO_CloseDevice(device->device);
+            device->device = nullptr;
+        }
+        device->cancelAll();
+        delete device;
+    });
+}
+
+inline Device::~Device() {
+    assert(!device); // (only ever deleted by DeviceDeleter, after closing)
+}
+
+inline Task<void> Device::start(std::stop_token stop) {
+    co_await runtime->onControl([this] {
+        accepting = true;
+        auto result = CASIO_Start(device);
+        if (result != 0) {
+            accepting = false;
+            throw Error("CASIO_Start", result);
+        }
+    }, stop);
+}
+
+inline Task<void> Device::stop(std::stop_token stop) {
+    co_await runtime->onControl([this] {
+        accepting = false;
+        auto result = CASIO_Stop(device);
+        cancelAll(); // (no more callbacks now)
+        if (result != 0) {
+            throw Error("CASIO_Stop", result);
+        }
+    }, stop);
+}
+
+inline Task<void> Device::close() {
+    co_await runtime->onControl([this] {
+        accepting = false;
+        if (device) {
+            CASIO_CloseDevice(device);
+            device = nullptr;
+        }
+        cancelAll();
+    });
+}
+
+inline bool Device::wake(BlockAwaiter *awaiter) {
+    if (awaiter->state.exchange(Claimed) == Waiting) {
+        if (!runtime->workerPool.post(awaiter->handle)) {
+            awaiter->state.store(Waiting);
+            return false;
+        }
+    }
+    return true;
+}
+
+inline void Device::cancel(BlockAwaiter *awaiter) {
+    BlockAwaiter *expected = awaiter;
+    if (waiters[awaiter->slotIndex.load()].compare_exchange_strong(expected, nullptr)) {
+        awaiter->cancelled = true;
+        while (!wake(awaiter)) {
+            std::this_thread::yield();
+        }
+    }
+    // (otherwise the audio thread got there first, and the block wins)
+}
+
+inline void Device::cancelAll() {
+    for (auto &waiter : waiters) {
+        if (auto awaiter = waiter.exchange(nullptr)) {
+            awaiter->cancelled = true;
+            while (!wake(awaiter)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+inline void Device::requeue(BlockAwaiter *awaiter) {
+    // its old slot may already hold a new waiter: any free slot will do. (a cancel looking in the old slot misses
+    // it, and it gets the next block instead, as when the audio thread wins that race)
+    while (true) {
+        for (int i = 0; i < ASYNC_MAX_WAITERS; i++) {
+            BlockAwaiter *expected = nullptr;
+            awaiter->slotIndex.store(i);
+            if (waiters[i].compare_exchange_strong(expected, awaiter)) {
+                return;
+            }
+        }
+        // every slot taken and the pool still full: nowhere to park it, and dropping it would hang its coroutine
+        if (wake(awaiter)) {
+            return;
+        }
+        std::this_thread::yield();
+    }
+}
+
+inline void Device::onEvent(CASIO_Event *event) {
+    event->handled = true;
+    if (realtimeHandler) {
+        realtimeHandler(*event);
+    }
+    else if (event->eventType == CASIO_EventType_BufferSwitch) {
+        for (int i = 0; i < props.numOutputs; i++) {
+            memset(event->bufferSwitchEvent.outputs[i], 0, props.bufferByteLength);
+        }
+    }
+    if (event->eventType != CASIO_EventType_BufferSwitch) {
+        return;
+    }
+
+    // publish the block
+    auto sequence = published.load(std::memory_order_relaxed) + 1;
+    auto &slot = slots[sequence % ASYNC_BLOCK_SLOTS];
+    auto &e = event->bufferSwitchEvent;
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.timeFlags = e.time.flags;
+    slot.nanoSeconds = e.time.nanoSeconds;
+    slot.samples = e.time.samples;
+    slot.activeInputs = e.activeInputs;
+    for (int i = 0; i < props.numInputs; i++) {
+        memcpy(slot.inputs.get() + (size_t)i * props.bufferByteLength, e.inputs[i], props.bufferByteLength);
+    }
+    slot.sequence.store(sequence, std::memory_order_release);
+    published.store(sequence); // (seq_cst, pairs with the waiter's registration)
+
+    // and wake whoever was waiting for it
+    for (auto &waiter : waiters) {
+        if (waiter.load()) {
+            if (auto awaiter = waiter.exchange(nullptr)) {
+                if (!wake(awaiter)) {
+                    requeue(awaiter); // pool queue full: next buffer, then
+                }
+            }
+        }
+    }
+}
+
+} // namespace casio
@@ -1,675 +1,782 @@
 // CASIOClient.cpp : Defines the exported functions for the DLL application.
 //
 
-#include "header.h"
 #include "CASIOClient.h"
+#include "engine.h"
 
-#include "util/unicodestuff.h"
-
-#include <objbase.h> // COM stuff
 #include <cstdio>
+#include <cstring>
 #include <string>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
 
 #include <cassert>
 
-#include "../sdk/ASIOSDK2.3/common/iasiodrv.h"
-
-//============ globals =======================================================
-
-#define MAX_REGKEY_LENGTH 512
-#define MAX_REGVALUE_LENGTH 512
-
-#define MAX_INPUT_CHANNELS 64
-#define MAX_OUTPUT_CHANNELS 64
+// the ones CASIO_EnumerateDevices lists (see backend.h)
+static const HostBackend *const hostBackends[] = {
+#ifdef _WIN32
+    &asioBackend,
+#endif
+#ifdef CASIO_NULL_BACKEND
+    &nullBackend,
+#endif
+    nullptr
+};
 
-#define MAX_OPEN_DEVICES 8
+//==============================================================================
 
-static HRESULT hr;
-#define MAX_ERROR_LENGTH 1024
-static char errorMessage[MAX_ERROR_LENGTH];
-static CASIO_EventCallback apiClientCallback = nullptr;
+CASIOCLIENT_API int CASIO_CDECL CASIO_Init(CASIO_EventCallback callback)
+{
+    apiClientCallback = callback;
+    for (auto backend = hostBackends; *backend; backend++) {
+        if ((*backend)->init && !(*backend)->init()) {
+            return -1;
+        }
+    }
+    logMessage("hello from CASIO_Init");
+    return 0;
+}
 
-struct _CASIO_DeviceID {
-    CLSID clsid;
-    std::string name;
-};
+CASIOCLIENT_API int CASIO_CDECL CASIO_Shutdown()
+{
+    for (auto backend = hostBackends; *backend; backend++) {
+        if ((*backend)->shutdown) {
+            (*backend)->shutdown();
+        }
+    }
+    logMessage("Goodbye from CASIO_Shutdown");
+    return 0;
+}
 
-struct _CASIO_Device {
-    CASIO_DeviceID id;
-    IASIO *asioDriver;
-    void *userData;
-
-    // various internal properties
-    char name[512]; // from the COM interface
-    long driverVersion;
-    long numInputs, numOutputs;
-    struct {
-        long minSize, maxSize, prefSize, granularity;
-        long currentSize;
-    } buffer;
-    ASIOSampleRate sampleRate;
-    bool supportsOutputReady;
-    long inputLatency, outputLatency;
-
-    ASIOBufferInfo bufferInfos[MAX_INPUT_CHANNELS + MAX_OUTPUT_CHANNELS];
-    ASIOChannelInfo channelInfos[MAX_INPUT_CHANNELS + MAX_OUTPUT_CHANNELS];
-
-    ASIOCallbacks callbacks; // ASIO keeps a pointer to this, not just the content
-
-    // destructured buffer pointers, easier to use in callback
-    struct {
-        void *inputs[MAX_INPUT_CHANNELS];
-        void *outputs[MAX_OUTPUT_CHANNELS];
-    } bufferPtrs[2]; // for double buffers
-
-    bool started = false;
-    int globalIndex; // since we only support a limited amount of ASIO devices at once, due to the context-less callback mechanism
-};
+CASIOCLIENT_API int CASIO_CDECL CASIO_EnumerateDevices(CASIO_DeviceInfo **outInfo, int *outCount)
+{
+    std::vector<CASIO_DeviceID> ids;
+    for (auto backend = hostBackends; *backend; backend++) {
+        if ((*backend)->enumerate) {
+            (*backend)->enumerate(ids);
+        }
+    }
+    auto count = ids.size();
+    *outInfo = new CASIO_DeviceInfo[count];
+    *outCount = (int)count;
+    for (size_t i = 0; i < count; i++) {
+        (*outInfo)[i].id = ids[i];
+        // "external" (visible to client) name is just a const char * from the internal std::string
+        (*outInfo)[i].name = ids[i]->name.c_str();
+    }
+    return 0;
+}
 
-//============ logging stuff =================================================
-
-void logMessage(const char *message) {
-    CASIO_Event event;
-    event.eventType = CASIO_EventType_Log;
-    // .handled doesn't matter
-    event.logEvent.message = message;
-    apiClientCallback(&event, nullptr, nullptr);
-}
-
-#define VSPRINTF_BUFFER_LEN 10*1024
-char formatBuffer[VSPRINTF_BUFFER_LEN];
-void logFormat(const char *format, ...) {
-    va_list args;
-    va_start(args, format);
-    vsprintf_s<VSPRINTF_BUFFER_LEN>(formatBuffer, format, args);
-    va_end(args);
-    //
-    logMessage(formatBuffer);
-}
-
-#define DEV_FORMAT_BUFFER_LEN 1024
-char devFormat[DEV_FORMAT_BUFFER_LEN];
-void logFormatDev(CASIO_Device d, const char *format, ...) {
-    sprintf_s<DEV_FORMAT_BUFFER_LEN>(devFormat, "[%s] %s", d->name, format);
-    //
-    va_list args;
-    va_start(args, format);
-    vsprintf_s<VSPRINTF_BUFFER_LEN>(formatBuffer, devFormat, args);
-    va_end(args);
-    //
-    logMessage(formatBuffer);
-}
-
-//============ callbacks =====================================================
-
-// these could be avoided if the ASIO header didn't predefine NATIVE_INT64 for us
-// (don't want to modify the SDK here to make it easier for other people to compile)
-inline UINT64 timestampToUint64(ASIOTimeStamp &x) {
-    UINT64 ret;
-    ((UINT32 *)&ret)[0] = x.lo;
-    ((UINT32 *)&ret)[1] = x.hi;
+static CASIO_Device newDevice(CASIO_DeviceID id, const HostBackend *backend, void *userData)
+{
+    auto ret = new _CASIO_Device;
+    ret->id = id;
+    ret->backend = backend;
+    ret->userData = userData;
+    snprintf(ret->name, sizeof(ret->name), "%s", id ? id->name.c_str() : "");
     return ret;
 }
-inline UINT64 samplesToUint64(ASIOSamples &x) {
-    UINT64 ret;
-    ((UINT32 *)&ret)[0] = x.lo;
-    ((UINT32 *)&ret)[1] = x.hi;
-    return ret;
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_OpenDevice(CASIO_DeviceID id, void *userData, CASIO_Device *outDevice)
+{
+    TIMELINE_SPAN("CASIO_OpenDevice", id->name.c_str());
+    auto ret = newDevice(id, id->backend, userData);
+    if (!id->backend->open(ret, id)) {
+        delete ret;
+        *outDevice = nullptr;
+        return -1;
+    }
+    engineDeviceOpened(ret);
+    *outDevice = ret;
+    return 0;
 }
 
-ASIOTime* onBufferSwitchTimeInfo(CASIO_Device device, ASIOTime* timeInfo, long doubleBufferIndex, ASIOBool directProcess)
+CASIOCLIENT_API int CASIO_CDECL CASIO_CloseDevice(CASIO_Device device)
 {
-    // new callback with time info. makes ASIOGetSamplePosition() and various
-    // calls to ASIOGetSampleRate obsolete,
-    // and allows for timecode sync etc. to be preferred; will be used if
-    // the driver calls asioMessage with selector kAsioSupportsTimeInfo.
+    TIMELINE_SPAN("CASIO_CloseDevice", device ? device->name : nullptr);
+    if (device && device->traceWriter.attached()) {
+        CASIO_StopTraceCapture(device);
+    }
+    if (device && device->sharedServer.attached()) {
+        CASIO_StopServing(device);
+    }
+    if (device && device->losslessWriter.attached()) {
+        CASIO_StopLosslessCapture(device, nullptr);
+    }
+    if (device) {
+        if (auto bridge = device->netBridge.detach()) {
+            netBridgeDestroy(bridge);
+        }
+        if (auto graph = device->graph.detach()) {
+            graphDestroy(graph);
+        }
+        delete device->graphHandle;
+    }
+    if (device && device->standby) {
+        // (stopped first, so it's done calling back into us before either goes away)
+        auto standby = device->standby;
+        CASIO_Stop(standby);
+        device->standby = nullptr;
+        CASIO_CloseDevice(standby);
+    }
+    if (device) {
+        if (device->backend->close) {
+            device->backend->close(device);
+        }
+        engineFreeBuffers(device);
+        delete device;
+    }
+    return 0;
+}
 
-    // (see onBufferSwitch comments for further info)
+CASIOCLIENT_API int CASIO_CDECL CASIO_Start(CASIO_Device device)
+{
+    TIMELINE_SPAN("CASIO_Start", device->name);
+    if (!device->backend->start) {
+        logFormatDev(device, "can't be started");
+        return -1;
+    }
+    if (device->failedOver) {
+        device->started = true; // the standby is doing the actual work
+        return 0;
+    }
+    if (!device->started) {
+        if (device->backend->start(device)) {
+            device->started = true;
+            return 0;
+        }
+    }
+    return -1;
+}
 
-    // send event
-    CASIO_Event event = {};
-    event.eventType = CASIO_EventType_BufferSwitch;
-    event.handled = false;
-
-    event.bufferSwitchEvent.time.flags = 0;
-    if (timeInfo->timeInfo.flags & kSystemTimeValid) {
-        event.bufferSwitchEvent.time.nanoSeconds = timestampToUint64(timeInfo->timeInfo.systemTime);
-        event.bufferSwitchEvent.time.flags |= CASIO_TimeFlag_NanoSecs;
-    }
-    if (timeInfo->timeInfo.flags & kSamplePositionValid) {
-        event.bufferSwitchEvent.time.samples = samplesToUint64(timeInfo->timeInfo.samplePosition);
-        event.bufferSwitchEvent.time.flags |= CASIO_TimeFlag_Samples;
-    }
-    if (timeInfo->timeCode.flags & kTcValid) {
-        event.bufferSwitchEvent.time.tcSamples = samplesToUint64(timeInfo->timeCode.timeCodeSamples);
-        event.bufferSwitchEvent.time.flags |= CASIO_TimeFlag_TCSamples;
-    }
-
-    event.bufferSwitchEvent.inputs = device->bufferPtrs[doubleBufferIndex].inputs;
-    event.bufferSwitchEvent.outputs = device->bufferPtrs[doubleBufferIndex].outputs;
-    apiClientCallback(&event, device, device->userData);
-
-    // finally if the driver supports the ASIOOutputReady() optimization, do it here, all data are in place
-    if (device->supportsOutputReady) {
-        device->asioDriver->outputReady();
-    }
-
-    return nullptr; // ?? what of that ASIOTime * we're supposed to return?
-}
-
-void onBufferSwitch(CASIO_Device device, long doubleBufferIndex, ASIOBool directProcess)
-{
-    // the actual processing callback.
-    // Beware that this is normally in a seperate thread, hence be sure that you take care
-    // about thread synchronization. This is omitted here for simplicity.
-
-    // bufferSwitch indicates that both input and output are to be processed.
-    // the current buffer half index (0 for A, 1 for B) determines
-    // - the output buffer that the host should start to fill. the other buffer
-    //   will be passed to output hardware regardless of whether it got filled
-    //   in time or not.
-    // - the input buffer that is now filled with incoming data. Note that
-    //   because of the synchronicity of i/o, the input always has at
-    //   least one buffer latency in relation to the output.
-    // directProcess suggests to the host whether it should immedeately
-    // start processing (directProcess == ASIOTrue), or whether its process
-    // should be deferred because the call comes from a very low level
-    // (for instance, a high level priority interrupt), and direct processing
-    // would cause timing instabilities for the rest of the system. If in doubt,
-    // directProcess should be set to ASIOFalse.
-    // Note: bufferSwitch may be called at interrupt time for highest efficiency.
-
-    // as this is a "back door" into the bufferSwitchTimeInfo a timeInfo needs to be created
-    // though it will only set the timeInfo.samplePosition and timeInfo.systemTime fields and the according flags
-    ASIOTime  timeInfo;
-    memset(&timeInfo, 0, sizeof(timeInfo));
-
-    // get the time stamp of the buffer, not necessary if no
-    // synchronization to other media is required
-    if (device->asioDriver->getSamplePosition(&timeInfo.timeInfo.samplePosition, &timeInfo.timeInfo.systemTime) == ASE_OK) {
-        timeInfo.timeInfo.flags = kSystemTimeValid | kSamplePositionValid;
-    }
-
-    onBufferSwitchTimeInfo(device, &timeInfo, doubleBufferIndex, directProcess);
-}
-
-void onSampleRateDidChange(CASIO_Device device, ASIOSampleRate sRate)
-{
-    // gets called when the AudioStreamIO detects a sample rate change
-    // If sample rate is unknown, 0 is passed (for instance, clock loss
-    // when externally synchronized).
-    //
-    // do whatever you need to do if the sample rate changed
-    // usually this only happens during external sync.
-    // Audio processing is not stopped by the driver, actual sample rate
-    // might not have even changed, maybe only the sample rate status of an
-    // AES/EBU or S/PDIF digital input at the audio device.
-    // You might have to update time/sample related conversion routines, etc.
-    CASIO_Event event;
-    event.eventType = CASIO_EventType_SampleRateChanged;
-    event.handled = false;
-    event.sampleRateChangedEvent.newSampleRate = sRate;
-    apiClientCallback(&event, device, device->userData);
-}
-
-long onAsioMessage(CASIO_Device device, long selector, long value, void* message, double* opt)
-{
-    // generic callback for various purposes, see selectors below.
-    // note this is only present if the asio version is 2 or higher
-    switch (selector) {
-    case kAsioSelectorSupported:
-        switch (value) {
-        case kAsioEngineVersion:
-        case kAsioResetRequest:
-        case kAsioBufferSizeChange:
-        case kAsioResyncRequest:
-        case kAsioLatenciesChanged:
-        case kAsioSupportsTimeInfo:
-        case kAsioSupportsTimeCode:
-        case kAsioOverload:
-            return 1;
-        default:
+CASIOCLIENT_API int CASIO_CDECL CASIO_Stop(CASIO_Device device)
+{
+    TIMELINE_SPAN("CASIO_Stop", device->name);
+    if (device->backend->stop && device->started) {
+        // flagged before stopping, so a standby doesn't mistake the silence for a failure
+        device->started = false;
+        device->lastBufferAt = 0;
+        if (device->failedOver) {
+            device->backend->stop(device); // (the standby mutes itself, whatever state this driver is in)
+            logFormatDev(device, "stopped (standby muted)");
             return 0;
         }
-        break;
-
-    case kAsioEngineVersion:
-        // return the supported ASIO version of the host application
-        // If a host applications does not implement this selector, ASIO 1.0 is assumed
-        // by the driver
-        return 2;
-
-    case kAsioResetRequest:
-        // defer the task and perform the reset of the driver during the next "safe" situation
-        // You cannot reset the driver right now, as this code is called from the driver.
-        // Reset the driver is done by completely destruct is. I.e. ASIOStop(), ASIODisposeBuffers(), Destruction
-        // Afterwards you initialize the driver again.
-        logMessage("kAsioResetRequest");
-        return 0;
+        if (device->backend->stop(device)) {
+            return 0;
+        }
+        device->started = true;
+    }
+    return -1;
+}
 
-    case kAsioBufferSizeChange:
-        logMessage("kAsioBufferSizeChange");
-        return 0;
+CASIOCLIENT_API int CASIO_CDECL CASIO_GetProperties(CASIO_Device device, CASIO_DeviceProperties *props, double *currentSampleRate)
+{
+    props->name = device->name;
+    props->numInputs = device->numInputs;
+    props->numOutputs = device->numOutputs;
+    props->bufferSampleLength = device->buffer.currentSize;
 
-    case kAsioResyncRequest:
-        // This informs the application, that the driver encountered some non fatal data loss.
-        // It is used for synchronization purposes of different media.
-        // Added mainly to work around the Win16Mutex problems in Windows 95/98 with the
-        // Windows Multimedia system, which could loose data because the Mutex was hold too long
-        // by another thread.
-        // However a driver can issue it in other situations, too.
-        logMessage("kAsioResyncRequest");
-        return 0;
+    props->bufferByteLength = device->buffer.currentSize * device->sampleSize;
+    props->sampleFormat = device->sampleFormat;
+    props->inputLatency = device->inputLatency;
+    props->outputLatency = device->outputLatency;
+    props->latencyMeasured = device->latencyMeasured;
+    props->roundTripLatency = device->latencyMeasured ? (int)lround(device->measuredLatency) :
+        (int)(device->inputLatency + device->outputLatency);
 
-    case kAsioLatenciesChanged:
-        // This will inform the host application that the drivers were latencies changed.
-        // Beware, it this does not mean that the buffer sizes have changed!
-        // You might need to update internal delay data.
-        logMessage("kAsioLatenciesChanged");
-        return 0;
+    // sample rate is separate because it can change ...
+    *currentSampleRate = device->sampleRate;
+    return 0;
+}
 
-    case kAsioSupportsTimeInfo:
-        // informs the driver wether the asioCallbacks.bufferSwitchTimeInfo() callback
-        // is supported.
-        // For compatibility with ASIO 1.0 drivers the host application should always support
-        // the "old" bufferSwitch method, too.
-        return 1;
-
-    case kAsioSupportsTimeCode:
-        // informs the driver wether application is interested in time code info.
-        // If an application does not need to know about time code, the driver has less work
-        // to do.
-        return 0;
+CASIOCLIENT_API int CASIO_CDECL CASIO_ShowControlPanel(CASIO_Device device)
+{
+    if (!device->backend->controlPanel || !device->backend->controlPanel(device)) {
+        logFormatDev(device, "failed to show control panel");
+        return -1;
+    }
+    return 0;
+}
 
-    case kAsioOverload:
-        logMessage("kAsioOverload!");
-        return 1;
-
-    default:
-        logFormat("unhandled asioMessage selector %d\n", selector);
-    }
-    return 0;
-}
-
-//============ below is our attempt to support multiple ASIO devices at once, since the callbacks have no user data / context arguments
-
-static int globalNumDevices = 0;
-static CASIO_Device globalDevices[MAX_OPEN_DEVICES];
-
-#define ASIO_CALLBACKS_DECL(x) \
-ASIOTime* onBufferSwitchTimeInfo_##x(ASIOTime* timeInfo, long doubleBufferIndex, ASIOBool directProcess) { \
-    return onBufferSwitchTimeInfo(globalDevices[x], timeInfo, doubleBufferIndex, directProcess); \
-} \
-void onBufferSwitch_##x(long doubleBufferIndex, ASIOBool directProcess) { \
-    onBufferSwitch(globalDevices[x], doubleBufferIndex, directProcess); \
-} \
-void onSampleRateDidChange_##x(ASIOSampleRate sRate) { \
-    onSampleRateDidChange(globalDevices[x], sRate); \
-} \
-long onAsioMessage_##x(long selector, long value, void* message, double* opt) { \
-    return onAsioMessage(globalDevices[x], selector, value, message, opt); \
-}
-
-ASIO_CALLBACKS_DECL(0)
-ASIO_CALLBACKS_DECL(1)
-ASIO_CALLBACKS_DECL(2)
-ASIO_CALLBACKS_DECL(3)
-ASIO_CALLBACKS_DECL(4)
-ASIO_CALLBACKS_DECL(5)
-ASIO_CALLBACKS_DECL(6)
-ASIO_CALLBACKS_DECL(7)
-
-#define ASIO_CALLBACK_STRUCT(x) { onBufferSwitch_##x, onSampleRateDidChange_##x, onAsioMessage_##x, onBufferSwitchTimeInfo_##x }
-static ASIOCallbacks globalCallbacks[] = {
-    ASIO_CALLBACK_STRUCT(0),
-    ASIO_CALLBACK_STRUCT(1),
-    ASIO_CALLBACK_STRUCT(2),
-    ASIO_CALLBACK_STRUCT(3),
-    ASIO_CALLBACK_STRUCT(4),
-    ASIO_CALLBACK_STRUCT(5),
-    ASIO_CALLBACK_STRUCT(6),
-    ASIO_CALLBACK_STRUCT(7),
-};
+CASIOCLIENT_API int CASIO_CDECL CASIO_EnableMetering(CASIO_Device device, bool enable)
+{
+    if (enable && device->sampleFormat == CASIO_SampleFormat_Unknown) {
+        logFormatDev(device, "metering not supported for this sample format");
+        return -1;
+    }
+    if (enable && !device->meters.enabled) {
+        // the audio thread may still be finishing a buffer it started metering before a disable, so it does the reset
+        meterRequestReset(&device->meters);
+    }
+    device->meters.enabled = enable;
+    return 0;
+}
 
-//==============================================================================
+CASIOCLIENT_API int CASIO_CDECL CASIO_GetMeters(CASIO_Device device, CASIO_ChannelMeter *inputs, CASIO_ChannelMeter *outputs, uint64_t *bufferCount)
+{
+    if (!device->meters.enabled) {
+        return -1;
+    }
+    MeterSnapshot snapshot;
+    meterRead(&device->meters, &snapshot);
+    if (inputs) {
+        memcpy(inputs, snapshot.inputs, sizeof(CASIO_ChannelMeter) * device->numInputs);
+    }
+    if (outputs) {
+        memcpy(outputs, snapshot.outputs, sizeof(CASIO_ChannelMeter) * device->numOutputs);
+    }
+    if (bufferCount) {
+        *bufferCount = snapshot.bufferCount;
+    }
+    return 0;
+}
 
-CASIOCLIENT_API int CDECL CASIO_Init(CASIO_EventCallback callback)
+CASIOCLIENT_API int CASIO_CDECL CASIO_SetSilenceDetection(CASIO_Device device, bool enable, float threshold, int holdMilliseconds)
 {
-    apiClientCallback = callback;
-    hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED); //COINIT_MULTITHREADED
-    if (SUCCEEDED(hr)) {
-        logMessage("hello from CASIO_Init");
-        return 0;
+    if (enable && device->sampleFormat == CASIO_SampleFormat_Unknown) {
+        logFormatDev(device, "silence detection not supported for this sample format");
+        return -1;
     }
-    else {
-        logMessage("CoInitializeEx failed :(");
+    // hold is kept in samples so it doesn't depend on the buffer size. it's converted at the current rate,
+    // a later rate change only stretches/shrinks it, which is harmless for this purpose
+    device->silence.threshold = threshold < 0 ? 0.0f : threshold;
+    device->silence.holdSamples = (int64_t)((holdMilliseconds < 0 ? 0 : holdMilliseconds) * device->sampleRate / 1000.0);
+    device->silence.enabled = enable;
+    return 0;
+}
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_ScheduleAction(CASIO_Device device, const CASIO_ScheduledAction *action)
+{
+    if (!schedulePost(&device->scheduler, *action)) {
+        logFormatDev(device, "%d scheduled actions already waiting, action refused", SCHEDULE_MAX_PENDING);
         return -1;
     }
+    return 0;
 }
 
-CASIOCLIENT_API int CDECL CASIO_Shutdown()
+CASIOCLIENT_API int CASIO_CDECL CASIO_GetSamplePosition(CASIO_Device device, uint64_t *position)
 {
-    CoUninitialize();
-    logMessage("Goodbye from CASIO_Shutdown");
+    *position = device->scheduler.position.load(std::memory_order_relaxed);
     return 0;
 }
 
-static bool testOpenDevice(CLSID clsid) {
-    IASIO *driver;
-    const GUID iid = clsid; // ASIO drivers just re-use their own CLSID as the IASIO interface IID. pretty sure that's wrong, but whatever ...
-    hr = CoCreateInstance(clsid, nullptr, CLSCTX_INPROC_SERVER, iid, reinterpret_cast<LPVOID *>(&driver));
-    if (SUCCEEDED(hr)) {
-        if (driver->init(nullptr) == ASIOTrue) {
-            return true;
-        }
+//============ trace capture / replay ========================================
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_StartTraceCapture(CASIO_Device device, const char *path, bool skipSilentInputs)
+{
+    if (device->traceWriter.attached()) {
+        logFormatDev(device, "trace capture already running");
+        return -1;
     }
-    return false;
-}
-
-CASIOCLIENT_API int CDECL CASIO_EnumerateDevices(CASIO_DeviceInfo **outInfo, int *outCount)
-{
-    // list all the keys in HKEY_LOCAL_MACHINE\SOFTWARE\ASIO
-    std::vector<CASIO_DeviceInfo> retInfos;
-    HKEY asioKey;
-    LONG result;
-    result = RegOpenKeyW(HKEY_LOCAL_MACHINE, L"SOFTWARE\\ASIO", &asioKey);
-    if (result == ERROR_SUCCESS) {
-        // list devices
-        DWORD index = 0;
-        WCHAR deviceKeyName[MAX_REGKEY_LENGTH + 1]; // no ASIO devices should have a longer name than that ... (proper way is to use RegQueryInfoKey() to get max subkey len)
-        while (true) {
-            result = RegEnumKeyW(asioKey, index++, deviceKeyName, MAX_REGKEY_LENGTH); // -1 probably not necessary, but why take chances?
-            if (result == ERROR_SUCCESS) {
-                // get that key's values
-                WCHAR valueStr[MAX_REGVALUE_LENGTH + 1];
-
-                CASIO_DeviceInfo info;
-                info.id = new _CASIO_DeviceID;
-
-                // CLSID
-                DWORD valueLen = MAX_REGVALUE_LENGTH;
-                RegGetValueW(asioKey, deviceKeyName, L"CLSID", RRF_RT_REG_SZ, NULL, valueStr, &valueLen);
-                CLSIDFromString(valueStr, &info.id->clsid);
-
-                // verify it's actually connected ...
-                if (!testOpenDevice(info.id->clsid)) {
-                    continue;
-                }
-
-                // description = name
-                valueLen = MAX_REGVALUE_LENGTH;
-                RegGetValueW(asioKey, deviceKeyName, L"Description", RRF_RT_REG_SZ, NULL, valueStr, &valueLen);
-                info.id->name = wstring_to_utf8(valueStr); // internal name is a std::string
-                // "external" (visible to client) name is just a const char * from that std::string
-                info.name = info.id->name.c_str();
-
-                retInfos.push_back(info);
-            }
-            else if (result == ERROR_NO_MORE_ITEMS) {
-                break;
-            }
-            else {
-                logMessage("unknown reg key enumeration error");
-                break;
-            }
-        }
+    if (device->sampleFormat == CASIO_SampleFormat_Unknown) {
+        logFormatDev(device, "trace capture not supported for this sample format");
+        return -1;
     }
-    // duplicate + return the data in the return vector
-    auto count = retInfos.size();
-    *outInfo = new CASIO_DeviceInfo[count];
-    *outCount = (int)count;
-    memcpy(*outInfo, retInfos.data(), sizeof(CASIO_DeviceInfo) * count);
+    TraceProperties props = {};
+    props.numInputs = device->numInputs;
+    props.numOutputs = device->numOutputs;
+    props.bufferSampleLength = device->buffer.currentSize;
+    props.bufferByteLength = device->buffer.currentSize * device->sampleSize;
+    props.sampleFormat = device->sampleFormat;
+    props.sampleRate = device->sampleRate;
+    props.inputLatency = device->inputLatency;
+    props.outputLatency = device->outputLatency;
+    strncpy(props.name, device->name, sizeof(props.name) - 1);
+
+    auto writer = traceWriterOpen(path, &props, skipSilentInputs);
+    if (!writer) {
+        logFormatDev(device, "failed to open trace file %s", path);
+        return -1;
+    }
+    if (!device->traceWriter.attach(writer)) {
+        traceWriterClose(writer);
+        logFormatDev(device, "trace capture already running");
+        return -1;
+    }
+    logFormatDev(device, "trace capture started: %s", path);
     return 0;
 }
 
-CASIOCLIENT_API int CDECL CASIO_OpenDevice(CASIO_DeviceID id, void *userData, CASIO_Device *outDevice)
+CASIOCLIENT_API int CASIO_CDECL CASIO_StopTraceCapture(CASIO_Device device)
 {
-    IASIO *driver;
+    auto writer = device->traceWriter.detach();
+    if (!writer) {
+        return -1;
+    }
+    auto dropped = traceWriterClose(writer);
+    logFormatDev(device, "trace capture stopped (%u records dropped)", dropped);
+    return 0;
+}
 
-    GUID iid = id->clsid; // ASIO drivers just re-use their own CLSID as the IASIO interface IID. pretty sure that's wrong, but whatever ...
-    hr = CoCreateInstance(id->clsid, NULL, CLSCTX_INPROC_SERVER, iid, (LPVOID *)&driver);
-    if (SUCCEEDED(hr)) {
-        auto ret = new _CASIO_Device;
-        ret->id = id;
-        ret->asioDriver = driver;
-        ret->userData = userData;
-        ret->globalIndex = globalNumDevices++;
+CASIOCLIENT_API int CASIO_CDECL CASIO_OpenTrace(const char *path, void *userData, CASIO_Device *outDevice)
+{
+    auto ret = newDevice(nullptr, &traceBackend, userData);
+    if (!traceBackendOpen(ret, path)) {
+        delete ret;
+        *outDevice = nullptr;
+        return -1;
+    }
+    engineDeviceOpened(ret);
+    *outDevice = ret;
+    return 0;
+}
 
-        driver->getDriverName(ret->name);
-        logFormatDev(ret, "opened successfully (global index %d)", ret->globalIndex);
+CASIOCLIENT_API int CASIO_CDECL CASIO_ReplayTrace(CASIO_Device device, bool realtime)
+{
+    if (device->backend != &traceBackend) {
+        logFormatDev(device, "not a trace device");
+        return -1;
+    }
+    return traceBackendReplay(device, realtime) ? 0 : -1;
+}
 
-        ret->driverVersion = driver->getDriverVersion();
-        logFormatDev(ret, "driver version: %08X", ret->driverVersion);
+//============ timeline ======================================================
 
-        if (driver->init(0) != ASIOTrue) { // pass 0 for sysref, since we don't use it (for that matter, why does ASIO want it?)
-            driver->getErrorMessage(errorMessage);
-            logFormat("init error: %s", errorMessage);
-            goto errorExit;
-        }
-        logFormatDev(ret, "ASIO init OK");
-
-        // formerly init_static_data:
-        // get channels
-        driver->getChannels(&ret->numInputs, &ret->numOutputs);
-        logFormatDev(ret, "channels in/out: %d/%d", ret->numInputs, ret->numOutputs);
-
-        // clamp channels
-        ret->numInputs = min(ret->numInputs, MAX_INPUT_CHANNELS);
-        ret->numOutputs = min(ret->numOutputs, MAX_OUTPUT_CHANNELS);
-
-        // get buffer size
-        driver->getBufferSize(&ret->buffer.minSize, &ret->buffer.maxSize, &ret->buffer.prefSize, &ret->buffer.granularity);
-        logFormatDev(ret, "buffer min/max/pref/gran: %d, %d, %d, %d",
-            ret->buffer.minSize, ret->buffer.maxSize, ret->buffer.prefSize, ret->buffer.granularity);
-
-        // get sample rate / set sample rate
-        driver->getSampleRate(&ret->sampleRate);
-        logFormatDev(ret, "current samplerate: %.2f", ret->sampleRate);
-        // set it to something specific if not between 0 and 96khz
-
-        // ASIOOutputReady optimization check
-        ret->supportsOutputReady = (driver->outputReady() == ASE_OK);
-        if (ret->supportsOutputReady) {
-            logFormatDev(ret, "driver supports outputRead()");
-        }
+CASIOCLIENT_API int CASIO_CDECL CASIO_EnableTimeline(bool enable, int spansPerThread)
+{
+    timelineEnable(enable, spansPerThread);
+    logFormat("timeline %s", enable ? "enabled" : "disabled");
+    return 0;
+}
 
-        // ===== create_asio_buffers ======
-        for (int i = 0; i < ret->numInputs + ret->numOutputs; i++) {
-            auto info = &ret->bufferInfos[i];
-            if (i < ret->numInputs) {
-                info->isInput = ASIOTrue;
-                info->channelNum = i;
-            }
-            else {
-                info->isInput = ASIOFalse;
-                info->channelNum = i - ret->numInputs;
-            }
-            info->buffers[0] = info->buffers[1] = NULL;
-        }
+CASIOCLIENT_API int CASIO_CDECL CASIO_ExportTimeline(const char *path)
+{
+    if (!timelineExport(path)) {
+        logFormat("failed to export timeline to %s", path);
+        return -1;
+    }
+    return 0;
+}
+
+//============ multi-process sharing =========================================
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_ServeDevice(CASIO_Device device, const char *name, int evictAfterMissedBuffers)
+{
+    if (!device->backend->hostDevice) {
+        logFormatDev(device, "only hardware devices can be served");
+        return -1;
+    }
+    if (device->sharedServer.attached()) {
+        logFormatDev(device, "already serving");
+        return -1;
+    }
+    if (device->sampleFormat == CASIO_SampleFormat_Unknown) {
+        logFormatDev(device, "sharing not supported for this sample format");
+        return -1;
+    }
+    SharedDeviceInfo info;
+    info.numInputs = device->numInputs;
+    info.numOutputs = device->numOutputs;
+    info.bufferSampleLength = device->buffer.currentSize;
+    info.bufferByteLength = device->buffer.currentSize * device->sampleSize;
+    info.sampleFormat = device->sampleFormat;
+    info.sampleRate = device->sampleRate;
+    info.name = device->name;
+
+    auto server = sharedServerCreate(name, &info, evictAfterMissedBuffers);
+    if (!server) {
+        logFormatDev(device, "failed to create shared device '%s' (name already in use?)", name);
+        return -1;
+    }
+    if (!device->sharedServer.attach(server)) {
+        sharedServerDestroy(server);
+        logFormatDev(device, "already serving");
+        return -1;
+    }
+    logFormatDev(device, "serving as '%s'", name);
+    return 0;
+}
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_StopServing(CASIO_Device device)
+{
+    auto server = device->sharedServer.detach();
+    if (!server) {
+        return -1;
+    }
+    sharedServerDestroy(server);
+    logFormatDev(device, "stopped serving");
+    return 0;
+}
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_GetSharedClientStats(CASIO_Device device, CASIO_SharedClientStats *stats)
+{
+    int result = -1;
+    device->sharedServer.use([&](SharedServer *server) {
+        sharedServerGetStats(server, stats);
+        result = 0;
+    });
+    return result;
+}
 
-        // our ghetto method of supporting multiple ASIO devices at once
-        ret->callbacks = globalCallbacks[ret->globalIndex];
-
-        // immediately assign to globalDevices, lest any callbacks fire as soon as we create buffers (ie, where callbacks are assigned)
-        globalDevices[ret->globalIndex] = ret;
-
-        ret->buffer.currentSize = ret->buffer.prefSize;
-
-        if (driver->createBuffers(ret->bufferInfos, ret->numInputs + ret->numOutputs, ret->buffer.currentSize, &ret->callbacks) == ASE_OK) {
-            logFormatDev(ret, "successfully created buffers");
-
-            // ASIOGetChannelInfo
-            for (int i = 0; i < ret->numInputs + ret->numOutputs; i++) {
-                auto info = &ret->channelInfos[i];
-                info->channel = ret->bufferInfos[i].channelNum;
-                info->isInput = ret->bufferInfos[i].isInput;
-                if (driver->getChannelInfo(info) == ASE_OK) {
-                    logFormatDev(ret, "  - channel - %s:%d [%s], grp %d, %s, sampletype: %d",
-                        info->isInput ? "input" : "output",
-                        info->channel,
-                        info->name,
-                        info->channelGroup,
-                        info->isActive ? "active" : "inactive",
-                        info->type);
-                }
-                else {
-                    driver->getErrorMessage(errorMessage);
-                    logFormatDev(ret, "error getting channel info (%d/%s) - err %s", info->channel, info->isInput ? "input" : "output",
-                        errorMessage);
-                    //
-                    goto errorExit;
-                }
-            }
-
-            // "destructure" the ASIO double-buffers to make them easier to pass to the client callback
-            for (int i = 0; i < ret->numInputs + ret->numOutputs; i++) {
-                if (i < ret->numInputs) {
-                    ret->bufferPtrs[0].inputs[i] = ret->bufferInfos[i].buffers[0];
-                    ret->bufferPtrs[1].inputs[i] = ret->bufferInfos[i].buffers[1];
-                }
-                else {
-                    auto outIndex = i - ret->numInputs;
-                    ret->bufferPtrs[0].outputs[outIndex] = ret->bufferInfos[i].buffers[0];
-                    ret->bufferPtrs[1].outputs[outIndex] = ret->bufferInfos[i].buffers[1];
-                }
-            }
-
-            if (driver->getLatencies(&ret->inputLatency, &ret->outputLatency) == ASE_OK) {
-                logFormatDev(ret, "i/o latencies: %d/%d", ret->inputLatency, ret->outputLatency);
-                // prepared and ready to start!
-                *outDevice = ret;
-                // already assigned to globalDevices, right before buffers created
-                return 0;
-            }
-            else {
-                driver->getErrorMessage(errorMessage);
-                logFormatDev(ret, "error getting latencies: %s", errorMessage);
-            }
+CASIOCLIENT_API int CASIO_CDECL CASIO_ConnectShared(const char *name, void *userData, CASIO_Device *outDevice)
+{
+    auto ret = newDevice(nullptr, &sharedBackend, userData);
+    if (!sharedBackendOpen(ret, name)) {
+        delete ret;
+        *outDevice = nullptr;
+        return -1;
+    }
+    engineDeviceOpened(ret);
+    *outDevice = ret;
+    return 0;
+}
+
+//============ network streams ===============================================
+
+static NetBridge *getNetBridge(CASIO_Device device)
+{
+    if (!device->netBridge.attached()) {
+        if (device->sampleFormat == CASIO_SampleFormat_Unknown) {
+            logFormatDev(device, "network streams not supported for this sample format");
+            return nullptr;
         }
-        else {
-            driver->getErrorMessage(errorMessage);
-            logFormatDev(ret, "failed to create buffers: %s", errorMessage);
+        auto bridge = netBridgeCreate(device->sampleFormat, device->buffer.currentSize,
+            device->sampleSize, device->sampleRate);
+        if (!bridge) {
+            logFormatDev(device, "failed to start networking");
+            return nullptr;
         }
-    errorExit:
-        *outDevice = nullptr;
-        driver->Release();
-        delete ret;
+        if (!device->netBridge.attach(bridge)) {
+            netBridgeDestroy(bridge); // (another thread got there first, use theirs)
+        }
+    }
+    NetBridge *bridge = nullptr;
+    device->netBridge.use([&](NetBridge *b) { bridge = b; }); // (only the control thread ever detaches it)
+    return bridge;
+}
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_AddSendStream(CASIO_Device device, const CASIO_StreamConfig *config, int *outStreamId)
+{
+    auto bridge = getNetBridge(device);
+    if (!bridge) {
         return -1;
     }
-    else {
-        logMessage("COM instantiation failed");
-        *outDevice = nullptr;
+    auto id = netBridgeAddSend(bridge, config, device->numInputs);
+    if (id < 0) {
+        logFormatDev(device, "failed to add send stream to %s:%d", config->address ? config->address : "?", config->port);
         return -1;
     }
+    logFormatDev(device, "sending inputs %d-%d to %s:%d (L%d)", config->firstChannel,
+        config->firstChannel + config->numChannels - 1, config->address, config->port, config->bitDepth);
+    *outStreamId = id;
+    return 0;
 }
 
-CASIOCLIENT_API int CDECL CASIO_CloseDevice(CASIO_Device device)
+CASIOCLIENT_API int CASIO_CDECL CASIO_AddReceiveStream(CASIO_Device device, const CASIO_StreamConfig *config, int *outStreamId)
 {
-    if (device) {
-        device->asioDriver->disposeBuffers();
-        logFormatDev(device, "buffers disposed");
-        device->asioDriver->Release();
-        globalDevices[device->globalIndex] = nullptr;
-        logFormatDev(device, "COM instance released");
-        delete device;
+    auto bridge = getNetBridge(device);
+    if (!bridge) {
+        return -1;
+    }
+    auto id = netBridgeAddReceive(bridge, config, device->numOutputs);
+    if (id < 0) {
+        logFormatDev(device, "failed to add receive stream on port %d", config->port);
+        return -1;
     }
+    logFormatDev(device, "receiving port %d into outputs %d-%d (L%d)", config->port, config->firstChannel,
+        config->firstChannel + config->numChannels - 1, config->bitDepth);
+    *outStreamId = id;
     return 0;
 }
 
-CASIOCLIENT_API int CDECL CASIO_Start(CASIO_Device device)
+CASIOCLIENT_API int CASIO_CDECL CASIO_RemoveStream(CASIO_Device device, int streamId)
 {
-    if (!device->started) {
-        if (device->asioDriver->start() == ASE_OK) {
-            logFormatDev(device, "ASIO playback started");
-            device->started = true;
-            return 0;
-        }
+    int result = -1;
+    device->netBridge.use([&](NetBridge *bridge) {
+        result = netBridgeRemove(bridge, streamId) ? 0 : -1;
+    });
+    return result;
+}
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_GetStreamStats(CASIO_Device device, int streamId, CASIO_StreamStats *stats)
+{
+    int result = -1;
+    device->netBridge.use([&](NetBridge *bridge) {
+        result = netBridgeGetStats(bridge, streamId, stats) ? 0 : -1;
+    });
+    return result;
+}
+
+//============ latency measurement ===========================================
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_MeasureLatency(CASIO_Device device, int outputChannel, int inputChannel,
+                                               CASIO_LatencyStimulus stimulus, CASIO_LatencyResult *result)
+{
+    if (outputChannel < 0 || outputChannel >= device->numOutputs || inputChannel < 0 || inputChannel >= device->numInputs) {
+        return -1;
     }
-    return -1;
+    if (!device->started || device->sampleFormat == CASIO_SampleFormat_Unknown) {
+        logFormatDev(device, "latency measurement needs a started device with a supported sample format");
+        return -1;
+    }
+    auto probe = latencyProbeCreate(stimulus, outputChannel, inputChannel, device->sampleRate, device->buffer.currentSize);
+    if (!device->latencyProbe.attach(probe)) {
+        latencyProbeDestroy(probe);
+        return -1; // already measuring
+    }
+    auto timeout = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(2000 + (int64_t)(1000.0 * probe->captureLength / device->sampleRate));
+    while (!probe->done.load(std::memory_order_acquire) && std::chrono::steady_clock::now() < timeout) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    device->latencyProbe.detach();
+    if (!probe->done.load(std::memory_order_acquire)) {
+        logFormatDev(device, "latency measurement timed out (no buffers?)");
+        latencyProbeDestroy(probe);
+        return -1;
+    }
+
+    double lag;
+    float peakRatio;
+    auto found = latencyAnalyze(probe, &lag, &peakRatio);
+    latencyProbeDestroy(probe);
+    if (!found) {
+        logFormatDev(device, "no loopback signal on input %d", inputChannel);
+        return -1;
+    }
+    result->measuredSamples = lag;
+    result->reportedSamples = (int)(device->inputLatency + device->outputLatency);
+    result->measuredMs = lag * 1000.0 / device->sampleRate;
+    result->peakRatio = peakRatio;
+    logFormatDev(device, "round-trip latency %d -> %d: measured %.1f samples (%.2f ms), driver reports %d, peak ratio %.1f",
+        outputChannel, inputChannel, lag, result->measuredMs, result->reportedSamples, peakRatio);
+
+    if (peakRatio < CASIO_MIN_LATENCY_PEAK_RATIO) {
+        logFormatDev(device, "correlation peak too weak, not using it (is the loopback cabled?)");
+        return -1;
+    }
+    device->measuredLatency = lag;
+    device->latencyMeasured = true;
+    return 0;
 }
 
-CASIOCLIENT_API int CDECL CASIO_Stop(CASIO_Device device)
+//============ hot standby ===================================================
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_SetStandby(CASIO_Device device, CASIO_DeviceID standbyId, int watchdogMilliseconds)
 {
-    if (device->started) {
-        if (device->asioDriver->stop() == ASE_OK) {
-            logFormatDev(device, "ASIO playback stopped");
-            device->started = false;
-            return 0;
-        }
+    if (!device->backend->hostDevice) {
+        logFormatDev(device, "only hardware devices can have a standby");
+        return -1;
     }
-    return -1;
+    if (device->standby) {
+        logFormatDev(device, "already has a standby");
+        return -1;
+    }
+    if (watchdogMilliseconds <= 0) {
+        return -1;
+    }
+
+    CASIO_Device standby;
+    if (CASIO_OpenDevice(standbyId, device->userData, &standby) != 0) {
+        logFormatDev(device, "failed to open standby '%s'", standbyId->name.c_str());
+        return -1;
+    }
+    if (standby->sampleRate != device->sampleRate && standby->backend->setSampleRate &&
+        standby->backend->setSampleRate(standby, device->sampleRate)) {
+        standby->sampleRate = device->sampleRate;
+    }
+    if (standby->sampleFormat != device->sampleFormat || standby->buffer.currentSize != device->buffer.currentSize ||
+        standby->sampleRate != device->sampleRate ||
+        standby->numInputs < device->numInputs || standby->numOutputs < device->numOutputs) {
+        logFormatDev(device, "standby '%s' doesn't match (format %d/%d, buffer %d/%d, rate %.0f/%.0f, channels %d+%d/%d+%d)",
+            standby->name, standby->sampleFormat, device->sampleFormat, standby->buffer.currentSize, device->buffer.currentSize,
+            standby->sampleRate, device->sampleRate,
+            standby->numInputs, standby->numOutputs, device->numInputs, device->numOutputs);
+        CASIO_CloseDevice(standby);
+        return -1;
+    }
+
+    standby->standbyFor = device;
+    device->watchdogNs = (uint64_t)watchdogMilliseconds * 1000000;
+    device->fault = CASIO_Failover_None;
+    device->standby = standby;
+    if (CASIO_Start(standby) != 0) {
+        device->standby = nullptr;
+        CASIO_CloseDevice(standby);
+        logFormatDev(device, "failed to start standby");
+        return -1;
+    }
+    logFormatDev(device, "standby '%s' running, watchdog %d ms", standby->name, watchdogMilliseconds);
+    return 0;
 }
 
-int getSampleSize(ASIOSampleType sampleType) {
-    switch (sampleType)
-    {
-    case ASIOSTInt16LSB:
-    case ASIOSTInt16MSB:
-        return 2;
+CASIOCLIENT_API int CASIO_CDECL CASIO_ClearStandby(CASIO_Device device)
+{
+    if (!device->standby) {
+        return -1;
+    }
+    if (device->failedOver) {
+        logFormatDev(device, "the standby is in charge now, close the device instead");
+        return -1;
+    }
+    auto standby = device->standby;
+    CASIO_Stop(standby);
+    device->standby = nullptr;
+    CASIO_CloseDevice(standby);
+    device->fault = CASIO_Failover_None;
+    return 0;
+}
 
-    case ASIOSTInt24LSB:
-    case ASIOSTInt24MSB:
-        return 3;
+CASIOCLIENT_API int CASIO_CDECL CASIO_GetFailoverStatus(CASIO_Device device, CASIO_FailoverStatus *status)
+{
+    memset(status, 0, sizeof(*status));
+    status->armed = device->standby != nullptr;
+    if (device->failedOver.load(std::memory_order_acquire)) {
+        *status = device->failoverStatus;
+        status->armed = true;
+        status->failedOver = true;
+    }
+    return 0;
+}
 
-    case ASIOSTInt32LSB:
-    case ASIOSTInt32MSB:
-    case ASIOSTFloat32LSB:
-    case ASIOSTFloat32MSB:
-    case ASIOSTInt32LSB16:
-    case ASIOSTInt32LSB18:
-    case ASIOSTInt32LSB20:
-    case ASIOSTInt32LSB24:
-    case ASIOSTInt32MSB16:
-    case ASIOSTInt32MSB18:
-    case ASIOSTInt32MSB20:
-    case ASIOSTInt32MSB24:
-        return 4;
+//============ processing graph ==============================================
 
-    case ASIOSTFloat64LSB:
-    case ASIOSTFloat64MSB:
-        return 8;
+CASIOCLIENT_API int CASIO_CDECL CASIO_GraphCreate(CASIO_Device device, int numThreads, CASIO_Graph *outGraph)
+{
+    if (device->sampleFormat == CASIO_SampleFormat_Unknown) {
+        logFormatDev(device, "processing graph not supported for this sample format");
+        return -1;
+    }
+    auto engine = graphCreate(device->sampleFormat, device->buffer.currentSize, device->numInputs, device->numOutputs,
+        numThreads);
+    if (!device->graph.attach(engine)) {
+        graphDestroy(engine);
+        return -1; // one per device
+    }
+    logFormatDev(device, "processing graph created (%d threads)", (int)engine->workers.size() + 1);
+    if (engine->realtimeWorkers < (int)engine->workers.size()) {
+        logFormatDev(device, "%d of %d graph workers at normal priority (realtime scheduling not permitted, or fewer cores than threads)",
+            (int)engine->workers.size() - engine->realtimeWorkers.load(), (int)engine->workers.size());
+    }
+    device->graphHandle = new _CASIO_Graph{device, engine};
+    *outGraph = device->graphHandle;
+    return 0;
+}
 
-    default:
+CASIOCLIENT_API int CASIO_CDECL CASIO_GraphDestroy(CASIO_Graph graph)
+{
+    if (!graph) {
         return -1;
     }
+    auto device = graph->device;
+    if (auto engine = device->graph.detach()) {
+        graphDestroy(engine);
+    }
+    device->graphHandle = nullptr;
+    delete graph;
+    return 0;
 }
 
+CASIOCLIENT_API int CASIO_CDECL CASIO_GraphAddSource(CASIO_Graph graph, int deviceInput)
+{
+    return graphAddSource(graph->engine, deviceInput);
+}
 
-CASIOCLIENT_API int CDECL CASIO_GetProperties(CASIO_Device device, CASIO_DeviceProperties *props, double *currentSampleRate)
+CASIOCLIENT_API int CASIO_CDECL CASIO_GraphAddSink(CASIO_Graph graph, int deviceOutput)
 {
-    props->name = device->name;
-    props->numInputs = device->numInputs;
-    props->numOutputs = device->numOutputs;
-    props->bufferSampleLength = device->buffer.currentSize;
+    return graphAddSink(graph->engine, deviceOutput);
+}
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_GraphAddProcessor(CASIO_Graph graph, int numInputs, int numOutputs,
+                                                  CASIO_NodeProcessFunc process, void *context)
+{
+    return graphAddProcessor(graph->engine, numInputs, numOutputs, process, context);
+}
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_GraphRemoveNode(CASIO_Graph graph, int node)
+{
+    return graphRemoveNode(graph->engine, node) ? 0 : -1;
+}
 
-    auto sampleType = device->channelInfos[0].type;
+CASIOCLIENT_API int CASIO_CDECL CASIO_GraphConnect(CASIO_Graph graph, int fromNode, int fromPort, int toNode, int toPort)
+{
+    return graphConnect(graph->engine, {fromNode, fromPort, toNode, toPort}) ? 0 : -1;
+}
 
-    props->bufferByteLength = device->buffer.currentSize * getSampleSize(sampleType);
+CASIOCLIENT_API int CASIO_CDECL CASIO_GraphDisconnect(CASIO_Graph graph, int fromNode, int fromPort, int toNode, int toPort)
+{
+    return graphDisconnect(graph->engine, {fromNode, fromPort, toNode, toPort}) ? 0 : -1;
+}
 
-    switch (sampleType) {
-    case ASIOSTInt32LSB:
-        props->sampleFormat = CASIO_SampleFormat_Int32;
-        break;
-    case ASIOSTFloat32LSB:
-        props->sampleFormat = CASIO_SampleFormat_Float32;
-        break;
-    case ASIOSTFloat64LSB:
-        props->sampleFormat = CASIO_SampleFormat_Float64;
-        break;
-    default:
-        props->sampleFormat = CASIO_SampleFormat_Unknown;
+CASIOCLIENT_API int CASIO_CDECL CASIO_GraphCommit(CASIO_Graph graph)
+{
+    TIMELINE_SPAN("CASIO_GraphCommit", graph->device->name);
+    if (!graphCommit(graph->engine)) {
+        logFormatDev(graph->device, "processing graph has a cycle, not committed");
+        return -1;
     }
+    return 0;
+}
 
-    // sample rate is separate because it can change ...
-    *currentSampleRate = device->sampleRate;
+//============ lossless capture ==============================================
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_StartLosslessCapture(CASIO_Device device, const char *path, int numThreads)
+{
+    if (device->losslessWriter.attached()) {
+        logFormatDev(device, "lossless capture already running");
+        return -1;
+    }
+    if (device->sampleFormat == CASIO_SampleFormat_Unknown || device->numInputs < 1) {
+        logFormatDev(device, "lossless capture not supported for this device");
+        return -1;
+    }
+    if (device->numInputs > LOSSLESS_MAX_CHANNELS) {
+        logFormatDev(device, "lossless capture supports at most %d inputs", LOSSLESS_MAX_CHANNELS);
+        return -1;
+    }
+    auto writer = losslessWriterOpen(path, device->sampleFormat, device->sampleSize,
+        device->numInputs, device->sampleRate, numThreads);
+    if (!writer) {
+        logFormatDev(device, "failed to open capture file %s", path);
+        return -1;
+    }
+    if (!device->losslessWriter.attach(writer)) {
+        CASIO_CaptureStats discarded;
+        losslessWriterClose(writer, &discarded);
+        logFormatDev(device, "lossless capture already running");
+        return -1;
+    }
+    logFormatDev(device, "lossless capture started: %s (%d encoder threads)", path, (int)writer->encoders.size());
     return 0;
 }
 
-CASIOCLIENT_API int CDECL CASIO_ShowControlPanel(CASIO_Device device)
+CASIOCLIENT_API int CASIO_CDECL CASIO_GetLosslessCaptureStats(CASIO_Device device, CASIO_CaptureStats *stats)
 {
-    if (device->asioDriver->controlPanel() != ASE_OK) {
-        logFormatDev(device, "failed to show control panel");
+    int result = -1;
+    device->losslessWriter.use([&](LosslessWriter *writer) {
+        losslessGetStats(writer, stats);
+        result = 0;
+    });
+    return result;
+}
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_StopLosslessCapture(CASIO_Device device, CASIO_CaptureStats *stats)
+{
+    auto writer = device->losslessWriter.detach();
+    if (!writer) {
+        return -1;
+    }
+    CASIO_CaptureStats final;
+    losslessWriterClose(writer, &final);
+    logFormatDev(device, "lossless capture stopped: %llu frames, ratio %.2f, %.1fx realtime per thread, %llu frames dropped",
+        (unsigned long long)final.frames, final.compressionRatio, final.realtimeFactor,
+        (unsigned long long)final.droppedFrames);
+    if (final.writeErrors) {
+        logFormatDev(device, "lossless capture had %llu write errors, the file is incomplete", (unsigned long long)final.writeErrors);
+    }
+    if (stats) {
+        *stats = final;
+    }
+    return 0;
+}
+
+CASIOCLIENT_API int CASIO_CDECL CASIO_DecodeLosslessCapture(const char *path, const char *wavPath)
+{
+    if (!losslessDecode(path, wavPath)) {
+        logFormat("failed to decode %s", path);
         return -1;
     }
     return 0;
@@ -1,14 +1,18 @@
 #pragma once
 
+#if defined(_WIN32)
 #ifdef CASIOCLIENT_EXPORTS
 #define CASIOCLIENT_API __declspec(dllexport)
 #else
 #define CASIOCLIENT_API __declspec(dllimport)
 #endif
+#define CASIO_CDECL __cdecl
+#else
+#define CASIOCLIENT_API __attribute__((visibility("default")))
+#define CASIO_CDECL
+#endif
 
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
-
+#include <stdint.h>
 #ifndef __cplusplus
 #include <stdbool.h>
 #endif
@@ -25,7 +29,9 @@ extern "C" {
     typedef enum {
         CASIO_EventType_Log,
         CASIO_EventType_BufferSwitch,
-        CASIO_EventType_SampleRateChanged
+        CASIO_EventType_SampleRateChanged,
+        CASIO_EventType_ScheduledAction,
+        CASIO_EventType_Failover
     } CASIO_EventType;
 
     typedef enum {
@@ -34,6 +40,31 @@ extern "C" {
         CASIO_TimeFlag_TCSamples = 1 << 2
     } CASIO_TimeFlags;
 
+    // actions that can be scheduled at an absolute sample position (see CASIO_ScheduleAction)
+    typedef enum {
+        CASIO_Action_OutputStart, // fade output(s) in from silence to .gain
+        CASIO_Action_OutputStop, // fade output(s) out to silence
+        CASIO_Action_SetGain, // ramp output(s) to .gain
+        CASIO_Action_Trigger // handed back to the client as a CASIO_EventType_ScheduledAction event, just before the bufferSwitch it falls in
+    } CASIO_ActionType;
+
+    typedef struct {
+        CASIO_ActionType type;
+        uint64_t samplePosition; // same timeline as bufferSwitchEvent.time.samples
+        int channel; // output channel, -1 = all outputs
+        float gain; // linear, 1.0 = unity
+        int fadeSamples; // ramp length, 0 = immediate
+        void *tag; // client data, passed back with triggers
+    } CASIO_ScheduledAction;
+
+    // why a device handed over to its standby (see CASIO_SetStandby)
+    typedef enum {
+        CASIO_Failover_None,
+        CASIO_Failover_Watchdog, // no bufferSwitch within the watchdog window
+        CASIO_Failover_ResetRequest, // the driver asked to be reset
+        CASIO_Failover_ClockLoss // sample rate changed to 0
+    } CASIO_FailoverReason;
+
     typedef struct {
         CASIO_EventType eventType;
         bool handled;
@@ -47,27 +78,41 @@ extern "C" {
                 void **outputs;
                 struct {
                     unsigned int flags; // CASIO_TimeFlags
-                    UINT64 nanoSeconds;
-                    UINT64 samples;
-                    UINT64 tcSamples;
+                    uint64_t nanoSeconds;
+                    uint64_t samples;
+                    uint64_t tcSamples;
                 } time;
+                // bit i set = input i carried signal within the silence hold time (see CASIO_SetSilenceDetection).
+                // all opened inputs are set when detection is off. silent inputs may be skipped entirely
+                uint64_t activeInputs;
             } bufferSwitchEvent;
             struct {
                 double newSampleRate;
             } sampleRateChangedEvent;
+            struct {
+                const CASIO_ScheduledAction *action;
+                int sampleOffset; // within the upcoming bufferSwitch
+            } scheduledActionEvent;
+            struct {
+                // sent on the standby's audio thread, right before its first bufferSwitch for this device
+                CASIO_FailoverReason reason;
+                uint64_t switchNs; // from the fault (or the watchdog expiring) to this event
+                uint64_t gapNs; // from the primary's last bufferSwitch to the standby's first
+            } failoverEvent;
         };
     } CASIO_Event;
 
-    typedef int(CDECL *CASIO_EventCallback)(CASIO_Event *event, CASIO_Device device, void *userData);
+    typedef int(CASIO_CDECL *CASIO_EventCallback)(CASIO_Event *event, CASIO_Device device, void *userData);
 
-    CASIOCLIENT_API int CDECL CASIO_Init(CASIO_EventCallback callback);
-    CASIOCLIENT_API int CDECL CASIO_Shutdown();
+    CASIOCLIENT_API int CASIO_CDECL CASIO_Init(CASIO_EventCallback callback);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_Shutdown();
 
     typedef struct {
         CASIO_DeviceID id;
         const char *name;
     } CASIO_DeviceInfo;
-    CASIOCLIENT_API int CDECL CASIO_EnumerateDevices(CASIO_DeviceInfo **outInfo, int *outCount);
+    // ASIO drivers on windows, plus a "Null Device" (timer-driven, silent inputs) when built with CASIO_NULL_BACKEND
+    CASIOCLIENT_API int CASIO_CDECL CASIO_EnumerateDevices(CASIO_DeviceInfo **outInfo, int *outCount);
 
     typedef enum {
         CASIO_SampleFormat_Unknown,
@@ -82,17 +127,201 @@ extern "C" {
         int bufferSampleLength;
         int bufferByteLength;
         CASIO_SampleFormat sampleFormat;
+        int inputLatency, outputLatency; // in samples, as reported by the driver
+        int roundTripLatency; // measured by CASIO_MeasureLatency if it ran, inputLatency + outputLatency otherwise
+        bool latencyMeasured;
     } CASIO_DeviceProperties;
 
-    CASIOCLIENT_API int CDECL CASIO_OpenDevice(CASIO_DeviceID id, void *userData, CASIO_Device *outDevice);
-    CASIOCLIENT_API int CDECL CASIO_CloseDevice(CASIO_Device device);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_OpenDevice(CASIO_DeviceID id, void *userData, CASIO_Device *outDevice);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_CloseDevice(CASIO_Device device);
+
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GetProperties(CASIO_Device device, CASIO_DeviceProperties *props, double *currentSampleRate);
 
-    CASIOCLIENT_API int CDECL CASIO_GetProperties(CASIO_Device device, CASIO_DeviceProperties *props, double *currentSampleRate);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_Start(CASIO_Device device);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_Stop(CASIO_Device device);
+
+    CASIOCLIENT_API int CASIO_CDECL CASIO_ShowControlPanel(CASIO_Device device);
+
+    // optional library-side metering, computed on the audio thread after each bufferSwitch
+    // and safe to poll from any other thread
+    typedef struct {
+        float peak; // max absolute sample over the last buffer, 1.0 = full scale
+        float rms; // RMS over the last buffer, 1.0 = full scale
+        unsigned int clipCount; // running count of full-scale samples since metering was enabled
+    } CASIO_ChannelMeter;
+
+    CASIOCLIENT_API int CASIO_CDECL CASIO_EnableMetering(CASIO_Device device, bool enable);
+    // inputs/outputs arrays must hold at least numInputs/numOutputs entries (see CASIO_GetProperties), either may be NULL
+    // bufferCount (optional) is the number of buffers metered so far, so pollers can tell whether anything is new
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GetMeters(CASIO_Device device, CASIO_ChannelMeter *inputs, CASIO_ChannelMeter *outputs, uint64_t *bufferCount);
+
+    // per-input silence detection, reported through bufferSwitchEvent.activeInputs.
+    // threshold is relative to full scale (0 = only exact digital silence counts), and an input
+    // is dropped from the mask once it has stayed at or below it for holdMilliseconds (negative values count as 0).
+    // library-side work (metering etc.) is skipped for inputs that aren't in the mask
+    CASIOCLIENT_API int CASIO_CDECL CASIO_SetSilenceDetection(CASIO_Device device, bool enable, float threshold, int holdMilliseconds);
+
+    // queue an action to happen at an exact sample position. callable from any thread, never blocks.
+    // actions whose position has already passed are applied at the start of the next buffer.
+    // returns -1 if 256 actions are already waiting to run; an action that was accepted always runs
+    CASIOCLIENT_API int CASIO_CDECL CASIO_ScheduleAction(CASIO_Device device, const CASIO_ScheduledAction *action);
+    // sample position at the start of the most recent buffer, for scheduling relative to "now"
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GetSamplePosition(CASIO_Device device, uint64_t *position);
+
+    // record a compact binary trace of the device session: properties, every bufferSwitch (time info + input buffers),
+    // asioMessage selectors and sample rate changes. skipSilentInputs leaves out inputs that aren't in activeInputs
+    // (see CASIO_SetSilenceDetection), they replay as digital silence. inputs carrying signal are always stored whole
+    CASIOCLIENT_API int CASIO_CDECL CASIO_StartTraceCapture(CASIO_Device device, const char *path, bool skipSilentInputs);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_StopTraceCapture(CASIO_Device device);
+
+    // open a recorded trace as a device (CASIO_GetProperties etc. work as usual), then feed it through the client
+    // callback on the calling thread -- as fast as possible, or at the recorded timing. or CASIO_Start/Stop it like a
+    // live device, which replays it at the recorded timing on a thread of its own.
+    // release it with CASIO_CloseDevice
+    CASIOCLIENT_API int CASIO_CDECL CASIO_OpenTrace(const char *path, void *userData, CASIO_Device *outDevice);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_ReplayTrace(CASIO_Device device, bool realtime);
+
+    // timeline of library activity on every thread (driver callbacks, library pre/post-processing, client callback,
+    // outputReady, asioMessage, CASIO_OpenDevice steps, ...), kept in per-thread rings of spansPerThread entries
+    // (0 = default). the ring size is fixed by the first enable. up to 64 threads are recorded at a time, rings of
+    // exited threads are reused.
+    // export writes Chrome trace event JSON, viewable in chrome://tracing or ui.perfetto.dev
+    CASIOCLIENT_API int CASIO_CDECL CASIO_EnableTimeline(bool enable, int spansPerThread);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_ExportTimeline(const char *path);
+
+    // multi-process access to one opened device.
+    // the owning process serves it under a name; other processes connect to get a device handle that behaves like a
+    // normal one (GetProperties, Start/Stop, bufferSwitch events) but runs on its own thread, one buffer behind the device.
+    // every client's outputs are mixed into the device outputs. clients that miss evictAfterMissedBuffers deadlines
+    // in a row are disconnected (a freshly started one gets a short grace for its first buffer). the slots of client
+    // processes that died without disconnecting are given back
+    #define CASIO_MAX_SHARED_CLIENTS 8
+
+    typedef struct {
+        bool connected;
+        unsigned int pid;
+        uint64_t buffersMixed, buffersMissed;
+        uint64_t averageLatencyNs, maxLatencyNs; // from publishing the inputs to the client finishing its outputs
+    } CASIO_SharedClientStats;
 
-    CASIOCLIENT_API int CDECL CASIO_Start(CASIO_Device device);
-    CASIOCLIENT_API int CDECL CASIO_Stop(CASIO_Device device);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_ServeDevice(CASIO_Device device, const char *name, int evictAfterMissedBuffers);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_StopServing(CASIO_Device device);
+    // stats must have room for CASIO_MAX_SHARED_CLIENTS entries, indexed by client slot
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GetSharedClientStats(CASIO_Device device, CASIO_SharedClientStats *stats);
+
+    CASIOCLIENT_API int CASIO_CDECL CASIO_ConnectShared(const char *name, void *userData, CASIO_Device *outDevice);
+
+    // round-trip latency over a cabled loopback from output to input. plays the stimulus on the output (replacing
+    // whatever the client writes there), records the input, and finds the lag by FFT cross-correlation on the calling
+    // thread. the device must be started; blocks for about a second. on success the figure also shows up in
+    // CASIO_DeviceProperties.roundTripLatency
+    typedef enum {
+        CASIO_Stimulus_Impulse,
+        CASIO_Stimulus_MLS // maximum length sequence, much more robust against noise
+    } CASIO_LatencyStimulus;
+
+    // below this the correlation peak isn't much of a match: the measurement fails (result still filled in)
+    #define CASIO_MIN_LATENCY_PEAK_RATIO 4.0f
+
+    typedef struct {
+        double measuredSamples; // with sub-sample interpolation
+        int reportedSamples; // driver inputLatency + outputLatency
+        double measuredMs;
+        float peakRatio; // correlation peak over the strongest value away from it, see CASIO_MIN_LATENCY_PEAK_RATIO
+    } CASIO_LatencyResult;
+
+    CASIOCLIENT_API int CASIO_CDECL CASIO_MeasureLatency(CASIO_Device device, int outputChannel, int inputChannel,
+                                                   CASIO_LatencyStimulus stimulus, CASIO_LatencyResult *result);
+
+    // hot standby: keep a second device opened, started and muted next to this one, and hand the client callback
+    // over to it (on this device's handle) when this one stops calling back for watchdogMilliseconds, asks for a reset,
+    // or loses its clock. the standby needs the same sample format, buffer size and sample rate, and at least as many channels.
+    // failover is one-way: the standby stays in charge (and open) until the device is closed.
+    typedef struct {
+        bool armed; // a standby is running
+        bool failedOver; // the standby is the one delivering buffers now
+        CASIO_FailoverReason reason;
+        uint64_t switchNs, gapNs; // as in the failover event
+    } CASIO_FailoverStatus;
+
+    CASIOCLIENT_API int CASIO_CDECL CASIO_SetStandby(CASIO_Device device, CASIO_DeviceID standbyId, int watchdogMilliseconds);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_ClearStandby(CASIO_Device device);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GetFailoverStatus(CASIO_Device device, CASIO_FailoverStatus *status);
+
+    // RTP network streams (AES67-style L16/L24 over UDP, IPv4 unicast or multicast)
+    typedef struct {
+        const char *address; // send: destination. receive: multicast group to join, or NULL/"0.0.0.0" for unicast
+        unsigned short port;
+        int firstChannel, numChannels; // device inputs to send / device outputs to play into (mixed)
+        int bitDepth; // 16 or 24
+        int payloadType; // RTP payload type, 0 = 96
+        int packetSamples; // frames per packet, 0 = 48 (1ms at 48kHz, the AES67 default)
+        int targetLatencySamples; // receive: minimum jitter buffer depth, 0 = 3 packets
+    } CASIO_StreamConfig;
+
+    typedef struct {
+        uint64_t packets;
+        uint64_t lostPackets, latePackets; // receive
+        uint64_t underruns; // receive: jitter buffer ran dry. send: device buffers dropped because the network thread fell behind
+        int bufferedSamples, targetSamples; // receive: current and target jitter buffer depth
+        double jitterSamples; // receive: interarrival jitter (RFC 3550)
+        double driftPpm; // receive: how much faster the sender's clock runs than the device's
+    } CASIO_StreamStats;
+
+    CASIOCLIENT_API int CASIO_CDECL CASIO_AddSendStream(CASIO_Device device, const CASIO_StreamConfig *config, int *outStreamId);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_AddReceiveStream(CASIO_Device device, const CASIO_StreamConfig *config, int *outStreamId);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_RemoveStream(CASIO_Device device, int streamId);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GetStreamStats(CASIO_Device device, int streamId, CASIO_StreamStats *stats);
+
+    // processing graph: an alternative to doing everything in the bufferSwitch callback. nodes are device inputs (sources),
+    // device outputs (sinks) and client processors, wired port to port; several wires into one input port are summed.
+    // every bufferSwitch (right after the client callback) the graph runs in dependency order, spread over worker threads,
+    // on float buffers. outputs with a sink are overwritten with what reaches it.
+    // edits only take effect on CASIO_GraphCommit, which swaps the new topology in at the next buffer boundary.
+    APIHANDLE(CASIO_Graph);
+
+    // runs on the audio thread or a graph worker. unconnected inputs read silence
+    typedef void(CASIO_CDECL *CASIO_NodeProcessFunc)(void *context, const float *const *inputs, float *const *outputs, int frames);
+
+    // one graph per device. closing the device destroys its graph, and the handle is invalid after that.
+    // numThreads includes the audio thread, 1 = everything runs on it. the workers get realtime priority (MMCSS, SCHED_FIFO)
+    // when there's a core for every thread and the system permits it, and log it when they don't
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GraphCreate(CASIO_Device device, int numThreads, CASIO_Graph *outGraph);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GraphDestroy(CASIO_Graph graph);
+
+    // these return a node id, or -1
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GraphAddSource(CASIO_Graph graph, int deviceInput);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GraphAddSink(CASIO_Graph graph, int deviceOutput);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GraphAddProcessor(CASIO_Graph graph, int numInputs, int numOutputs,
+                                                      CASIO_NodeProcessFunc process, void *context);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GraphRemoveNode(CASIO_Graph graph, int node); // (and its connections)
+
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GraphConnect(CASIO_Graph graph, int fromNode, int fromPort, int toNode, int toPort);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GraphDisconnect(CASIO_Graph graph, int fromNode, int fromPort, int toNode, int toPort);
+
+    // fails (and leaves the running graph alone) if the edits made a cycle
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GraphCommit(CASIO_Graph graph);
+
+    // lossless compressed capture of all inputs: blocks of each channel are encoded (LPC / fixed predictors,
+    // partitioned Rice residuals, constant and wasted-bits shortcuts) by a pool of encoder threads and written in order.
+    // float formats are stored losslessly as long as the samples are exact multiples of 2^-31 (anything from a
+    // fixed-point converter is); other blocks are stored verbatim. if the encoders fall behind, blocks are dropped
+    // and decode as silence.
+    typedef struct {
+        uint64_t frames; // captured
+        uint64_t rawBytes, encodedBytes;
+        double compressionRatio; // raw / encoded
+        double realtimeFactor; // audio time encoded per second of one encoder thread's time
+        uint64_t droppedFrames;
+        uint64_t writeErrors; // failed file writes (disk full...): if not 0, the capture is damaged from there on
+    } CASIO_CaptureStats;
 
-    CASIOCLIENT_API int CDECL CASIO_ShowControlPanel(CASIO_Device device);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_StartLosslessCapture(CASIO_Device device, const char *path, int numThreads);
+    CASIOCLIENT_API int CASIO_CDECL CASIO_GetLosslessCaptureStats(CASIO_Device device, CASIO_CaptureStats *stats);
+    // stats may be null
+    CASIOCLIENT_API int CASIO_CDECL CASIO_StopLosslessCapture(CASIO_Device device, CASIO_CaptureStats *stats);
+    // expands a capture to a WAV file in the device's sample format
+    CASIOCLIENT_API int CASIO_CDECL CASIO_DecodeLosslessCapture(const char *path, const char *wavPath);
 
 #ifdef __cplusplus
 }
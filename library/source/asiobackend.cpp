@@ -0,0 +1,573 @@
+// the ASIO host backend (windows): drivers are COM objects, registered under HKLM\SOFTWARE\ASIO
+
+#include "header.h"
+#include "engine.h"
+
+#include "util/unicodestuff.h"
+
+#include <objbase.h> // COM stuff
+#include <algorithm>
+#include <cstring>
+
+#include "../sdk/ASIOSDK2.3/common/iasiodrv.h"
+
+#define MAX_REGKEY_LENGTH 512
+#define MAX_REGVALUE_LENGTH 512
+
+#define MAX_OPEN_DEVICES 8
+
+static HRESULT hr;
+#define MAX_ERROR_LENGTH 1024
+static char errorMessage[MAX_ERROR_LENGTH];
+
+// backendData of an ASIO device
+struct AsioDevice {
+    IASIO *driver;
+    ASIOBufferInfo bufferInfos[MAX_INPUT_CHANNELS + MAX_OUTPUT_CHANNELS];
+    ASIOChannelInfo channelInfos[MAX_INPUT_CHANNELS + MAX_OUTPUT_CHANNELS];
+    ASIOCallbacks callbacks; // ASIO keeps a pointer to this, not just the content
+    int globalIndex; // since we only support a limited amount of ASIO devices at once, due to the context-less callback mechanism
+};
+
+static inline AsioDevice *asioOf(CASIO_Device device) {
+    return (AsioDevice *)device->backendData;
+}
+
+static CASIO_SampleFormat toSampleFormat(ASIOSampleType sampleType) {
+    switch (sampleType) {
+    case ASIOSTInt32LSB:
+        return CASIO_SampleFormat_Int32;
+    case ASIOSTFloat32LSB:
+        return CASIO_SampleFormat_Float32;
+    case ASIOSTFloat64LSB:
+        return CASIO_SampleFormat_Float64;
+    default:
+        return CASIO_SampleFormat_Unknown;
+    }
+}
+
+static int getSampleSize(ASIOSampleType sampleType) {
+    switch (sampleType)
+    {
+    case ASIOSTInt16LSB:
+    case ASIOSTInt16MSB:
+        return 2;
+
+    case ASIOSTInt24LSB:
+    case ASIOSTInt24MSB:
+        return 3;
+
+    case ASIOSTInt32LSB:
+    case ASIOSTInt32MSB:
+    case ASIOSTFloat32LSB:
+    case ASIOSTFloat32MSB:
+    case ASIOSTInt32LSB16:
+    case ASIOSTInt32LSB18:
+    case ASIOSTInt32LSB20:
+    case ASIOSTInt32LSB24:
+    case ASIOSTInt32MSB16:
+    case ASIOSTInt32MSB18:
+    case ASIOSTInt32MSB20:
+    case ASIOSTInt32MSB24:
+        return 4;
+
+    case ASIOSTFloat64LSB:
+    case ASIOSTFloat64MSB:
+        return 8;
+
+    default:
+        return -1;
+    }
+}
+
+//============ callbacks =====================================================
+
+// these could be avoided if the ASIO header didn't predefine NATIVE_INT64 for us
+// (don't want to modify the SDK here to make it easier for other people to compile)
+inline uint64_t timestampToUint64(ASIOTimeStamp &x) {
+    uint64_t ret;
+    ((uint32_t *)&ret)[0] = x.lo;
+    ((uint32_t *)&ret)[1] = x.hi;
+    return ret;
+}
+
+inline uint64_t samplesToUint64(ASIOSamples &x) {
+    uint64_t ret;
+    ((uint32_t *)&ret)[0] = x.lo;
+    ((uint32_t *)&ret)[1] = x.hi;
+    return ret;
+}
+
+ASIOTime* onBufferSwitchTimeInfo(CASIO_Device device, ASIOTime* timeInfo, long doubleBufferIndex, ASIOBool directProcess)
+{
+    // new callback with time info. makes ASIOGetSamplePosition() and various
+    // calls to ASIOGetSampleRate obsolete,
+    // and allows for timecode sync etc. to be preferred; will be used if
+    // the driver calls asioMessage with selector kAsioSupportsTimeInfo.
+
+    // (see onBufferSwitch comments for further info)
+
+    // send event
+    CASIO_Event event = {};
+    event.eventType = CASIO_EventType_BufferSwitch;
+    event.handled = false;
+
+    event.bufferSwitchEvent.time.flags = 0;
+    if (timeInfo->timeInfo.flags & kSystemTimeValid) {
+        event.bufferSwitchEvent.time.nanoSeconds = timestampToUint64(timeInfo->timeInfo.systemTime);
+        event.bufferSwitchEvent.time.flags |= CASIO_TimeFlag_NanoSecs;
+    }
+    if (timeInfo->timeInfo.flags & kSamplePositionValid) {
+        event.bufferSwitchEvent.time.samples = samplesToUint64(timeInfo->timeInfo.samplePosition);
+        event.bufferSwitchEvent.time.flags |= CASIO_TimeFlag_Samples;
+    }
+    if (timeInfo->timeCode.flags & kTcValid) {
+        event.bufferSwitchEvent.time.tcSamples = samplesToUint64(timeInfo->timeCode.timeCodeSamples);
+        event.bufferSwitchEvent.time.flags |= CASIO_TimeFlag_TCSamples;
+    }
+
+    engineBufferSwitch(device, &event, doubleBufferIndex);
+
+    return nullptr; // ?? what of that ASIOTime * we're supposed to return?
+}
+
+void onBufferSwitch(CASIO_Device device, long doubleBufferIndex, ASIOBool directProcess)
+{
+    // the actual processing callback.
+    // Beware that this is normally in a seperate thread, hence be sure that you take care
+    // about thread synchronization. This is omitted here for simplicity.
+
+    // bufferSwitch indicates that both input and output are to be processed.
+    // the current buffer half index (0 for A, 1 for B) determines
+    // - the output buffer that the host should start to fill. the other buffer
+    //   will be passed to output hardware regardless of whether it got filled
+    //   in time or not.
+    // - the input buffer that is now filled with incoming data. Note that
+    //   because of the synchronicity of i/o, the input always has at
+    //   least one buffer latency in relation to the output.
+    // directProcess suggests to the host whether it should immedeately
+    // start processing (directProcess == ASIOTrue), or whether its process
+    // should be deferred because the call comes from a very low level
+    // (for instance, a high level priority interrupt), and direct processing
+    // would cause timing instabilities for the rest of the system. If in doubt,
+    // directProcess should be set to ASIOFalse.
+    // Note: bufferSwitch may be called at interrupt time for highest efficiency.
+
+    // as this is a "back door" into the bufferSwitchTimeInfo a timeInfo needs to be created
+    // though it will only set the timeInfo.samplePosition and timeInfo.systemTime fields and the according flags
+    ASIOTime  timeInfo;
+    memset(&timeInfo, 0, sizeof(timeInfo));
+
+    // get the time stamp of the buffer, not necessary if no
+    // synchronization to other media is required
+    if (asioOf(device)->driver->getSamplePosition(&timeInfo.timeInfo.samplePosition, &timeInfo.timeInfo.systemTime) == ASE_OK) {
+        timeInfo.timeInfo.flags = kSystemTimeValid | kSamplePositionValid;
+    }
+
+    onBufferSwitchTimeInfo(device, &timeInfo, doubleBufferIndex, directProcess);
+}
+
+void onSampleRateDidChange(CASIO_Device device, ASIOSampleRate sRate)
+{
+    // gets called when the AudioStreamIO detects a sample rate change
+    // If sample rate is unknown, 0 is passed (for instance, clock loss
+    // when externally synchronized).
+    //
+    // do whatever you need to do if the sample rate changed
+    // usually this only happens during external sync.
+    // You might have to update time/sample related conversion routines, etc.
+    engineSampleRateChanged(device, sRate);
+}
+
+long onAsioMessage(CASIO_Device device, long selector, long value, void* message, double* opt)
+{
+    // generic callback for various purposes, see selectors below.
+    // note this is only present if the asio version is 2 or higher
+    // (the engine records and acts on the notifications, the queries are answered here)
+    engineHostMessage(device, selector, value);
+
+    switch (selector) {
+    case kAsioSelectorSupported:
+        switch (value) {
+        case kAsioEngineVersion:
+        case kAsioResetRequest:
+        case kAsioBufferSizeChange:
+        case kAsioResyncRequest:
+        case kAsioLatenciesChanged:
+        case kAsioSupportsTimeInfo:
+        case kAsioSupportsTimeCode:
+        case kAsioOverload:
+            return 1;
+        default:
+            return 0;
+        }
+        break;
+
+    case kAsioEngineVersion:
+        // return the supported ASIO version of the host application
+        // If a host applications does not implement this selector, ASIO 1.0 is assumed
+        // by the driver
+        return 2;
+
+    case kAsioSupportsTimeInfo:
+        // informs the driver wether the asioCallbacks.bufferSwitchTimeInfo() callback
+        // is supported.
+        // For compatibility with ASIO 1.0 drivers the host application should always support
+        // the "old" bufferSwitch method, too.
+        return 1;
+
+    case kAsioSupportsTimeCode:
+        // informs the driver wether application is interested in time code info.
+        // If an application does not need to know about time code, the driver has less work
+        // to do.
+        return 0;
+
+    case kAsioOverload:
+        return 1;
+    }
+    return 0;
+}
+
+static_assert((long)kAsioSelectorSupported == HostMessage_SelectorSupported && (long)kAsioResetRequest == HostMessage_ResetRequest &&
+    (long)kAsioLatenciesChanged == HostMessage_LatenciesChanged && (long)kAsioOverload == HostMessage_Overload);
+
+//============ below is our attempt to support multiple ASIO devices at once, since the callbacks have no user data / context arguments
+
+static CASIO_Device globalDevices[MAX_OPEN_DEVICES];
+
+#define ASIO_CALLBACKS_DECL(x) \
+ASIOTime* onBufferSwitchTimeInfo_##x(ASIOTime* timeInfo, long doubleBufferIndex, ASIOBool directProcess) { \
+    return onBufferSwitchTimeInfo(globalDevices[x], timeInfo, doubleBufferIndex, directProcess); \
+} \
+void onBufferSwitch_##x(long doubleBufferIndex, ASIOBool directProcess) { \
+    onBufferSwitch(globalDevices[x], doubleBufferIndex, directProcess); \
+} \
+void onSampleRateDidChange_##x(ASIOSampleRate sRate) { \
+    onSampleRateDidChange(globalDevices[x], sRate); \
+} \
+long onAsioMessage_##x(long selector, long value, void* message, double* opt) { \
+    return onAsioMessage(globalDevices[x], selector, value, message, opt); \
+}
+
+ASIO_CALLBACKS_DECL(0)
+ASIO_CALLBACKS_DECL(1)
+ASIO_CALLBACKS_DECL(2)
+ASIO_CALLBACKS_DECL(3)
+ASIO_CALLBACKS_DECL(4)
+ASIO_CALLBACKS_DECL(5)
+ASIO_CALLBACKS_DECL(6)
+ASIO_CALLBACKS_DECL(7)
+
+#define ASIO_CALLBACK_STRUCT(x) { onBufferSwitch_##x, onSampleRateDidChange_##x, onAsioMessage_##x, onBufferSwitchTimeInfo_##x }
+static ASIOCallbacks globalCallbacks[] = {
+    ASIO_CALLBACK_STRUCT(0),
+    ASIO_CALLBACK_STRUCT(1),
+    ASIO_CALLBACK_STRUCT(2),
+    ASIO_CALLBACK_STRUCT(3),
+    ASIO_CALLBACK_STRUCT(4),
+    ASIO_CALLBACK_STRUCT(5),
+    ASIO_CALLBACK_STRUCT(6),
+    ASIO_CALLBACK_STRUCT(7),
+};
+
+//============ backend =======================================================
+
+static bool asioInit()
+{
+    hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED); //COINIT_MULTITHREADED
+    if (FAILED(hr)) {
+        logMessage("CoInitializeEx failed :(");
+        return false;
+    }
+    return true;
+}
+
+static void asioShutdown()
+{
+    CoUninitialize();
+}
+
+static bool testOpenDevice(CLSID clsid) {
+    IASIO *driver;
+    const GUID iid = clsid; // ASIO drivers just re-use their own CLSID as the IASIO interface IID. pretty sure that's wrong, but whatever ...
+    hr = CoCreateInstance(clsid, nullptr, CLSCTX_INPROC_SERVER, iid, reinterpret_cast<LPVOID *>(&driver));
+    if (SUCCEEDED(hr)) {
+        if (driver->init(nullptr) == ASIOTrue) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void asioEnumerate(std::vector<CASIO_DeviceID> &ids)
+{
+    // list all the keys in HKEY_LOCAL_MACHINE\SOFTWARE\ASIO
+    HKEY asioKey;
+    LONG result;
+    result = RegOpenKeyW(HKEY_LOCAL_MACHINE, L"SOFTWARE\\ASIO", &asioKey);
+    if (result == ERROR_SUCCESS) {
+        // list devices
+        DWORD index = 0;
+        WCHAR deviceKeyName[MAX_REGKEY_LENGTH + 1]; // no ASIO devices should have a longer name than that ... (proper way is to use RegQueryInfoKey() to get max subkey len)
+        while (true) {
+            result = RegEnumKeyW(asioKey, index++, deviceKeyName, MAX_REGKEY_LENGTH); // -1 probably not necessary, but why take chances?
+            if (result == ERROR_SUCCESS) {
+                // get that key's values
+                WCHAR valueStr[MAX_REGVALUE_LENGTH + 1];
+
+                // CLSID
+                DWORD valueLen = MAX_REGVALUE_LENGTH;
+                RegGetValueW(asioKey, deviceKeyName, L"CLSID", RRF_RT_REG_SZ, NULL, valueStr, &valueLen);
+                CLSID clsid;
+                CLSIDFromString(valueStr, &clsid);
+
+                // verify it's actually connected ...
+                if (!testOpenDevice(clsid)) {
+                    continue;
+                }
+
+                auto id = new _CASIO_DeviceID;
+                id->backend = &asioBackend;
+                id->key = wstring_to_utf8(valueStr);
+
+                // description = name
+                valueLen = MAX_REGVALUE_LENGTH;
+                RegGetValueW(asioKey, deviceKeyName, L"Description", RRF_RT_REG_SZ, NULL, valueStr, &valueLen);
+                id->name = wstring_to_utf8(valueStr);
+
+                ids.push_back(id);
+            }
+            else if (result == ERROR_NO_MORE_ITEMS) {
+                break;
+            }
+            else {
+                logMessage("unknown reg key enumeration error");
+                break;
+            }
+        }
+    }
+}
+
+static bool asioOpen(CASIO_Device device, CASIO_DeviceID id)
+{
+    IASIO *driver;
+    CLSID clsid;
+    CLSIDFromString(utf8_to_wstring(id->key).c_str(), &clsid);
+    GUID iid = clsid; // ASIO drivers just re-use their own CLSID as the IASIO interface IID. pretty sure that's wrong, but whatever ...
+    auto step = timelineBegin();
+    hr = CoCreateInstance(clsid, NULL, CLSCTX_INPROC_SERVER, iid, (LPVOID *)&driver);
+    timelineEnd("CoCreateInstance", id->name.c_str(), step);
+    if (FAILED(hr)) {
+        logMessage("COM instantiation failed");
+        return false;
+    }
+
+    int globalIndex = 0;
+    while (globalIndex < MAX_OPEN_DEVICES && globalDevices[globalIndex]) {
+        globalIndex++;
+    }
+    if (globalIndex == MAX_OPEN_DEVICES) {
+        logFormat("can't open more than %d ASIO devices at once", MAX_OPEN_DEVICES);
+        driver->Release();
+        return false;
+    }
+
+    auto asio = new AsioDevice;
+    asio->driver = driver;
+    asio->globalIndex = globalIndex;
+    device->backendData = asio;
+
+    driver->getDriverName(device->name);
+    logFormatDev(device, "opened successfully (global index %d)", asio->globalIndex);
+
+    device->driverVersion = driver->getDriverVersion();
+    logFormatDev(device, "driver version: %08X", device->driverVersion);
+
+    step = timelineBegin();
+    ASIOBool initResult; // (declared apart from the assignment, so the gotos below can jump over it)
+    initResult = driver->init(0); // pass 0 for sysref, since we don't use it (for that matter, why does ASIO want it?)
+    timelineEnd("init", device->name, step);
+    if (initResult != ASIOTrue) {
+        driver->getErrorMessage(errorMessage);
+        logFormat("init error: %s", errorMessage);
+        goto errorExit;
+    }
+    logFormatDev(device, "ASIO init OK");
+
+    // formerly init_static_data:
+    // get channels
+    driver->getChannels(&device->numInputs, &device->numOutputs);
+    logFormatDev(device, "channels in/out: %d/%d", device->numInputs, device->numOutputs);
+
+    // clamp channels
+    device->numInputs = std::min(device->numInputs, (long)MAX_INPUT_CHANNELS);
+    device->numOutputs = std::min(device->numOutputs, (long)MAX_OUTPUT_CHANNELS);
+
+    // get buffer size
+    driver->getBufferSize(&device->buffer.minSize, &device->buffer.maxSize, &device->buffer.prefSize, &device->buffer.granularity);
+    logFormatDev(device, "buffer min/max/pref/gran: %d, %d, %d, %d",
+        device->buffer.minSize, device->buffer.maxSize, device->buffer.prefSize, device->buffer.granularity);
+
+    // get sample rate / set sample rate
+    driver->getSampleRate(&device->sampleRate);
+    logFormatDev(device, "current samplerate: %.2f", device->sampleRate);
+    // set it to something specific if not between 0 and 96khz
+
+    // ASIOOutputReady optimization check
+    device->supportsOutputReady = (driver->outputReady() == ASE_OK);
+    if (device->supportsOutputReady) {
+        logFormatDev(device, "driver supports outputRead()");
+    }
+
+    // ===== create_asio_buffers ======
+    for (int i = 0; i < device->numInputs + device->numOutputs; i++) {
+        auto info = &asio->bufferInfos[i];
+        if (i < device->numInputs) {
+            info->isInput = ASIOTrue;
+            info->channelNum = i;
+        }
+        else {
+            info->isInput = ASIOFalse;
+            info->channelNum = i - device->numInputs;
+        }
+        info->buffers[0] = info->buffers[1] = NULL;
+    }
+
+    // our ghetto method of supporting multiple ASIO devices at once
+    asio->callbacks = globalCallbacks[asio->globalIndex];
+
+    // immediately assign to globalDevices, lest any callbacks fire as soon as we create buffers (ie, where callbacks are assigned)
+    globalDevices[asio->globalIndex] = device;
+
+    device->buffer.currentSize = device->buffer.prefSize;
+
+    step = timelineBegin();
+    ASIOError createResult;
+    createResult = driver->createBuffers(asio->bufferInfos, device->numInputs + device->numOutputs, device->buffer.currentSize,
+        &asio->callbacks);
+    timelineEnd("createBuffers", device->name, step);
+    if (createResult == ASE_OK) {
+        logFormatDev(device, "successfully created buffers");
+
+        // ASIOGetChannelInfo
+        step = timelineBegin();
+        for (int i = 0; i < device->numInputs + device->numOutputs; i++) {
+            auto info = &asio->channelInfos[i];
+            info->channel = asio->bufferInfos[i].channelNum;
+            info->isInput = asio->bufferInfos[i].isInput;
+            if (driver->getChannelInfo(info) == ASE_OK) {
+                logFormatDev(device, "  - channel - %s:%d [%s], grp %d, %s, sampletype: %d",
+                    info->isInput ? "input" : "output",
+                    info->channel,
+                    info->name,
+                    info->channelGroup,
+                    info->isActive ? "active" : "inactive",
+                    info->type);
+            }
+            else {
+                driver->getErrorMessage(errorMessage);
+                logFormatDev(device, "error getting channel info (%d/%s) - err %s", info->channel, info->isInput ? "input" : "output",
+                    errorMessage);
+                //
+                goto errorExit;
+            }
+        }
+        timelineEnd("getChannelInfo", device->name, step);
+
+        device->sampleFormat = toSampleFormat(asio->channelInfos[0].type);
+        device->sampleSize = getSampleSize(asio->channelInfos[0].type);
+
+        // "destructure" the ASIO double-buffers to make them easier to pass to the client callback
+        for (int i = 0; i < device->numInputs + device->numOutputs; i++) {
+            if (i < device->numInputs) {
+                device->bufferPtrs[0].inputs[i] = asio->bufferInfos[i].buffers[0];
+                device->bufferPtrs[1].inputs[i] = asio->bufferInfos[i].buffers[1];
+            }
+            else {
+                auto outIndex = i - device->numInputs;
+                device->bufferPtrs[0].outputs[outIndex] = asio->bufferInfos[i].buffers[0];
+                device->bufferPtrs[1].outputs[outIndex] = asio->bufferInfos[i].buffers[1];
+            }
+        }
+
+        if (driver->getLatencies(&device->inputLatency, &device->outputLatency) == ASE_OK) {
+            logFormatDev(device, "i/o latencies: %d/%d", device->inputLatency, device->outputLatency);
+            // prepared and ready to start!
+            // already assigned to globalDevices, right before buffers created
+            return true;
+        }
+        else {
+            driver->getErrorMessage(errorMessage);
+            logFormatDev(device, "error getting latencies: %s", errorMessage);
+        }
+    }
+    else {
+        driver->getErrorMessage(errorMessage);
+        logFormatDev(device, "failed to create buffers: %s", errorMessage);
+    }
+errorExit:
+    globalDevices[asio->globalIndex] = nullptr;
+    driver->Release();
+    delete asio;
+    device->backendData = nullptr;
+    return false;
+}
+
+static void asioClose(CASIO_Device device)
+{
+    auto asio = asioOf(device);
+    asio->driver->disposeBuffers();
+    logFormatDev(device, "buffers disposed");
+    asio->driver->Release();
+    globalDevices[asio->globalIndex] = nullptr;
+    logFormatDev(device, "COM instance released");
+    delete asio;
+}
+
+static bool asioStart(CASIO_Device device)
+{
+    if (asioOf(device)->driver->start() == ASE_OK) {
+        logFormatDev(device, "ASIO playback started");
+        return true;
+    }
+    return false;
+}
+
+static bool asioStop(CASIO_Device device)
+{
+    if (asioOf(device)->driver->stop() == ASE_OK) {
+        logFormatDev(device, "ASIO playback stopped");
+        return true;
+    }
+    return false;
+}
+
+static bool asioSetSampleRate(CASIO_Device device, double sampleRate)
+{
+    return asioOf(device)->driver->setSampleRate(sampleRate) == ASE_OK;
+}
+
+static bool asioControlPanel(CASIO_Device device)
+{
+    return asioOf(device)->driver->controlPanel() == ASE_OK;
+}
+
+static void asioOutputReady(CASIO_Device device)
+{
+    asioOf(device)->driver->outputReady();
+}
+
+const HostBackend asioBackend = {
+    "asio",
+    true,
+    asioInit,
+    asioShutdown,
+    asioEnumerate,
+    asioOpen,
+    asioClose,
+    asioStart,
+    asioStop,
+    asioSetSampleRate,
+    asioControlPanel,
+    asioOutputReady,
+};
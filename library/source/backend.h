@@ -0,0 +1,57 @@
+#pragma once
+
+#include "CASIOClient.h"
+
+#include <string>
+#include <vector>
+
+// host backends: where a device's buffers and callbacks come from.
+//
+// everything about a device that doesn't depend on the host API lives in the engine (engine.h): properties,
+// buffer pointers, the per-buffer processing chain, event dispatch, standby routing. a backend fills in the
+// properties and buffer pointers when it opens a device, then calls the engine entry points (engineBufferSwitch,
+// engineSampleRateChanged, engineHostMessage) from whatever thread the host calls it back on.
+//
+// the ones CASIO_EnumerateDevices lists, in this order:
+//   asio (windows): COM drivers registered under HKLM\SOFTWARE\ASIO
+//   null (CASIO_NULL_BACKEND): a device with silent inputs, run off a timer thread. for building and running
+//        everything without audio hardware. CASIO_NULL_DEVICE="inputs,outputs,bufferSize,sampleRate" changes
+//        its shape from the default 8,8,256,48000
+// recorded traces (CASIO_OpenTrace) and shared devices (CASIO_ConnectShared) are backends as well, opened by their own calls.
+
+struct HostBackend {
+    const char *name;
+    bool hostDevice; // a device in its own right rather than a view of one: can be served, can have a standby
+
+    // all optional (open is needed by the ones that enumerate)
+    bool (*init)();
+    void (*shutdown)();
+    void (*enumerate)(std::vector<CASIO_DeviceID> &ids);
+    bool (*open)(CASIO_Device device, CASIO_DeviceID id); // properties, buffers and backendData. logs what went wrong
+    void (*close)(CASIO_Device device);
+    bool (*start)(CASIO_Device device);
+    bool (*stop)(CASIO_Device device);
+    bool (*setSampleRate)(CASIO_Device device, double sampleRate);
+    bool (*controlPanel)(CASIO_Device device);
+    void (*outputReady)(CASIO_Device device); // audio thread, only if the device supportsOutputReady
+};
+
+struct _CASIO_DeviceID {
+    const HostBackend *backend;
+    std::string name;
+    std::string key; // backend-specific (the ASIO driver's CLSID)
+};
+
+#ifdef _WIN32
+extern const HostBackend asioBackend;
+#endif
+#ifdef CASIO_NULL_BACKEND
+extern const HostBackend nullBackend;
+#endif
+extern const HostBackend traceBackend;
+extern const HostBackend sharedBackend;
+
+// these two aren't opened through a CASIO_DeviceID
+bool traceBackendOpen(CASIO_Device device, const char *path);
+bool traceBackendReplay(CASIO_Device device, bool realtime); // on the calling thread
+bool sharedBackendOpen(CASIO_Device device, const char *name);
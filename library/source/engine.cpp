@@ -0,0 +1,363 @@
+#include "engine.h"
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+CASIO_EventCallback apiClientCallback = nullptr;
+
+//============ logging stuff =================================================
+
+void logMessage(const char *message) {
+    CASIO_Event event;
+    event.eventType = CASIO_EventType_Log;
+    // .handled doesn't matter
+    event.logEvent.message = message;
+    apiClientCallback(&event, nullptr, nullptr);
+}
+
+#define VSPRINTF_BUFFER_LEN 10*1024
+thread_local char formatBuffer[VSPRINTF_BUFFER_LEN]; // (backends log from their own threads)
+void logFormat(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(formatBuffer, VSPRINTF_BUFFER_LEN, format, args);
+    va_end(args);
+    //
+    logMessage(formatBuffer);
+}
+
+#define DEV_FORMAT_BUFFER_LEN 1024
+thread_local char devFormat[DEV_FORMAT_BUFFER_LEN];
+void logFormatDev(CASIO_Device d, const char *format, ...) {
+    snprintf(devFormat, DEV_FORMAT_BUFFER_LEN, "[%s] %s", d->name, format);
+    //
+    va_list args;
+    va_start(args, format);
+    vsnprintf(formatBuffer, VSPRINTF_BUFFER_LEN, devFormat, args);
+    va_end(args);
+    //
+    logMessage(formatBuffer);
+}
+
+//============ device setup ==================================================
+
+uint64_t steadyNow() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int sampleFormatSize(CASIO_SampleFormat format) {
+    switch (format) {
+    case CASIO_SampleFormat_Int32:
+    case CASIO_SampleFormat_Float32:
+        return 4;
+    case CASIO_SampleFormat_Float64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+void engineDeviceOpened(CASIO_Device device) {
+    meterReset(&device->meters);
+    silenceReset(&device->silence);
+    scheduleReset(&device->scheduler);
+}
+
+void engineAllocateBuffers(CASIO_Device device) {
+    auto bufferByteLength = (size_t)device->buffer.currentSize * device->sampleSize;
+    auto numChannels = device->numInputs + device->numOutputs;
+    device->ownBuffers = new uint8_t[(size_t)numChannels * 2 * bufferByteLength]();
+    for (int i = 0; i < numChannels; i++) {
+        for (int half = 0; half < 2; half++) {
+            auto buffer = device->ownBuffers + ((size_t)i * 2 + half) * bufferByteLength;
+            if (i < device->numInputs) {
+                device->bufferPtrs[half].inputs[i] = buffer;
+            }
+            else {
+                device->bufferPtrs[half].outputs[i - device->numInputs] = buffer;
+            }
+        }
+    }
+}
+
+void engineFreeBuffers(CASIO_Device device) {
+    delete[] device->ownBuffers;
+    device->ownBuffers = nullptr;
+}
+
+//============ callbacks =====================================================
+
+// everything after the host-specific time info conversion and routing, shared with trace replay and shared clients
+// io is the device whose driver and buffers serve this bufferSwitch: the device itself, or its standby after a failover
+void processBufferSwitch(CASIO_Device device, CASIO_Device io, CASIO_Event *bufferSwitch, long doubleBufferIndex)
+{
+    auto &event = *bufferSwitch;
+    auto span = timelineBegin();
+    event.bufferSwitchEvent.inputs = io->bufferPtrs[doubleBufferIndex].inputs;
+    event.bufferSwitchEvent.outputs = io->bufferPtrs[doubleBufferIndex].outputs;
+    event.bufferSwitchEvent.activeInputs = silenceProcess(&device->silence, device->sampleFormat, device->buffer.currentSize,
+        event.bufferSwitchEvent.inputs, device->numInputs);
+
+    device->traceWriter.use([&](TraceWriter *writer) {
+        traceWriteBufferSwitch(writer, &event);
+    });
+    device->losslessWriter.use([&](LosslessWriter *writer) {
+        losslessWrite(writer, event.bufferSwitchEvent.inputs, device->buffer.currentSize);
+    });
+    device->sharedServer.use([&](SharedServer *server) {
+        sharedServerPublish(server, &event); // as early as possible, so other processes work in parallel with us
+    });
+    device->netBridge.use([&](NetBridge *bridge) {
+        netBridgeCapture(bridge, &event);
+    });
+
+    // scheduled actions: triggers go out ahead of the buffer they land in, the rest is applied to the output below
+    auto scheduler = &device->scheduler;
+    scheduleBegin(scheduler, event.bufferSwitchEvent.time.samples,
+        (event.bufferSwitchEvent.time.flags & CASIO_TimeFlag_Samples) != 0, device->buffer.currentSize);
+    for (int i = 0; i < scheduler->numDue; i++) {
+        if (scheduler->pending[i].type == CASIO_Action_Trigger) {
+            CASIO_Event trigger;
+            trigger.eventType = CASIO_EventType_ScheduledAction;
+            trigger.handled = false;
+            trigger.scheduledActionEvent.action = &scheduler->pending[i];
+            trigger.scheduledActionEvent.sampleOffset = scheduleOffset(scheduler, scheduler->pending[i]);
+            apiClientCallback(&trigger, device, device->userData);
+        }
+    }
+    timelineEnd("preprocess", device->name, span);
+
+    span = timelineBegin();
+    apiClientCallback(&event, device, device->userData);
+    timelineEnd("clientCallback", device->name, span);
+
+    device->graph.use([&](GraphEngine *graph) {
+        auto span = timelineBegin();
+        graphProcess(graph, event.bufferSwitchEvent.inputs, event.bufferSwitchEvent.outputs);
+        timelineEnd("graph", device->name, span);
+    });
+
+    span = timelineBegin();
+    device->sharedServer.use([&](SharedServer *server) {
+        sharedServerMix(server, event.bufferSwitchEvent.outputs);
+    });
+    device->netBridge.use([&](NetBridge *bridge) {
+        netBridgePlay(bridge, event.bufferSwitchEvent.outputs);
+    });
+    scheduleApply(scheduler, device->sampleFormat, device->buffer.currentSize, event.bufferSwitchEvent.outputs, device->numOutputs);
+    device->latencyProbe.use([&](LatencyProbe *probe) {
+        latencyProbeProcess(probe, device->sampleFormat, device->buffer.currentSize,
+            event.bufferSwitchEvent.inputs, event.bufferSwitchEvent.outputs);
+    });
+    timelineEnd("postprocess", device->name, span);
+
+    // finally if the driver supports the ASIOOutputReady() optimization, do it here, all data are in place
+    if (io->supportsOutputReady) {
+        span = timelineBegin();
+        io->backend->outputReady(io);
+        timelineEnd("outputReady", device->name, span);
+    }
+
+    // metering reads only, so it's done after outputReady to keep it off the output deadline
+    if (device->meters.enabled.load(std::memory_order_relaxed)) {
+        span = timelineBegin();
+        meterProcess(&device->meters, device->sampleFormat, device->buffer.currentSize,
+            event.bufferSwitchEvent.inputs, device->numInputs, event.bufferSwitchEvent.activeInputs,
+            event.bufferSwitchEvent.outputs, device->numOutputs);
+        timelineEnd("metering", device->name, span);
+    }
+}
+
+// silence a device's outputs from channel `from` on, and hand them over
+static void muteBuffers(CASIO_Device device, long doubleBufferIndex, int from)
+{
+    auto bytes = device->buffer.currentSize * device->sampleSize;
+    for (int i = from; i < device->numOutputs; i++) {
+        memset(device->bufferPtrs[doubleBufferIndex].outputs[i], 0, bytes);
+    }
+    if (device->supportsOutputReady && from == 0) {
+        device->backend->outputReady(device);
+    }
+}
+
+// bufferSwitch of a standby device: keep quiet and watch the primary, or stand in for it once it failed
+static void standbyBufferSwitch(CASIO_Device standby, CASIO_Event *bufferSwitch, long doubleBufferIndex)
+{
+    auto primary = standby->standbyFor;
+    if (!primary->failedOver.load(std::memory_order_acquire)) {
+        auto now = steadyNow();
+        auto reason = CASIO_Failover_None;
+        uint64_t faultAt = 0;
+        auto last = primary->lastBufferAt.load(std::memory_order_relaxed);
+        if (primary->started && last) {
+            auto fault = (CASIO_FailoverReason)primary->fault.load();
+            if (fault != CASIO_Failover_None && !primary->inCallback.load()) {
+                // (if the primary is still inside a callback, it's alive enough to finish it: take over on the next buffer)
+                reason = fault;
+                faultAt = primary->faultAt.load();
+            }
+            else if (now > last + primary->watchdogNs) {
+                reason = CASIO_Failover_Watchdog;
+                faultAt = last + primary->watchdogNs;
+            }
+        }
+        if (reason == CASIO_Failover_None) {
+            muteBuffers(standby, doubleBufferIndex, 0);
+            return;
+        }
+
+        // take over. continue the primary's sample timeline where it stopped
+        auto &time = bufferSwitch->bufferSwitchEvent.time;
+        if (time.flags & CASIO_TimeFlag_Samples) {
+            primary->samplesOffset = (int64_t)(primary->lastSamples.load(std::memory_order_relaxed) + primary->buffer.currentSize) -
+                (int64_t)time.samples;
+        }
+        auto &status = primary->failoverStatus;
+        status.reason = reason;
+        status.gapNs = now - last;
+        status.switchNs = steadyNow() - faultAt;
+        // seq_cst, paired with the primary setting inCallback before it checks failedOver (engineBufferSwitch):
+        // whatever the interleaving, at most one of the two gets to process a buffer
+        primary->failedOver.store(true);
+    }
+
+    // a primary stuck in its callback (a watchdog takeover) still owns the client and its buffers: mute until it
+    // returns rather than run the client twice at once. it sees failedOver on its way back in and only idles after that
+    if (!primary->started || primary->inCallback.load()) {
+        muteBuffers(standby, doubleBufferIndex, 0);
+        return;
+    }
+    if (!primary->failoverAnnounced) {
+        primary->failoverAnnounced = true;
+        auto &status = primary->failoverStatus;
+        CASIO_Event event;
+        event.eventType = CASIO_EventType_Failover;
+        event.handled = false;
+        event.failoverEvent.reason = status.reason;
+        event.failoverEvent.switchNs = status.switchNs;
+        event.failoverEvent.gapNs = status.gapNs;
+        apiClientCallback(&event, primary, primary->userData);
+    }
+    bufferSwitch->bufferSwitchEvent.time.samples += primary->samplesOffset;
+    muteBuffers(standby, doubleBufferIndex, primary->numOutputs); // whatever the primary didn't have
+    processBufferSwitch(primary, standby, bufferSwitch, doubleBufferIndex);
+}
+
+void engineBufferSwitch(CASIO_Device device, CASIO_Event *event, long doubleBufferIndex)
+{
+    // covers the whole callback, from the driver's point of view
+    TIMELINE_SPAN("bufferSwitch", device->name);
+
+    if (device->standbyFor) {
+        standbyBufferSwitch(device, event, doubleBufferIndex);
+    }
+    else {
+        // set before checking failedOver, the standby does it the other way round (see standbyBufferSwitch)
+        device->inCallback.store(true);
+        if (device->failedOver.load()) {
+            muteBuffers(device, doubleBufferIndex, 0); // its standby took over, this one only idles now
+        }
+        else {
+            if (device->started) {
+                device->lastBufferAt.store(steadyNow(), std::memory_order_relaxed);
+                device->lastSamples.store(event->bufferSwitchEvent.time.samples, std::memory_order_relaxed);
+            }
+            processBufferSwitch(device, device, event, doubleBufferIndex);
+        }
+        device->inCallback.store(false);
+    }
+}
+
+// a primary with a standby flags driver-reported faults for the standby to act on
+static void reportFault(CASIO_Device device, CASIO_FailoverReason reason)
+{
+    if (device->standby && !device->failedOver.load() && device->fault.load() == CASIO_Failover_None) {
+        device->faultAt.store(steadyNow());
+        device->fault.store(reason);
+    }
+}
+
+void engineSampleRateChanged(CASIO_Device device, double sampleRate)
+{
+    // Audio processing is not stopped by the driver, actual sample rate
+    // might not have even changed, maybe only the sample rate status of an
+    // AES/EBU or S/PDIF digital input at the audio device.
+    TIMELINE_SPAN("sampleRateDidChange", device->name);
+    device->traceWriter.use([&](TraceWriter *writer) {
+        traceWriteSampleRate(writer, sampleRate);
+    });
+    if (sampleRate == 0) {
+        reportFault(device, CASIO_Failover_ClockLoss);
+    }
+
+    // a standby only speaks for its primary once it took over
+    auto target = device;
+    if (device->standbyFor) {
+        if (!device->standbyFor->failedOver.load(std::memory_order_acquire)) {
+            return;
+        }
+        target = device->standbyFor;
+    }
+
+    CASIO_Event event;
+    event.eventType = CASIO_EventType_SampleRateChanged;
+    event.handled = false;
+    event.sampleRateChangedEvent.newSampleRate = sampleRate;
+    apiClientCallback(&event, target, target->userData);
+}
+
+void engineHostMessage(CASIO_Device device, long message, long value)
+{
+    TIMELINE_SPAN("asioMessage", device->name);
+    device->traceWriter.use([&](TraceWriter *writer) {
+        traceWriteAsioMessage(writer, message, value);
+    });
+
+    switch (message) {
+    case HostMessage_SelectorSupported:
+    case HostMessage_EngineVersion:
+    case HostMessage_SupportsTimeInfo:
+    case HostMessage_SupportsTimeCode:
+        break; // queries, answered by the backend
+
+    case HostMessage_ResetRequest:
+        // defer the task and perform the reset of the driver during the next "safe" situation
+        // You cannot reset the driver right now, as this code is called from the driver.
+        // Reset the driver is done by completely destruct is. I.e. ASIOStop(), ASIODisposeBuffers(), Destruction
+        // Afterwards you initialize the driver again.
+        logMessage("kAsioResetRequest");
+        reportFault(device, CASIO_Failover_ResetRequest);
+        break;
+
+    case HostMessage_BufferSizeChange:
+        logMessage("kAsioBufferSizeChange");
+        break;
+
+    case HostMessage_ResyncRequest:
+        // This informs the application, that the driver encountered some non fatal data loss.
+        // It is used for synchronization purposes of different media.
+        // Added mainly to work around the Win16Mutex problems in Windows 95/98 with the
+        // Windows Multimedia system, which could loose data because the Mutex was hold too long
+        // by another thread.
+        // However a driver can issue it in other situations, too.
+        logMessage("kAsioResyncRequest");
+        break;
+
+    case HostMessage_LatenciesChanged:
+        // This will inform the host application that the drivers were latencies changed.
+        // Beware, it this does not mean that the buffer sizes have changed!
+        // You might need to update internal delay data.
+        logMessage("kAsioLatenciesChanged");
+        break;
+
+    case HostMessage_Overload:
+        logMessage("kAsioOverload!");
+        break;
+
+    default:
+        logFormat("unhandled asioMessage selector %d\n", message);
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "CASIOClient.h"
+#include "backend.h"
+
+#include "metering.h"
+#include "silence.h"
+#include "schedule.h"
+#include "tracefile.h"
+#include "timeline.h"
+#include "shareddevice.h"
+#include "netbridge.h"
+#include "latency.h"
+#include "graph.h"
+#include "lossless.h"
+
+#include <atomic>
+#include <cstdint>
+
+// the device itself, whatever backend serves it (see backend.h)
+
+#define MAX_INPUT_CHANNELS 64
+#define MAX_OUTPUT_CHANNELS 64
+
+static_assert(MAX_INPUT_CHANNELS <= METER_MAX_CHANNELS && MAX_OUTPUT_CHANNELS <= METER_MAX_CHANNELS);
+static_assert(MAX_INPUT_CHANNELS <= SILENCE_MAX_CHANNELS); // activeInputs is a 64-bit mask
+static_assert(MAX_INPUT_CHANNELS <= LOSSLESS_MAX_CHANNELS);
+static_assert(MAX_OUTPUT_CHANNELS <= SCHEDULE_MAX_OUTPUTS);
+
+// host messages, numbered as ASIO's asioMessage selectors (which is also what traces record)
+enum HostMessage : long {
+    HostMessage_SelectorSupported = 1,
+    HostMessage_EngineVersion = 2,
+    HostMessage_ResetRequest = 3,
+    HostMessage_BufferSizeChange = 4,
+    HostMessage_ResyncRequest = 5,
+    HostMessage_LatenciesChanged = 6,
+    HostMessage_SupportsTimeInfo = 7,
+    HostMessage_SupportsTimeCode = 8,
+    HostMessage_Overload = 15,
+};
+
+// CASIO_GraphCreate's handle. owned by its device, so closing the device frees it too
+struct _CASIO_Graph {
+    CASIO_Device device;
+    GraphEngine *engine;
+};
+
+struct _CASIO_Device {
+    CASIO_DeviceID id; // null unless opened with CASIO_OpenDevice
+    const HostBackend *backend;
+    void *backendData = nullptr;
+    void *userData;
+
+    // various internal properties, filled in by the backend
+    char name[512];
+    long driverVersion = 0;
+    long numInputs = 0, numOutputs = 0;
+    struct {
+        long minSize, maxSize, prefSize, granularity;
+        long currentSize;
+    } buffer = {};
+    double sampleRate = 0;
+    bool supportsOutputReady = false;
+    long inputLatency = 0, outputLatency = 0;
+    CASIO_SampleFormat sampleFormat = CASIO_SampleFormat_Unknown; // Unknown: the engine passes buffers through untouched
+    int sampleSize = 0; // bytes, whatever the format
+
+    // destructured buffer pointers, easier to use in callback
+    struct {
+        void *inputs[MAX_INPUT_CHANNELS];
+        void *outputs[MAX_OUTPUT_CHANNELS];
+    } bufferPtrs[2]; // for double buffers
+    uint8_t *ownBuffers = nullptr; // engineAllocateBuffers, for backends without buffers of their own
+
+    std::atomic<bool> started = false;
+
+    MeterBank meters;
+    SilenceDetector silence;
+    Scheduler scheduler;
+
+    Detachable<TraceWriter> traceWriter;
+    Detachable<SharedServer> sharedServer;
+    Detachable<NetBridge> netBridge; // created with the first network stream
+    Detachable<LatencyProbe> latencyProbe; // while CASIO_MeasureLatency runs
+    Detachable<GraphEngine> graph; // CASIO_GraphCreate
+    CASIO_Graph graphHandle = nullptr; // ... and the client's handle to it
+    Detachable<LosslessWriter> losslessWriter;
+
+    bool latencyMeasured = false;
+    double measuredLatency = 0; // round trip, samples
+
+    // hot standby (CASIO_SetStandby), on the primary:
+    CASIO_Device standby = nullptr;
+    uint64_t watchdogNs = 0;
+    std::atomic<uint64_t> lastBufferAt = 0; // steady clock ns, 0 = hasn't called back since it was started
+    std::atomic<uint64_t> lastSamples = 0; // time.samples of the last buffer, so the standby can continue the timeline
+    std::atomic<bool> inCallback = false;
+    std::atomic<int> fault = CASIO_Failover_None; // reported by the driver, waiting for the standby to act on it
+    std::atomic<uint64_t> faultAt = 0;
+    std::atomic<bool> failedOver = false;
+    CASIO_FailoverStatus failoverStatus = {}; // written once by the standby's audio thread, before failedOver is set
+    bool failoverAnnounced = false; // standby's audio thread only, the event waits until it actually takes over
+    int64_t samplesOffset = 0; // added to the standby's time.samples
+    // ... and on the standby:
+    CASIO_Device standbyFor = nullptr;
+};
+
+extern CASIO_EventCallback apiClientCallback;
+
+void logMessage(const char *message);
+void logFormat(const char *format, ...);
+void logFormatDev(CASIO_Device d, const char *format, ...);
+
+uint64_t steadyNow(); // ns
+
+int sampleFormatSize(CASIO_SampleFormat format); // 0 for Unknown
+
+// once the properties are in: resets the per-device processing state
+void engineDeviceOpened(CASIO_Device device);
+// zeroed double buffers for every channel in one block, laid out the way a driver would hand them over
+void engineAllocateBuffers(CASIO_Device device);
+void engineFreeBuffers(CASIO_Device device);
+
+// backend callbacks, on the host's audio thread.
+// event: a bufferSwitch with the time info filled in, the engine does the rest
+void engineBufferSwitch(CASIO_Device device, CASIO_Event *event, long doubleBufferIndex);
+// the chain after routing (silence, capture, client callback, ...), without standby handling. for devices that can't
+// have one (traces, shared clients). io is the device whose buffers serve this bufferSwitch
+void processBufferSwitch(CASIO_Device device, CASIO_Device io, CASIO_Event *bufferSwitch, long doubleBufferIndex);
+void engineSampleRateChanged(CASIO_Device device, double sampleRate); // 0 = unknown (clock loss)
+void engineHostMessage(CASIO_Device device, long message, long value); // HostMessage
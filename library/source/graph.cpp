@@ -0,0 +1,451 @@
+#include "graph.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <avrt.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+typedef std::bitset<GRAPH_MAX_NODES> NodeSet;
+
+//============ sample conversion =============================================
+
+static void readInput(CASIO_SampleFormat format, const void *in, float *out, int frames) {
+    switch (format) {
+    case CASIO_SampleFormat_Int32:
+        for (int i = 0; i < frames; i++) {
+            out[i] = (float)(((const int32_t *)in)[i] * (1.0 / 2147483648.0));
+        }
+        break;
+    case CASIO_SampleFormat_Float32:
+        memcpy(out, in, frames * sizeof(float));
+        break;
+    case CASIO_SampleFormat_Float64:
+        for (int i = 0; i < frames; i++) {
+            out[i] = (float)((const double *)in)[i];
+        }
+        break;
+    default:
+        memset(out, 0, frames * sizeof(float));
+        break;
+    }
+}
+
+static void writeOutput(CASIO_SampleFormat format, const float *in, void *out, int frames) {
+    switch (format) {
+    case CASIO_SampleFormat_Int32:
+        for (int i = 0; i < frames; i++) {
+            auto v = std::clamp((double)in[i], -1.0, 1.0);
+            ((int32_t *)out)[i] = (int32_t)(v * 2147483647.0);
+        }
+        break;
+    case CASIO_SampleFormat_Float32:
+        memcpy(out, in, frames * sizeof(float));
+        break;
+    case CASIO_SampleFormat_Float64:
+        for (int i = 0; i < frames; i++) {
+            ((double *)out)[i] = in[i];
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+//============ execution =====================================================
+
+static void runNode(GraphEngine *engine, CompiledGraph *graph, int index) {
+    auto &node = graph->nodes[index];
+    auto frames = engine->bufferSamples;
+    for (int i = node.firstSum; i < node.firstSum + node.numSums; i++) {
+        auto &sum = graph->sums[i];
+        if (sum.first) {
+            memcpy(sum.dest, sum.source, frames * sizeof(float));
+        }
+        else {
+            for (int j = 0; j < frames; j++) {
+                sum.dest[j] += sum.source[j];
+            }
+        }
+    }
+    switch (node.type) {
+    case GraphNode_Source:
+        readInput(engine->format, engine->deviceInputs[node.channel], node.outputs[0], frames);
+        break;
+    case GraphNode_Sink:
+        writeOutput(engine->format, node.inputs[0], engine->deviceOutputs[node.channel], frames);
+        break;
+    case GraphNode_Processor:
+        node.process(node.context, node.inputs, node.outputs, frames);
+        break;
+    }
+    for (int i = node.firstSuccessor; i < node.firstSuccessor + node.numSuccessors; i++) {
+        auto successor = graph->successors[i];
+        if (graph->pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            engine->ready.push(successor); // (every node is queued once per buffer, so it can't be full)
+        }
+    }
+    graph->remaining.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+// takes nodes until the whole graph has run
+static void drain(GraphEngine *engine, CompiledGraph *graph) {
+    while (graph->remaining.load(std::memory_order_acquire) > 0) {
+        int index;
+        if (engine->ready.pop(index)) {
+            runNode(engine, graph, index);
+        }
+        else {
+            std::this_thread::yield(); // (whatever's left depends on nodes other threads are running)
+        }
+    }
+}
+
+static void workerThreadProc(GraphEngine *engine, bool realtime) {
+    // (on the worker itself: MMCSS only ever registers the calling thread)
+#ifdef _WIN32
+    HANDLE mmcss = nullptr;
+    if (realtime) {
+        DWORD taskIndex = 0;
+        mmcss = AvSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex);
+        realtime = mmcss || SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+    }
+#else
+    if (realtime) {
+        sched_param param = {};
+        param.sched_priority = std::min(GRAPH_WORKER_PRIORITY, sched_get_priority_max(SCHED_FIFO));
+        realtime = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+    }
+#endif
+    if (realtime) {
+        engine->realtimeWorkers++;
+    }
+    engine->startedWorkers++;
+
+    uint32_t seen = 0;
+    while (true) {
+        engine->epoch.wait(seen);
+        seen = engine->epoch.load();
+        if (engine->quit.load()) {
+            break;
+        }
+        // the audio thread clears workerGraph before it waits for busyWorkers to drop to 0:
+        // either it sees us here, or we see the null and stay out of a graph it's done with
+        engine->busyWorkers++;
+        if (auto graph = engine->workerGraph.load()) {
+            drain(engine, graph);
+        }
+        engine->busyWorkers--;
+    }
+#ifdef _WIN32
+    if (mmcss) {
+        AvRevertMmThreadCharacteristics(mmcss);
+    }
+#endif
+}
+
+void graphProcess(GraphEngine *engine, void **inputs, void **outputs)
+{
+    engine->compiled.use([&](CompiledGraph *graph) {
+        if (graph->nodes.empty()) {
+            return;
+        }
+        engine->deviceInputs = inputs;
+        engine->deviceOutputs = outputs;
+        for (size_t i = 0; i < graph->nodes.size(); i++) {
+            graph->pending[i].store(graph->nodes[i].numPredecessors, std::memory_order_relaxed);
+        }
+        graph->remaining.store((int)graph->nodes.size(), std::memory_order_relaxed);
+        for (auto root : graph->roots) {
+            engine->ready.push(root);
+        }
+
+        if (engine->workers.empty()) {
+            drain(engine, graph);
+            return;
+        }
+        engine->workerGraph.store(graph);
+        engine->epoch.fetch_add(1);
+        engine->epoch.notify_all();
+        drain(engine, graph);
+        engine->workerGraph.store(nullptr);
+        while (engine->busyWorkers.load() != 0) {
+            std::this_thread::yield(); // (they're only noticing that there's nothing left)
+        }
+    });
+}
+
+//============ setup =========================================================
+
+GraphEngine *graphCreate(CASIO_SampleFormat format, int bufferSamples, int numInputs, int numOutputs, int numThreads)
+{
+    auto engine = new GraphEngine();
+    engine->format = format;
+    engine->bufferSamples = bufferSamples;
+    engine->numInputs = numInputs;
+    engine->numOutputs = numOutputs;
+    numThreads = std::clamp(numThreads, 1, GRAPH_MAX_THREADS);
+    auto realtime = numThreads <= (int)std::thread::hardware_concurrency();
+    for (int i = 1; i < numThreads; i++) {
+        engine->workers.emplace_back(workerThreadProc, engine, realtime);
+    }
+    while (engine->startedWorkers.load() < (int)engine->workers.size()) {
+        std::this_thread::yield();
+    }
+    return engine;
+}
+
+void graphDestroy(GraphEngine *engine)
+{
+    engine->quit.store(true);
+    engine->epoch.fetch_add(1);
+    engine->epoch.notify_all();
+    for (auto &worker : engine->workers) {
+        worker.join();
+    }
+    delete engine->compiled.detach();
+    delete engine;
+}
+
+//============ editing =======================================================
+
+static int addNode(GraphEngine *engine, const GraphNode &node) {
+    for (size_t i = 0; i < engine->nodes.size(); i++) {
+        if (!engine->nodes[i].used) {
+            engine->nodes[i] = node;
+            return (int)i;
+        }
+    }
+    if (engine->nodes.size() >= GRAPH_MAX_NODES) {
+        return -1;
+    }
+    engine->nodes.push_back(node);
+    return (int)engine->nodes.size() - 1;
+}
+
+static bool validNode(GraphEngine *engine, int node) {
+    return node >= 0 && node < (int)engine->nodes.size() && engine->nodes[node].used;
+}
+
+int graphAddSource(GraphEngine *engine, int deviceInput)
+{
+    if (deviceInput < 0 || deviceInput >= engine->numInputs) {
+        return -1;
+    }
+    return addNode(engine, {true, GraphNode_Source, deviceInput, 0, 1, nullptr, nullptr});
+}
+
+int graphAddSink(GraphEngine *engine, int deviceOutput)
+{
+    if (deviceOutput < 0 || deviceOutput >= engine->numOutputs) {
+        return -1;
+    }
+    for (auto &node : engine->nodes) {
+        if (node.used && node.type == GraphNode_Sink && node.channel == deviceOutput) {
+            return -1; // one per output, wire several things into it instead
+        }
+    }
+    return addNode(engine, {true, GraphNode_Sink, deviceOutput, 1, 0, nullptr, nullptr});
+}
+
+int graphAddProcessor(GraphEngine *engine, int numInputs, int numOutputs, CASIO_NodeProcessFunc process, void *context)
+{
+    if (!process || numInputs < 0 || numInputs > GRAPH_MAX_PORTS || numOutputs < 0 || numOutputs > GRAPH_MAX_PORTS) {
+        return -1;
+    }
+    return addNode(engine, {true, GraphNode_Processor, -1, numInputs, numOutputs, process, context});
+}
+
+bool graphRemoveNode(GraphEngine *engine, int node)
+{
+    if (!validNode(engine, node)) {
+        return false;
+    }
+    engine->nodes[node].used = false;
+    std::erase_if(engine->wires, [&](const GraphWire &w) { return w.fromNode == node || w.toNode == node; });
+    return true;
+}
+
+static bool sameWire(const GraphWire &a, const GraphWire &b) {
+    return a.fromNode == b.fromNode && a.fromPort == b.fromPort && a.toNode == b.toNode && a.toPort == b.toPort;
+}
+
+bool graphConnect(GraphEngine *engine, const GraphWire &wire)
+{
+    if (!validNode(engine, wire.fromNode) || !validNode(engine, wire.toNode) ||
+        wire.fromPort < 0 || wire.fromPort >= engine->nodes[wire.fromNode].numOutputs ||
+        wire.toPort < 0 || wire.toPort >= engine->nodes[wire.toNode].numInputs) {
+        return false;
+    }
+    for (auto &w : engine->wires) {
+        if (sameWire(w, wire)) {
+            return true;
+        }
+    }
+    engine->wires.push_back(wire); // (cycles are caught on commit)
+    return true;
+}
+
+bool graphDisconnect(GraphEngine *engine, const GraphWire &wire)
+{
+    return std::erase_if(engine->wires, [&](const GraphWire &w) { return sameWire(w, wire); }) > 0;
+}
+
+//============ compiling =====================================================
+
+bool graphCommit(GraphEngine *engine)
+{
+    // live nodes, in id order for now
+    std::vector<int> ids;
+    std::vector<int> indexOf(engine->nodes.size(), -1);
+    for (size_t i = 0; i < engine->nodes.size(); i++) {
+        if (engine->nodes[i].used) {
+            indexOf[i] = (int)ids.size();
+            ids.push_back((int)i);
+        }
+    }
+    auto n = (int)ids.size();
+
+    std::vector<std::vector<int>> successors(n), predecessors(n);
+    for (auto &w : engine->wires) {
+        auto from = indexOf[w.fromNode], to = indexOf[w.toNode];
+        if (std::find(successors[from].begin(), successors[from].end(), to) == successors[from].end()) {
+            successors[from].push_back(to);
+            predecessors[to].push_back(from);
+        }
+    }
+
+    // Kahn's algorithm
+    std::vector<int> order, waiting(n);
+    for (int i = 0; i < n; i++) {
+        waiting[i] = (int)predecessors[i].size();
+        if (waiting[i] == 0) {
+            order.push_back(i);
+        }
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+        for (auto s : successors[order[i]]) {
+            if (--waiting[s] == 0) {
+                order.push_back(s);
+            }
+        }
+    }
+    if ((int)order.size() != n) {
+        return false;
+    }
+
+    // everything that's guaranteed to have finished before a node starts
+    std::vector<NodeSet> ancestors(n);
+    for (auto v : order) {
+        for (auto p : predecessors[v]) {
+            ancestors[v] |= ancestors[p];
+            ancestors[v].set(p);
+        }
+    }
+
+    // buffer assignment, in topological order. users = the nodes touching the buffer's current value
+    std::vector<NodeSet> users;
+    auto allocate = [&](int v, const NodeSet &newUsers) {
+        for (size_t b = 0; b < users.size(); b++) {
+            if ((users[b] & ~ancestors[v]).none()) {
+                users[b] = newUsers;
+                return (int)b;
+            }
+        }
+        users.push_back(newUsers);
+        return (int)users.size() - 1;
+    };
+    const int silence = -1;
+    std::vector<std::vector<int>> outputBuffers(n), inputBuffers(n);
+    struct SumIndex { int dest, source; bool first; };
+    std::vector<std::vector<SumIndex>> sums(n);
+    for (auto v : order) {
+        auto &node = engine->nodes[ids[v]];
+        // (a node's inputs were all assigned by its predecessors, which come first)
+        inputBuffers[v].assign(node.numInputs, silence);
+        for (int port = 0; port < node.numInputs; port++) {
+            std::vector<int> sources;
+            for (auto &w : engine->wires) {
+                if (w.toNode == ids[v] && w.toPort == port) {
+                    sources.push_back(outputBuffers[indexOf[w.fromNode]][w.fromPort]);
+                }
+            }
+            if (sources.size() == 1) {
+                inputBuffers[v][port] = sources[0];
+            }
+            else if (sources.size() > 1) {
+                NodeSet self;
+                self.set(v);
+                auto dest = allocate(v, self);
+                for (size_t i = 0; i < sources.size(); i++) {
+                    sums[v].push_back({dest, sources[i], i == 0});
+                }
+                inputBuffers[v][port] = dest;
+            }
+        }
+        outputBuffers[v].assign(node.numOutputs, silence);
+        for (int port = 0; port < node.numOutputs; port++) {
+            NodeSet valueUsers;
+            valueUsers.set(v);
+            for (auto &w : engine->wires) {
+                if (w.fromNode == ids[v] && w.fromPort == port) {
+                    valueUsers.set(indexOf[w.toNode]);
+                }
+            }
+            outputBuffers[v][port] = allocate(v, valueUsers);
+        }
+    }
+
+    auto graph = new CompiledGraph();
+    graph->numBuffers = (int)users.size();
+    graph->arena.reset(new float[(size_t)(graph->numBuffers + 1) * engine->bufferSamples]());
+    auto buffer = [&](int b) {
+        return graph->arena.get() + (size_t)(b == silence ? graph->numBuffers : b) * engine->bufferSamples;
+    };
+    std::vector<int> position(n);
+    for (int i = 0; i < n; i++) {
+        position[order[i]] = i;
+    }
+    for (auto v : order) {
+        auto &desc = engine->nodes[ids[v]];
+        CompiledNode node = {};
+        node.type = desc.type;
+        node.channel = desc.channel;
+        node.numInputs = desc.numInputs;
+        node.numOutputs = desc.numOutputs;
+        node.process = desc.process;
+        node.context = desc.context;
+        for (int port = 0; port < desc.numInputs; port++) {
+            node.inputs[port] = buffer(inputBuffers[v][port]);
+        }
+        for (int port = 0; port < desc.numOutputs; port++) {
+            node.outputs[port] = buffer(outputBuffers[v][port]);
+        }
+        node.firstSum = (int)graph->sums.size();
+        node.numSums = (int)sums[v].size();
+        for (auto &sum : sums[v]) {
+            graph->sums.push_back({buffer(sum.dest), buffer(sum.source), sum.first});
+        }
+        node.firstSuccessor = (int)graph->successors.size();
+        node.numSuccessors = (int)successors[v].size();
+        for (auto s : successors[v]) {
+            graph->successors.push_back(position[s]);
+        }
+        node.numPredecessors = (int)predecessors[v].size();
+        if (node.numPredecessors == 0) {
+            graph->roots.push_back((int)graph->nodes.size());
+        }
+        graph->nodes.push_back(node);
+    }
+    graph->pending.reset(new std::atomic<int>[n]);
+
+    delete engine->compiled.replace(graph);
+    return true;
+}
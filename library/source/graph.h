@@ -0,0 +1,122 @@
+#pragma once
+
+#include "CASIOClient.h"
+#include "util/lockfree.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// processing graph (CASIO_Graph...).
+//
+// the control thread edits a plain description (nodes and wires) and CASIO_GraphCommit compiles it:
+// topological order, per-node predecessor counts and successor lists, and buffer assignment out of one arena.
+// a buffer is handed to a new value only when every node that wrote or read its previous value is an ancestor
+// of the new writer, so the reuse holds however the nodes end up spread over threads.
+// the compiled graph is swapped in whole; the audio thread picks up whatever is current at the start of a buffer.
+//
+// per buffer, the audio thread resets the counters, queues the nodes without predecessors and wakes the workers,
+// then works along with them. whoever finishes a node decrements its successors' counters and queues the ones
+// that hit zero. nothing in there locks or allocates.
+//
+// the workers do the audio thread's work, so they ask for its kind of priority: MMCSS "Pro Audio" on windows (time
+// critical if that's not available), SCHED_FIFO elsewhere. only with a core for every thread though: they spin while
+// waiting on each other, and a realtime spinner would starve the thread it waits on. where it's not permitted either
+// (no rtprio limit on linux, say) they stay at normal priority, and a loaded system can make them miss the deadline.
+
+#define GRAPH_MAX_NODES 256 // power of 2 (ready queue)
+#define GRAPH_MAX_PORTS 16
+#define GRAPH_MAX_THREADS 16
+#define GRAPH_WORKER_PRIORITY 70 // SCHED_FIFO, where the system allows that much
+
+enum GraphNodeType {
+    GraphNode_Source, // device input -> float
+    GraphNode_Sink, // float -> device output
+    GraphNode_Processor,
+};
+
+struct GraphNode {
+    bool used;
+    GraphNodeType type;
+    int channel; // sources and sinks
+    int numInputs, numOutputs;
+    CASIO_NodeProcessFunc process;
+    void *context;
+};
+
+struct GraphWire {
+    int fromNode, fromPort, toNode, toPort;
+};
+
+// summing of multi-wire inputs, done by the consuming node before it runs
+struct GraphSum {
+    float *dest;
+    const float *source;
+    bool first; // copy rather than add
+};
+
+struct CompiledNode {
+    GraphNodeType type;
+    int channel;
+    int numInputs, numOutputs;
+    CASIO_NodeProcessFunc process;
+    void *context;
+    const float *inputs[GRAPH_MAX_PORTS];
+    float *outputs[GRAPH_MAX_PORTS];
+    int firstSum, numSums;
+    int firstSuccessor, numSuccessors;
+    int numPredecessors;
+};
+
+struct CompiledGraph {
+    std::vector<CompiledNode> nodes; // in topological order
+    std::vector<GraphSum> sums;
+    std::vector<int> successors;
+    std::vector<int> roots;
+    std::unique_ptr<float[]> arena; // numBuffers + 1 (silence, for unconnected inputs) buffers
+    int numBuffers;
+
+    std::unique_ptr<std::atomic<int>[]> pending; // predecessors still running, per node
+    std::atomic<int> remaining; // nodes still to run this buffer
+};
+
+struct GraphEngine {
+    CASIO_SampleFormat format;
+    int bufferSamples;
+    int numInputs, numOutputs;
+
+    // control thread
+    std::vector<GraphNode> nodes; // index = node id, removed ones are reused
+    std::vector<GraphWire> wires;
+
+    Detachable<CompiledGraph> compiled;
+
+    // set per buffer by the audio thread
+    CompiledGraph *running = nullptr;
+    void **deviceInputs, **deviceOutputs;
+
+    BoundedQueue<int, GRAPH_MAX_NODES> ready;
+    std::atomic<CompiledGraph *> workerGraph = nullptr; // non-null while workers may take nodes
+    std::atomic<int> busyWorkers = 0;
+    std::atomic<uint32_t> epoch = 0; // bumped to wake the workers
+    std::atomic<bool> quit = false;
+    std::vector<std::thread> workers;
+    std::atomic<int> startedWorkers = 0, realtimeWorkers = 0; // (graphCreate waits for all of them to report)
+};
+
+GraphEngine *graphCreate(CASIO_SampleFormat format, int bufferSamples, int numInputs, int numOutputs, int numThreads);
+void graphDestroy(GraphEngine *engine); // (detached from the device first)
+
+// control thread. node ids or -1
+int graphAddSource(GraphEngine *engine, int deviceInput);
+int graphAddSink(GraphEngine *engine, int deviceOutput);
+int graphAddProcessor(GraphEngine *engine, int numInputs, int numOutputs, CASIO_NodeProcessFunc process, void *context);
+bool graphRemoveNode(GraphEngine *engine, int node);
+bool graphConnect(GraphEngine *engine, const GraphWire &wire);
+bool graphDisconnect(GraphEngine *engine, const GraphWire &wire);
+bool graphCommit(GraphEngine *engine); // false if the graph has a cycle
+
+// audio thread, after the client callback
+void graphProcess(GraphEngine *engine, void **inputs, void **outputs);
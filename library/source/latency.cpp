@@ -0,0 +1,188 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <vector>
+
+#define LATENCY_MAX_SECONDS 1.0 // longest round trip we look for
+#define LATENCY_START_BUFFERS 2 // buffers of silence before the stimulus
+#define LATENCY_MLS_ORDER 15 // 32767 samples, ~0.7s at 48kHz
+#define LATENCY_MLS_LEVEL 0.25f
+#define LATENCY_IMPULSE_LEVEL 0.9f
+#define LATENCY_PEAK_WINDOW 64 // around the peak, excluded when looking for the runner-up
+
+static const double pi = 3.14159265358979323846;
+
+//============ setup =========================================================
+
+LatencyProbe *latencyProbeCreate(CASIO_LatencyStimulus stimulus, int outputChannel, int inputChannel,
+                                 double sampleRate, int bufferSamples)
+{
+    auto probe = new LatencyProbe();
+    probe->outputChannel = outputChannel;
+    probe->inputChannel = inputChannel;
+
+    if (stimulus == CASIO_Stimulus_MLS) {
+        // x^15 + x^14 + 1, a maximal length LFSR
+        probe->stimulusLength = (1 << LATENCY_MLS_ORDER) - 1;
+        probe->stimulus = new float[probe->stimulusLength];
+        uint32_t state = 1;
+        for (int i = 0; i < probe->stimulusLength; i++) {
+            auto bit = ((state >> 14) ^ (state >> 13)) & 1;
+            state = ((state << 1) | bit) & ((1 << LATENCY_MLS_ORDER) - 1);
+            probe->stimulus[i] = bit ? LATENCY_MLS_LEVEL : -LATENCY_MLS_LEVEL;
+        }
+    }
+    else {
+        probe->stimulusLength = 1;
+        probe->stimulus = new float[1];
+        probe->stimulus[0] = LATENCY_IMPULSE_LEVEL;
+    }
+
+    probe->startFrame = LATENCY_START_BUFFERS * bufferSamples;
+    probe->captureLength = probe->startFrame + probe->stimulusLength + (int)(LATENCY_MAX_SECONDS * sampleRate);
+    probe->capture = new float[probe->captureLength]();
+    return probe;
+}
+
+void latencyProbeDestroy(LatencyProbe *probe)
+{
+    delete[] probe->stimulus;
+    delete[] probe->capture;
+    delete probe;
+}
+
+//============ audio thread ==================================================
+
+void latencyProbeProcess(LatencyProbe *probe, CASIO_SampleFormat format, int bufferSamples, void **inputs, void **outputs)
+{
+    if (probe->done.load(std::memory_order_relaxed)) {
+        return; // (outputs are the client's again)
+    }
+    auto in = inputs[probe->inputChannel];
+    auto out = outputs[probe->outputChannel];
+    for (int i = 0; i < bufferSamples; i++) {
+        auto frame = probe->frame + i;
+        auto stimulusIndex = frame - probe->startFrame;
+        auto v = stimulusIndex >= 0 && stimulusIndex < probe->stimulusLength ? probe->stimulus[stimulusIndex] : 0.0f;
+        float captured = 0;
+        switch (format) {
+        case CASIO_SampleFormat_Int32:
+            ((int32_t *)out)[i] = (int32_t)((double)v * 2147483647.0);
+            captured = (float)(((int32_t *)in)[i] * (1.0 / 2147483648.0));
+            break;
+        case CASIO_SampleFormat_Float32:
+            ((float *)out)[i] = v;
+            captured = ((float *)in)[i];
+            break;
+        case CASIO_SampleFormat_Float64:
+            ((double *)out)[i] = v;
+            captured = (float)((double *)in)[i];
+            break;
+        default:
+            break;
+        }
+        if (frame < probe->captureLength) {
+            probe->capture[frame] = captured;
+        }
+    }
+    probe->frame += bufferSamples;
+    if (probe->frame >= probe->captureLength) {
+        probe->done.store(true, std::memory_order_release);
+    }
+}
+
+//============ analysis ======================================================
+
+// in-place iterative radix-2, n a power of 2
+static void fft(std::complex<double> *x, size_t n, bool inverse)
+{
+    for (size_t i = 1, j = 0; i < n; i++) {
+        auto bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(x[i], x[j]);
+        }
+    }
+    for (size_t len = 2; len <= n; len <<= 1) {
+        auto angle = 2 * pi / (double)len * (inverse ? 1 : -1);
+        std::complex<double> step(cos(angle), sin(angle));
+        for (size_t i = 0; i < n; i += len) {
+            std::complex<double> w(1);
+            for (size_t k = 0; k < len / 2; k++) {
+                auto a = x[i + k];
+                auto b = x[i + k + len / 2] * w;
+                x[i + k] = a + b;
+                x[i + k + len / 2] = a - b;
+                w *= step;
+            }
+        }
+    }
+    if (inverse) {
+        for (size_t i = 0; i < n; i++) {
+            x[i] /= (double)n;
+        }
+    }
+}
+
+bool latencyAnalyze(const LatencyProbe *probe, double *lagSamples, float *peakRatio)
+{
+    size_t n = 1;
+    while (n < (size_t)(probe->captureLength + probe->stimulusLength)) {
+        n <<= 1;
+    }
+    std::vector<std::complex<double>> captured(n), stimulus(n);
+    for (int i = 0; i < probe->captureLength; i++) {
+        captured[i] = probe->capture[i];
+    }
+    for (int i = 0; i < probe->stimulusLength; i++) {
+        stimulus[i] = probe->stimulus[i];
+    }
+    fft(captured.data(), n, false);
+    fft(stimulus.data(), n, false);
+    for (size_t i = 0; i < n; i++) {
+        captured[i] *= std::conj(stimulus[i]);
+    }
+    fft(captured.data(), n, true); // captured[lag] is now the (linear, zero padding takes care of that) cross-correlation
+
+    // only lags at which the whole stimulus made it into the capture
+    auto searchEnd = probe->captureLength - probe->stimulusLength + 1;
+    int peak = probe->startFrame;
+    double peakValue = 0;
+    for (int lag = probe->startFrame; lag < searchEnd; lag++) {
+        auto v = std::fabs(captured[lag].real()); // (a polarity-inverting loopback still counts)
+        if (v > peakValue) {
+            peakValue = v;
+            peak = lag;
+        }
+    }
+    double runnerUp = 0;
+    for (int lag = probe->startFrame; lag < searchEnd; lag++) {
+        if (std::abs(lag - peak) > LATENCY_PEAK_WINDOW) {
+            runnerUp = std::max(runnerUp, std::fabs(captured[lag].real()));
+        }
+    }
+    if (peakValue <= 0) {
+        return false;
+    }
+    *peakRatio = runnerUp > 0 ? (float)(peakValue / runnerUp) : INFINITY;
+
+    // parabolic interpolation for the sub-sample part
+    double offset = 0;
+    if (peak > probe->startFrame && peak + 1 < searchEnd) {
+        auto a = std::fabs(captured[peak - 1].real());
+        auto b = peakValue;
+        auto c = std::fabs(captured[peak + 1].real());
+        auto denominator = a - 2 * b + c;
+        if (denominator != 0) {
+            offset = 0.5 * (a - c) / denominator;
+        }
+    }
+    *lagSamples = peak - probe->startFrame + offset;
+    return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "CASIOClient.h"
+
+#include <atomic>
+#include <cstdint>
+
+// loopback latency measurement.
+//
+// the audio thread plays a stimulus into one output (starting a couple of buffers in, once things have settled)
+// and records one input into a preallocated buffer, both counted on the same frame timeline.
+// the caller then cross-correlates the recording with the stimulus (by FFT, on its own thread)
+// and the lag of the correlation peak is the round trip, in the same frames the driver reports latencies in.
+
+struct LatencyProbe {
+    int outputChannel, inputChannel;
+    float *stimulus;
+    int stimulusLength;
+    int startFrame; // where the stimulus starts on the output
+    float *capture;
+    int captureLength;
+
+    int64_t frame = 0; // audio-thread only
+    std::atomic<bool> done = false;
+};
+
+LatencyProbe *latencyProbeCreate(CASIO_LatencyStimulus stimulus, int outputChannel, int inputChannel,
+                                 double sampleRate, int bufferSamples);
+void latencyProbeDestroy(LatencyProbe *probe);
+
+// audio thread, after everything else has written the outputs
+void latencyProbeProcess(LatencyProbe *probe, CASIO_SampleFormat format, int bufferSamples, void **inputs, void **outputs);
+
+// once done: false if there was no usable peak
+bool latencyAnalyze(const LatencyProbe *probe, double *lagSamples, float *peakRatio);
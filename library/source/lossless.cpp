@@ -0,0 +1,827 @@
+#include "lossless.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+#define LOSSLESS_LPC_ORDER 8
+#define LOSSLESS_LPC_PRECISION 14 // bits per quantized coefficient
+#define LOSSLESS_MAX_FIXED_ORDER 4
+#define LOSSLESS_PARTITION 256 // residuals per Rice parameter
+#define LOSSLESS_RICE_BITS 6
+#define LOSSLESS_MAX_RICE 58
+#define LOSSLESS_POLL_MS 2
+
+static uint64_t losslessNow() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//============ bit streams ===================================================
+
+struct BitWriter {
+    uint8_t *data;
+    size_t capacity, pos = 0;
+    uint64_t acc = 0;
+    int bits = 0;
+    bool overflow = false;
+
+    void put(uint64_t value, int n) { // n <= 32
+        acc = (acc << n) | (value & ((1ULL << n) - 1));
+        bits += n;
+        while (bits >= 8) {
+            bits -= 8;
+            if (pos < capacity) {
+                data[pos++] = (uint8_t)(acc >> bits);
+            }
+            else {
+                overflow = true;
+            }
+        }
+    }
+    void putWide(uint64_t value, int n) { // n <= 64
+        if (n > 32) {
+            put(value >> 32, n - 32);
+            n = 32;
+        }
+        put(value, n);
+    }
+    void unary(uint64_t q) { // q zeros, then a one
+        for (; q >= 32; q -= 32) {
+            put(0, 32);
+        }
+        put(1, (int)q + 1);
+    }
+    void flush() {
+        if (bits > 0) {
+            put(0, 8 - bits);
+        }
+    }
+};
+
+struct BitReader {
+    const uint8_t *data;
+    size_t length, pos = 0;
+    uint64_t acc = 0;
+    int bits = 0;
+
+    uint64_t get(int n) { // n <= 32, reads zeros past the end
+        while (bits < n) {
+            acc = (acc << 8) | (pos < length ? data[pos] : 0);
+            pos++;
+            bits += 8;
+        }
+        bits -= n;
+        return (acc >> bits) & ((1ULL << n) - 1);
+    }
+    uint64_t getWide(int n) {
+        uint64_t high = 0;
+        if (n > 32) {
+            high = get(n - 32) << 32;
+            n = 32;
+        }
+        return high | get(n);
+    }
+    uint64_t unary() {
+        uint64_t q = 0;
+        while (get(1) == 0 && pos <= length) {
+            q++;
+        }
+        return q;
+    }
+};
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t u) {
+    return (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+}
+
+//============ encoding ======================================================
+
+struct EncoderScratch {
+    int32_t x[LOSSLESS_BLOCK_FRAMES];
+    int64_t residual[2][LOSSLESS_BLOCK_FRAMES];
+    double windowed[LOSSLESS_BLOCK_FRAMES];
+};
+
+// false if the block can't be represented exactly
+static bool toIntegers(CASIO_SampleFormat format, const uint8_t *raw, int frames, int32_t *out) {
+    auto fromScaled = [](double scaled, bool negative, int32_t *result) {
+        if (!(scaled >= -2147483648.0 && scaled <= 2147483647.0) || scaled != std::floor(scaled) || (scaled == 0 && negative)) {
+            return false; // (NaN, out of range, finer than 2^-31 or -0)
+        }
+        *result = (int32_t)scaled;
+        return true;
+    };
+    switch (format) {
+    case CASIO_SampleFormat_Int32:
+        memcpy(out, raw, frames * sizeof(int32_t));
+        return true;
+    case CASIO_SampleFormat_Float32:
+        for (int i = 0; i < frames; i++) {
+            auto v = ((const float *)raw)[i];
+            if (!fromScaled((double)v * 2147483648.0, std::signbit(v), &out[i])) {
+                return false;
+            }
+        }
+        return true;
+    case CASIO_SampleFormat_Float64:
+        for (int i = 0; i < frames; i++) {
+            auto v = ((const double *)raw)[i];
+            if (!fromScaled(v * 2147483648.0, std::signbit(v), &out[i])) {
+                return false;
+            }
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+static int riceParameter(uint64_t sum, int n) {
+    int k = 0;
+    while (k < LOSSLESS_MAX_RICE && ((uint64_t)n << (k + 1)) <= sum) {
+        k++;
+    }
+    return k;
+}
+
+static uint64_t riceBits(const int64_t *residual, int count) {
+    uint64_t bits = 0;
+    for (int start = 0; start < count; start += LOSSLESS_PARTITION) {
+        auto n = std::min(LOSSLESS_PARTITION, count - start);
+        uint64_t sum = 0;
+        for (int i = 0; i < n; i++) {
+            sum += zigzag(residual[start + i]);
+        }
+        auto k = riceParameter(sum, n);
+        bits += LOSSLESS_RICE_BITS + (uint64_t)n * (k + 1);
+        for (int i = 0; i < n; i++) {
+            bits += zigzag(residual[start + i]) >> k;
+        }
+    }
+    return bits;
+}
+
+static void writeRice(BitWriter &out, const int64_t *residual, int count) {
+    for (int start = 0; start < count && !out.overflow; start += LOSSLESS_PARTITION) {
+        auto n = std::min(LOSSLESS_PARTITION, count - start);
+        uint64_t sum = 0;
+        for (int i = 0; i < n; i++) {
+            sum += zigzag(residual[start + i]);
+        }
+        auto k = riceParameter(sum, n);
+        out.put(k, LOSSLESS_RICE_BITS);
+        for (int i = 0; i < n; i++) {
+            auto u = zigzag(residual[start + i]);
+            out.unary(u >> k);
+            out.putWide(u, k);
+        }
+    }
+}
+
+// the fixed order whose residual has the smallest absolute sum, all of them in one pass (like FLAC does)
+static int bestFixedOrder(const int32_t *x, int frames) {
+    if (frames <= LOSSLESS_MAX_FIXED_ORDER) {
+        return 0;
+    }
+    uint64_t sums[LOSSLESS_MAX_FIXED_ORDER + 1] = {};
+    int64_t e0Prev = x[3], e1Prev = (int64_t)x[3] - x[2];
+    int64_t e2Prev = e1Prev - ((int64_t)x[2] - x[1]);
+    int64_t e3Prev = e2Prev - (((int64_t)x[2] - x[1]) - ((int64_t)x[1] - x[0]));
+    for (int i = LOSSLESS_MAX_FIXED_ORDER; i < frames; i++) {
+        int64_t e0 = x[i];
+        auto e1 = e0 - e0Prev;
+        auto e2 = e1 - e1Prev;
+        auto e3 = e2 - e2Prev;
+        auto e4 = e3 - e3Prev;
+        sums[0] += (uint64_t)std::llabs(e0);
+        sums[1] += (uint64_t)std::llabs(e1);
+        sums[2] += (uint64_t)std::llabs(e2);
+        sums[3] += (uint64_t)std::llabs(e3);
+        sums[4] += (uint64_t)std::llabs(e4);
+        e0Prev = e0;
+        e1Prev = e1;
+        e2Prev = e2;
+        e3Prev = e3;
+    }
+    return (int)(std::min_element(sums, sums + LOSSLESS_MAX_FIXED_ORDER + 1) - sums);
+}
+
+static void fixedResidual(const int32_t *x, int frames, int order, int64_t *residual) {
+    auto r = residual - order;
+    switch (order) {
+    case 0:
+        for (int i = 0; i < frames; i++) {
+            r[i] = x[i];
+        }
+        break;
+    case 1:
+        for (int i = 1; i < frames; i++) {
+            r[i] = (int64_t)x[i] - x[i - 1];
+        }
+        break;
+    case 2:
+        for (int i = 2; i < frames; i++) {
+            r[i] = (int64_t)x[i] - 2 * (int64_t)x[i - 1] + x[i - 2];
+        }
+        break;
+    case 3:
+        for (int i = 3; i < frames; i++) {
+            r[i] = (int64_t)x[i] - 3 * (int64_t)x[i - 1] + 3 * (int64_t)x[i - 2] - x[i - 3];
+        }
+        break;
+    default:
+        for (int i = 4; i < frames; i++) {
+            r[i] = (int64_t)x[i] - 4 * (int64_t)x[i - 1] + 6 * (int64_t)x[i - 2] - 4 * (int64_t)x[i - 3] + x[i - 4];
+        }
+        break;
+    }
+}
+
+static void lpcResidual(const int32_t *x, int frames, const int32_t *coeffs, int order, int shift, int64_t *residual) {
+    for (int i = order; i < frames; i++) {
+        int64_t prediction = 0;
+        for (int j = 0; j < order; j++) {
+            prediction += (int64_t)coeffs[j] * x[i - 1 - j];
+        }
+        residual[i - order] = x[i] - (prediction >> shift);
+    }
+}
+
+// Welch-windowed autocorrelation, Levinson-Durbin, quantized with error feedback. false if there's nothing to fit
+static bool lpcCoefficients(const int32_t *x, int frames, double *windowed, int32_t *coeffs, int *shift) {
+    auto center = (frames - 1) / 2.0;
+    for (int i = 0; i < frames; i++) {
+        auto t = (i - center) / (center + 1);
+        windowed[i] = x[i] * (1 - t * t);
+    }
+    // (all lags per sample: independent sums, rather than one long dependency chain per lag)
+    double autocorrelation[LOSSLESS_LPC_ORDER + 1] = {};
+    for (int i = 0; i < LOSSLESS_LPC_ORDER; i++) {
+        for (int lag = 0; lag <= i; lag++) {
+            autocorrelation[lag] += windowed[i] * windowed[i - lag];
+        }
+    }
+    for (int i = LOSSLESS_LPC_ORDER; i < frames; i++) {
+        for (int lag = 0; lag <= LOSSLESS_LPC_ORDER; lag++) {
+            autocorrelation[lag] += windowed[i] * windowed[i - lag];
+        }
+    }
+    if (autocorrelation[0] <= 0) {
+        return false;
+    }
+
+    double lpc[LOSSLESS_LPC_ORDER] = {}, previous[LOSSLESS_LPC_ORDER];
+    auto error = autocorrelation[0];
+    for (int m = 0; m < LOSSLESS_LPC_ORDER; m++) {
+        auto reflection = autocorrelation[m + 1];
+        for (int j = 0; j < m; j++) {
+            reflection -= lpc[j] * autocorrelation[m - j];
+        }
+        reflection /= error;
+        memcpy(previous, lpc, sizeof(lpc));
+        lpc[m] = reflection;
+        for (int j = 0; j < m; j++) {
+            lpc[j] = previous[j] - reflection * previous[m - 1 - j];
+        }
+        error *= 1 - reflection * reflection;
+        if (error <= 0) {
+            return false;
+        }
+    }
+
+    double largest = 0;
+    for (auto c : lpc) {
+        largest = std::max(largest, std::fabs(c));
+    }
+    if (largest == 0) {
+        return false;
+    }
+    int exponent;
+    frexp(largest, &exponent);
+    *shift = std::clamp(LOSSLESS_LPC_PRECISION - 1 - exponent, 0, 31);
+    auto limit = (1 << (LOSSLESS_LPC_PRECISION - 1)) - 1;
+    double carried = 0;
+    for (int j = 0; j < LOSSLESS_LPC_ORDER; j++) {
+        auto scaled = lpc[j] * (double)(1LL << *shift) + carried;
+        auto q = std::clamp((int)std::lround(scaled), -limit - 1, limit);
+        carried = scaled - q;
+        coeffs[j] = q;
+    }
+    return true;
+}
+
+// returns the payload length
+static uint32_t encodeChannel(const LosslessWriter *w, const uint8_t *raw, int frames, LosslessBlockHeader *header,
+                              uint8_t *out, EncoderScratch *scratch)
+{
+    auto rawLength = (uint32_t)(frames * w->sampleSize);
+    auto verbatim = [&]() {
+        header->method = Lossless_Verbatim;
+        header->shift = 0;
+        header->order = 0;
+        memcpy(out, raw, rawLength);
+        return rawLength;
+    };
+    auto x = scratch->x;
+    if (!toIntegers(w->format, raw, frames, x)) {
+        return verbatim();
+    }
+
+    int32_t bitsUsed = 0;
+    bool constant = true;
+    for (int i = 0; i < frames; i++) {
+        bitsUsed |= x[i];
+        constant &= x[i] == x[0];
+    }
+    if (constant) {
+        header->method = Lossless_Constant;
+        header->shift = 0;
+        header->order = 0;
+        memcpy(out, &x[0], sizeof(int32_t));
+        return sizeof(int32_t);
+    }
+    auto shift = std::countr_zero((uint32_t)bitsUsed);
+    if (shift > 0) {
+        for (int i = 0; i < frames; i++) {
+            x[i] >>= shift;
+        }
+    }
+
+    // pick the predictor with the smallest output
+    auto best = scratch->residual[0], candidate = scratch->residual[1];
+    LosslessMethod method = Lossless_Fixed;
+    int order = bestFixedOrder(x, frames);
+    fixedResidual(x, frames, order, best);
+    auto bestBits = 32ULL * order + riceBits(best, frames - order);
+    int32_t coeffs[LOSSLESS_LPC_ORDER];
+    int lpcShift = 0;
+    // (if not even a first difference helps, the block is noise-like and LPC won't find anything either)
+    if (order > 0 && frames > 2 * LOSSLESS_LPC_ORDER && lpcCoefficients(x, frames, scratch->windowed, coeffs, &lpcShift)) {
+        lpcResidual(x, frames, coeffs, LOSSLESS_LPC_ORDER, lpcShift, candidate);
+        auto bits = 4 + 5 + (uint64_t)LOSSLESS_LPC_ORDER * (LOSSLESS_LPC_PRECISION + 32) +
+            riceBits(candidate, frames - LOSSLESS_LPC_ORDER);
+        if (bits < bestBits) {
+            bestBits = bits;
+            method = Lossless_Lpc;
+            order = LOSSLESS_LPC_ORDER;
+            std::swap(best, candidate);
+        }
+    }
+    if (bestBits / 8 >= rawLength) {
+        return verbatim();
+    }
+
+    BitWriter bits{out, w->encodedCapacity};
+    if (method == Lossless_Lpc) {
+        bits.put(LOSSLESS_LPC_PRECISION - 1, 4);
+        bits.put(lpcShift, 5);
+        for (int j = 0; j < order; j++) {
+            bits.put((uint32_t)coeffs[j], LOSSLESS_LPC_PRECISION);
+        }
+    }
+    for (int i = 0; i < order; i++) {
+        bits.put((uint32_t)x[i], 32);
+    }
+    writeRice(bits, best, frames - order);
+    bits.flush();
+    if (bits.overflow || bits.pos >= rawLength) {
+        return verbatim();
+    }
+    header->method = method;
+    header->shift = (uint8_t)shift;
+    header->order = (uint8_t)order;
+    return (uint32_t)bits.pos;
+}
+
+static void encoderThreadProc(LosslessWriter *w)
+{
+    auto scratch = std::make_unique<EncoderScratch>();
+    while (true) {
+        auto seen = w->jobsPosted.load();
+        auto stopping = !w->running.load(); // (everything was queued before running went false)
+        uint32_t job;
+        while (w->jobs.pop(job)) {
+            auto start = losslessNow();
+            auto &slot = w->slots[job / LOSSLESS_MAX_CHANNELS];
+            auto channel = job % LOSSLESS_MAX_CHANNELS;
+            auto header = &slot.headers[channel];
+            *header = {};
+            header->frame = slot.startFrame;
+            header->frames = (uint16_t)slot.frames;
+            header->channel = (uint8_t)channel;
+            header->length = encodeChannel(w, slot.raw + (size_t)channel * LOSSLESS_BLOCK_FRAMES * w->sampleSize,
+                slot.frames, header, slot.encoded[channel], scratch.get());
+            w->encodeNs.fetch_add(losslessNow() - start, std::memory_order_relaxed);
+            slot.remaining.fetch_sub(1, std::memory_order_acq_rel);
+        }
+        if (stopping) {
+            return;
+        }
+        w->jobsPosted.wait(seen);
+    }
+}
+
+// writes finished slots out in order
+static void writerThreadProc(LosslessWriter *w)
+{
+    int next = 0;
+    while (true) {
+        auto &slot = w->slots[next];
+        if (slot.full.load(std::memory_order_acquire)) {
+            if (slot.remaining.load(std::memory_order_acquire) != 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(LOSSLESS_POLL_MS));
+                continue;
+            }
+            uint64_t encoded = 0;
+            for (int ch = 0; ch < w->numChannels; ch++) {
+                auto &header = slot.headers[ch];
+                if (fwrite(&header, sizeof(LosslessBlockHeader), 1, w->file) != 1 ||
+                    fwrite(slot.encoded[ch], header.length, 1, w->file) != 1) {
+                    w->writeErrors.fetch_add(1, std::memory_order_relaxed); // (disk full, say. keep going, it may clear)
+                }
+                encoded += sizeof(LosslessBlockHeader) + header.length;
+            }
+            w->framesWritten.fetch_add(slot.frames, std::memory_order_relaxed);
+            w->rawBytes.fetch_add((uint64_t)slot.frames * w->sampleSize * w->numChannels, std::memory_order_relaxed);
+            w->encodedBytes.fetch_add(encoded, std::memory_order_relaxed);
+            slot.full.store(false, std::memory_order_release);
+            next = (next + 1) % LOSSLESS_SLOTS;
+            continue;
+        }
+        if (!w->running.load()) {
+            // close may have submitted the last slot right before stopping us: look again now that running is
+            // known to be false. (slots are handed over in order, so nothing's left behind this one)
+            if (slot.full.load(std::memory_order_acquire)) {
+                continue;
+            }
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(LOSSLESS_POLL_MS));
+    }
+}
+
+//============ audio thread ==================================================
+
+static void submitSlot(LosslessWriter *w, int index) {
+    auto &slot = w->slots[index];
+    slot.remaining.store(w->numChannels, std::memory_order_relaxed);
+    slot.full.store(true, std::memory_order_release);
+    for (int ch = 0; ch < w->numChannels; ch++) {
+        w->jobs.push((uint32_t)(index * LOSSLESS_MAX_CHANNELS + ch)); // (sized for every channel of every slot)
+    }
+    w->jobsPosted.fetch_add(1);
+    w->jobsPosted.notify_all();
+    w->nextSlot = (index + 1) % LOSSLESS_SLOTS;
+    w->fillSlot = -1;
+}
+
+void losslessWrite(LosslessWriter *w, void **inputs, int frames)
+{
+    auto sampleSize = w->sampleSize;
+    for (int done = 0; done < frames; ) {
+        if (w->fillSlot < 0) {
+            auto &next = w->slots[w->nextSlot];
+            if (next.full.load(std::memory_order_acquire)) {
+                // encoders are behind, skip the rest of this buffer
+                w->droppedFrames.fetch_add(frames - done, std::memory_order_relaxed);
+                w->frame += frames - done;
+                return;
+            }
+            w->fillSlot = w->nextSlot;
+            next.frames = 0;
+            next.startFrame = w->frame;
+        }
+        auto &slot = w->slots[w->fillSlot];
+        auto n = std::min(frames - done, LOSSLESS_BLOCK_FRAMES - slot.frames);
+        for (int ch = 0; ch < w->numChannels; ch++) {
+            memcpy(slot.raw + ((size_t)ch * LOSSLESS_BLOCK_FRAMES + slot.frames) * sampleSize,
+                (const uint8_t *)inputs[ch] + (size_t)done * sampleSize, (size_t)n * sampleSize);
+        }
+        slot.frames += n;
+        done += n;
+        w->frame += n;
+        if (slot.frames == LOSSLESS_BLOCK_FRAMES) {
+            submitSlot(w, w->fillSlot);
+        }
+    }
+}
+
+//============ setup =========================================================
+
+LosslessWriter *losslessWriterOpen(const char *path, CASIO_SampleFormat format, int sampleSize, int numChannels,
+                                   double sampleRate, int numThreads)
+{
+    if (numChannels < 1 || numChannels > LOSSLESS_MAX_CHANNELS) {
+        return nullptr;
+    }
+    auto file = fopen(path, "wb");
+    if (!file) {
+        return nullptr;
+    }
+    LosslessProperties props = {};
+    props.numChannels = numChannels;
+    props.sampleFormat = format;
+    props.sampleRate = sampleRate;
+    props.blockFrames = LOSSLESS_BLOCK_FRAMES;
+    uint32_t version = LOSSLESS_VERSION;
+    if (fwrite(LOSSLESS_MAGIC, 8, 1, file) != 1 || fwrite(&version, sizeof(version), 1, file) != 1 ||
+        fwrite(&props, sizeof(props), 1, file) != 1) {
+        fclose(file);
+        return nullptr;
+    }
+
+    auto w = new LosslessWriter();
+    w->file = file;
+    w->format = format;
+    w->sampleSize = sampleSize;
+    w->numChannels = numChannels;
+    w->sampleRate = sampleRate;
+    w->encodedCapacity = (size_t)LOSSLESS_BLOCK_FRAMES * sampleSize; // (anything bigger goes verbatim)
+    for (auto &slot : w->slots) {
+        slot.raw = new uint8_t[(size_t)numChannels * LOSSLESS_BLOCK_FRAMES * sampleSize];
+        slot.frames = 0;
+        slot.startFrame = 0;
+        slot.remaining = 0;
+        slot.full = false;
+        slot.headers = new LosslessBlockHeader[numChannels];
+        slot.encoded = new uint8_t *[numChannels];
+        for (int ch = 0; ch < numChannels; ch++) {
+            slot.encoded[ch] = new uint8_t[w->encodedCapacity];
+        }
+    }
+    w->fillSlot = -1;
+    w->nextSlot = 0;
+    w->frame = 0;
+    w->framesWritten = 0;
+    w->rawBytes = 0;
+    w->encodedBytes = 0;
+    w->droppedFrames = 0;
+    w->writeErrors = 0;
+    w->encodeNs = 0;
+    w->running = true;
+
+    if (numThreads <= 0) {
+        numThreads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    }
+    numThreads = std::min(numThreads, LOSSLESS_MAX_THREADS);
+    for (int i = 0; i < numThreads; i++) {
+        w->encoders.emplace_back(encoderThreadProc, w);
+    }
+    w->writer = std::thread(writerThreadProc, w);
+    return w;
+}
+
+void losslessWriterClose(LosslessWriter *w, CASIO_CaptureStats *stats)
+{
+    // (detached from the device by now, so the partly filled slot is ours)
+    if (w->fillSlot >= 0 && w->slots[w->fillSlot].frames > 0) {
+        submitSlot(w, w->fillSlot);
+    }
+    w->running = false;
+    w->jobsPosted.fetch_add(1);
+    w->jobsPosted.notify_all();
+    for (auto &encoder : w->encoders) {
+        encoder.join();
+    }
+    w->writer.join();
+    if (fclose(w->file) != 0) {
+        w->writeErrors.fetch_add(1, std::memory_order_relaxed); // (the last buffered blocks didn't make it)
+    }
+    losslessGetStats(w, stats);
+
+    for (auto &slot : w->slots) {
+        delete[] slot.raw;
+        for (int ch = 0; ch < w->numChannels; ch++) {
+            delete[] slot.encoded[ch];
+        }
+        delete[] slot.encoded;
+        delete[] slot.headers;
+    }
+    delete w;
+}
+
+void losslessGetStats(const LosslessWriter *w, CASIO_CaptureStats *stats)
+{
+    stats->frames = w->framesWritten.load(std::memory_order_relaxed);
+    stats->rawBytes = w->rawBytes.load(std::memory_order_relaxed);
+    stats->encodedBytes = w->encodedBytes.load(std::memory_order_relaxed);
+    stats->compressionRatio = stats->encodedBytes > 0 ? (double)stats->rawBytes / (double)stats->encodedBytes : 0;
+    auto encodeSeconds = w->encodeNs.load(std::memory_order_relaxed) / 1e9;
+    stats->realtimeFactor = encodeSeconds > 0 ? stats->frames / w->sampleRate / encodeSeconds : 0;
+    stats->droppedFrames = w->droppedFrames.load(std::memory_order_relaxed);
+    stats->writeErrors = w->writeErrors.load(std::memory_order_relaxed);
+}
+
+//============ decoding ======================================================
+
+static bool decodeChannel(const LosslessProperties &props, int sampleSize, const LosslessBlockHeader &header,
+                          const uint8_t *payload, uint8_t *out, int32_t *x, int64_t *residual)
+{
+    auto frames = (int)header.frames;
+    if (header.method == Lossless_Verbatim) {
+        if (header.length != (uint32_t)(frames * sampleSize)) {
+            return false;
+        }
+        memcpy(out, payload, header.length);
+        return true;
+    }
+    if (header.method == Lossless_Constant) {
+        if (header.length != sizeof(int32_t)) {
+            return false;
+        }
+        int32_t v;
+        memcpy(&v, payload, sizeof(v));
+        std::fill(x, x + frames, v);
+    }
+    else {
+        int order = header.order;
+        if (order >= frames || (header.method == Lossless_Fixed && order > LOSSLESS_MAX_FIXED_ORDER) ||
+            (header.method == Lossless_Lpc && order > LOSSLESS_LPC_ORDER) || header.method > Lossless_Lpc) {
+            return false;
+        }
+        BitReader bits{payload, header.length};
+        int32_t coeffs[LOSSLESS_LPC_ORDER];
+        int precision = 0, lpcShift = 0;
+        if (header.method == Lossless_Lpc) {
+            precision = (int)bits.get(4) + 1;
+            lpcShift = (int)bits.get(5);
+            for (int j = 0; j < order; j++) {
+                auto v = bits.get(precision);
+                coeffs[j] = (int32_t)(v << (32 - precision)) >> (32 - precision); // sign extend
+            }
+        }
+        for (int i = 0; i < order; i++) {
+            x[i] = (int32_t)bits.get(32);
+        }
+        auto count = frames - order;
+        for (int start = 0; start < count; start += LOSSLESS_PARTITION) {
+            auto n = std::min(LOSSLESS_PARTITION, count - start);
+            auto k = (int)bits.get(LOSSLESS_RICE_BITS);
+            for (int i = 0; i < n; i++) {
+                auto q = bits.unary();
+                residual[start + i] = unzigzag((q << k) | bits.getWide(k));
+            }
+        }
+        if (bits.pos > header.length) {
+            return false;
+        }
+        for (int i = order; i < frames; i++) {
+            auto r = residual[i - order];
+            int64_t prediction;
+            if (header.method == Lossless_Lpc) {
+                int64_t sum = 0;
+                for (int j = 0; j < order; j++) {
+                    sum += (int64_t)coeffs[j] * x[i - 1 - j];
+                }
+                prediction = sum >> lpcShift;
+            }
+            else {
+                switch (order) {
+                case 0: prediction = 0; break;
+                case 1: prediction = x[i - 1]; break;
+                case 2: prediction = 2 * (int64_t)x[i - 1] - x[i - 2]; break;
+                case 3: prediction = 3 * (int64_t)x[i - 1] - 3 * (int64_t)x[i - 2] + x[i - 3]; break;
+                default: prediction = 4 * (int64_t)x[i - 1] - 6 * (int64_t)x[i - 2] + 4 * (int64_t)x[i - 3] - x[i - 4]; break;
+                }
+            }
+            x[i] = (int32_t)(prediction + r);
+        }
+        for (int i = 0; i < frames; i++) {
+            x[i] = (int32_t)((uint32_t)x[i] << header.shift);
+        }
+    }
+
+    for (int i = 0; i < frames; i++) {
+        switch (props.sampleFormat) {
+        case CASIO_SampleFormat_Int32:
+            ((int32_t *)out)[i] = x[i];
+            break;
+        case CASIO_SampleFormat_Float32:
+            ((float *)out)[i] = (float)(x[i] / 2147483648.0);
+            break;
+        case CASIO_SampleFormat_Float64:
+            ((double *)out)[i] = x[i] / 2147483648.0;
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+// WAVE_FORMAT_EXTENSIBLE, sizes patched in at the end (and saturated past 4GB)
+static void writeWavHeader(FILE *file, const LosslessProperties &props, int sampleSize, uint64_t dataBytes) {
+    static const uint8_t pcmGuid[16] = {1, 0, 0, 0, 0, 0, 0x10, 0, 0x80, 0, 0, 0xAA, 0, 0x38, 0x9B, 0x71};
+    static const uint8_t floatGuid[16] = {3, 0, 0, 0, 0, 0, 0x10, 0, 0x80, 0, 0, 0xAA, 0, 0x38, 0x9B, 0x71};
+    auto u32 = [&](uint64_t v) {
+        auto clamped = (uint32_t)std::min<uint64_t>(v, UINT32_MAX);
+        fwrite(&clamped, 4, 1, file);
+    };
+    auto u16 = [&](uint16_t v) { fwrite(&v, 2, 1, file); };
+    auto blockAlign = props.numChannels * sampleSize;
+    fwrite("RIFF", 4, 1, file);
+    u32(4 + 8 + 40 + 8 + dataBytes);
+    fwrite("WAVEfmt ", 8, 1, file);
+    u32(40);
+    u16(0xFFFE);
+    u16((uint16_t)props.numChannels);
+    u32((uint32_t)props.sampleRate);
+    u32((uint64_t)props.sampleRate * blockAlign);
+    u16((uint16_t)blockAlign);
+    u16((uint16_t)(sampleSize * 8));
+    u16(22);
+    u16((uint16_t)(sampleSize * 8));
+    u32(0); // channel mask: none in particular
+    fwrite(props.sampleFormat == CASIO_SampleFormat_Int32 ? pcmGuid : floatGuid, 16, 1, file);
+    fwrite("data", 4, 1, file);
+    u32(dataBytes);
+}
+
+bool losslessDecode(const char *path, const char *wavPath)
+{
+    auto in = fopen(path, "rb");
+    if (!in) {
+        return false;
+    }
+    char magic[8];
+    uint32_t version;
+    LosslessProperties props;
+    if (fread(magic, 8, 1, in) != 1 || memcmp(magic, LOSSLESS_MAGIC, 8) != 0 ||
+        fread(&version, sizeof(version), 1, in) != 1 || version != LOSSLESS_VERSION ||
+        fread(&props, sizeof(props), 1, in) != 1 ||
+        props.numChannels < 1 || props.numChannels > LOSSLESS_MAX_CHANNELS || props.blockFrames != LOSSLESS_BLOCK_FRAMES) {
+        fclose(in);
+        return false;
+    }
+    auto format = (CASIO_SampleFormat)props.sampleFormat;
+    int sampleSize = format == CASIO_SampleFormat_Float64 ? 8 : 4;
+    if (format != CASIO_SampleFormat_Int32 && format != CASIO_SampleFormat_Float32 && format != CASIO_SampleFormat_Float64) {
+        fclose(in);
+        return false;
+    }
+    auto out = fopen(wavPath, "wb");
+    if (!out) {
+        fclose(in);
+        return false;
+    }
+    writeWavHeader(out, props, sampleSize, 0);
+
+    auto blockBytes = (size_t)LOSSLESS_BLOCK_FRAMES * sampleSize;
+    std::vector<uint8_t> channels((size_t)props.numChannels * blockBytes), payload(blockBytes);
+    std::vector<uint8_t> interleaved((size_t)props.numChannels * blockBytes);
+    std::vector<int32_t> x(LOSSLESS_BLOCK_FRAMES);
+    std::vector<int64_t> residual(LOSSLESS_BLOCK_FRAMES);
+    uint64_t position = 0; // frames written so far
+    bool ok = true;
+    LosslessBlockHeader header;
+    while (fread(&header, sizeof(header), 1, in) == 1) {
+        if (header.channel != 0 || header.frames == 0 || header.frames > LOSSLESS_BLOCK_FRAMES || header.frame < position) {
+            ok = false;
+            break;
+        }
+        // dropped frames come back as silence
+        std::fill(interleaved.begin(), interleaved.end(), 0);
+        while (position < header.frame) {
+            auto n = (size_t)std::min<uint64_t>(header.frame - position, LOSSLESS_BLOCK_FRAMES);
+            fwrite(interleaved.data(), n * props.numChannels * sampleSize, 1, out);
+            position += n;
+        }
+        auto frames = header.frames;
+        for (int ch = 0; ch < props.numChannels && ok; ch++) {
+            if (ch > 0 && (fread(&header, sizeof(header), 1, in) != 1 || header.channel != ch || header.frames != frames)) {
+                ok = false;
+                break;
+            }
+            if (header.length > blockBytes || fread(payload.data(), 1, header.length, in) != header.length) {
+                ok = false;
+                break;
+            }
+            ok = decodeChannel(props, sampleSize, header, payload.data(), channels.data() + ch * blockBytes,
+                x.data(), residual.data());
+        }
+        if (!ok) {
+            break;
+        }
+        for (int i = 0; i < frames; i++) {
+            for (int ch = 0; ch < props.numChannels; ch++) {
+                memcpy(&interleaved[((size_t)i * props.numChannels + ch) * sampleSize],
+                    &channels[ch * blockBytes + (size_t)i * sampleSize], sampleSize);
+            }
+        }
+        fwrite(interleaved.data(), (size_t)frames * props.numChannels * sampleSize, 1, out);
+        position += frames;
+    }
+    fclose(in);
+    fseek(out, 0, SEEK_SET);
+    writeWavHeader(out, props, sampleSize, position * props.numChannels * sampleSize);
+    fclose(out);
+    return ok;
+}
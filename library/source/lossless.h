@@ -0,0 +1,109 @@
+#pragma once
+
+#include "CASIOClient.h"
+#include "util/lockfree.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// lossless compressed input capture.
+//
+// file layout (little-endian):
+//   "CASIOLAC" | uint32 version | LosslessProperties
+//   then blocks: LosslessBlockHeader | payload[header.length], every channel of a block in channel order
+//
+// the audio thread copies the inputs, in native format, into the slot being filled. a full slot is handed to the
+// encoder threads as one job per channel on a lock-free queue; a writer thread writes finished slots out in order.
+// if no slot is free the audio thread drops frames (and counts them) rather than wait.
+//
+// a channel block is encoded (FLAC-style, though not FLAC: that stops at 8 channels) as one of
+//   constant: one sample
+//   verbatim: the native bytes
+//   fixed / LPC: order warm-up samples, then the prediction residual in Rice-coded partitions.
+// samples are integers for this: Int32 as they are, floats scaled by 2^31 when that's exact, verbatim otherwise.
+// trailing zero bits common to the whole block (24 bit data in 32 bit samples, say) are shifted out first.
+
+#define LOSSLESS_MAGIC "CASIOLAC"
+#define LOSSLESS_VERSION 1
+#define LOSSLESS_BLOCK_FRAMES 4096
+#define LOSSLESS_SLOTS 8
+#define LOSSLESS_MAX_CHANNELS 64 // LosslessBlockHeader.channel is a byte, but job numbers scale with this
+#define LOSSLESS_MAX_THREADS 16
+
+enum LosslessMethod : uint8_t {
+    Lossless_Constant,
+    Lossless_Verbatim,
+    Lossless_Fixed,
+    Lossless_Lpc,
+};
+
+struct LosslessProperties {
+    int32_t numChannels;
+    int32_t sampleFormat; // CASIO_SampleFormat
+    double sampleRate;
+    int32_t blockFrames;
+    int32_t reserved;
+};
+
+struct LosslessBlockHeader {
+    uint64_t frame; // of the first sample, from capture start
+    uint32_t length; // of the payload that follows
+    uint16_t frames;
+    uint8_t channel;
+    uint8_t method; // LosslessMethod
+    uint8_t shift; // wasted bits
+    uint8_t order;
+    uint8_t reserved[6];
+};
+
+struct LosslessSlot {
+    uint8_t *raw; // [numChannels][LOSSLESS_BLOCK_FRAMES * sampleSize]
+    int frames;
+    uint64_t startFrame;
+    std::atomic<int> remaining; // channels still encoding
+    std::atomic<bool> full; // handed to the encoders, until the writer is done with it
+
+    // per channel, written by the encoders
+    LosslessBlockHeader *headers;
+    uint8_t **encoded;
+};
+
+struct LosslessWriter {
+    FILE *file;
+    CASIO_SampleFormat format;
+    int sampleSize;
+    int numChannels;
+    double sampleRate;
+    size_t encodedCapacity; // per channel block
+    LosslessSlot slots[LOSSLESS_SLOTS];
+
+    // audio thread
+    int fillSlot; // -1 while dropping
+    int nextSlot;
+    uint64_t frame;
+
+    BoundedQueue<uint32_t, LOSSLESS_SLOTS * LOSSLESS_MAX_CHANNELS> jobs; // slot * LOSSLESS_MAX_CHANNELS + channel
+    std::atomic<uint32_t> jobsPosted = 0; // encoders wait on this
+    std::vector<std::thread> encoders;
+    std::thread writer;
+    std::atomic<bool> running;
+
+    std::atomic<uint64_t> framesWritten, rawBytes, encodedBytes, droppedFrames, writeErrors;
+    std::atomic<uint64_t> encodeNs; // summed over the encoder threads
+};
+
+// numThreads: encoder threads, 0 = one less than the cores
+LosslessWriter *losslessWriterOpen(const char *path, CASIO_SampleFormat format, int sampleSize, int numChannels,
+                                   double sampleRate, int numThreads);
+// encodes whatever's left, closes the file and reports the final stats
+void losslessWriterClose(LosslessWriter *w, CASIO_CaptureStats *stats);
+void losslessGetStats(const LosslessWriter *w, CASIO_CaptureStats *stats);
+
+// audio thread
+void losslessWrite(LosslessWriter *w, void **inputs, int frames);
+
+// expands a capture to a WAV file
+bool losslessDecode(const char *path, const char *wavPath);
@@ -0,0 +1,207 @@
+#include "metering.h"
+
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define METER_SSE2
+#include <emmintrin.h>
+#endif
+
+#define INT32_SCALE (1.0f / 2147483648.0f)
+
+//============ kernels =======================================================
+// each one does a single pass over the native buffer, no separate conversion to float first
+
+static float meterInt32(const int32_t *src, int n, double *sumSquares, unsigned int *clips)
+{
+    int i = 0;
+    float peak = 0;
+    double sum = 0;
+    unsigned int clipCount = 0;
+#ifdef METER_SSE2
+    const __m128 scale = _mm_set1_ps(INT32_SCALE);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 vpeak = _mm_setzero_ps();
+    __m128 vsum = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        auto x = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(src + i))), scale);
+        auto a = _mm_and_ps(x, absMask);
+        vpeak = _mm_max_ps(vpeak, a);
+        vsum = _mm_add_ps(vsum, _mm_mul_ps(x, x));
+        clipCount += std::popcount((unsigned int)_mm_movemask_ps(_mm_cmpge_ps(a, one)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, vpeak);
+    peak = std::fmax(std::fmax(lanes[0], lanes[1]), std::fmax(lanes[2], lanes[3]));
+    _mm_storeu_ps(lanes, vsum);
+    sum = (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < n; i++) {
+        auto x = src[i] * INT32_SCALE;
+        auto a = std::fabs(x);
+        peak = std::fmax(peak, a);
+        sum += (double)x * x;
+        clipCount += (a >= 1.0f);
+    }
+    if (sumSquares) *sumSquares = sum;
+    if (clips) *clips = clipCount;
+    return peak;
+}
+
+static float meterFloat32(const float *src, int n, double *sumSquares, unsigned int *clips)
+{
+    int i = 0;
+    float peak = 0;
+    double sum = 0;
+    unsigned int clipCount = 0;
+#ifdef METER_SSE2
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 vpeak = _mm_setzero_ps();
+    __m128 vsum = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        auto x = _mm_loadu_ps(src + i);
+        auto a = _mm_and_ps(x, absMask);
+        vpeak = _mm_max_ps(vpeak, a);
+        vsum = _mm_add_ps(vsum, _mm_mul_ps(x, x));
+        clipCount += std::popcount((unsigned int)_mm_movemask_ps(_mm_cmpge_ps(a, one)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, vpeak);
+    peak = std::fmax(std::fmax(lanes[0], lanes[1]), std::fmax(lanes[2], lanes[3]));
+    _mm_storeu_ps(lanes, vsum);
+    sum = (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < n; i++) {
+        auto a = std::fabs(src[i]);
+        peak = std::fmax(peak, a);
+        sum += (double)src[i] * src[i];
+        clipCount += (a >= 1.0f);
+    }
+    if (sumSquares) *sumSquares = sum;
+    if (clips) *clips = clipCount;
+    return peak;
+}
+
+static float meterFloat64(const double *src, int n, double *sumSquares, unsigned int *clips)
+{
+    int i = 0;
+    double peak = 0;
+    double sum = 0;
+    unsigned int clipCount = 0;
+#ifdef METER_SSE2
+    const __m128d absMask = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+    const __m128d one = _mm_set1_pd(1.0);
+    __m128d vpeak = _mm_setzero_pd();
+    __m128d vsum = _mm_setzero_pd();
+    for (; i + 2 <= n; i += 2) {
+        auto x = _mm_loadu_pd(src + i);
+        auto a = _mm_and_pd(x, absMask);
+        vpeak = _mm_max_pd(vpeak, a);
+        vsum = _mm_add_pd(vsum, _mm_mul_pd(x, x));
+        clipCount += std::popcount((unsigned int)_mm_movemask_pd(_mm_cmpge_pd(a, one)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, vpeak);
+    peak = std::fmax(lanes[0], lanes[1]);
+    _mm_storeu_pd(lanes, vsum);
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++) {
+        auto a = std::fabs(src[i]);
+        peak = std::fmax(peak, a);
+        sum += src[i] * src[i];
+        clipCount += (a >= 1.0);
+    }
+    if (sumSquares) *sumSquares = sum;
+    if (clips) *clips = clipCount;
+    return (float)peak;
+}
+
+float meterChannel(CASIO_SampleFormat format, const void *buffer, int numSamples, double *sumSquares, unsigned int *clips)
+{
+    switch (format) {
+    case CASIO_SampleFormat_Int32:
+        return meterInt32((const int32_t *)buffer, numSamples, sumSquares, clips);
+    case CASIO_SampleFormat_Float32:
+        return meterFloat32((const float *)buffer, numSamples, sumSquares, clips);
+    case CASIO_SampleFormat_Float64:
+        return meterFloat64((const double *)buffer, numSamples, sumSquares, clips);
+    default:
+        if (sumSquares) *sumSquares = 0;
+        if (clips) *clips = 0;
+        return 0;
+    }
+}
+
+//============ publishing ====================================================
+
+void meterReset(MeterBank *bank)
+{
+    bank->bufferCount = 0;
+    memset(bank->inputClips, 0, sizeof(bank->inputClips));
+    memset(bank->outputClips, 0, sizeof(bank->outputClips));
+    memset(bank->slots, 0, sizeof(bank->slots));
+    bank->resetRequested = false;
+}
+
+void meterRequestReset(MeterBank *bank)
+{
+    bank->resetRequested.store(true, std::memory_order_release);
+}
+
+static void meterChannels(CASIO_SampleFormat format, int bufferSamples, void **buffers, int count, uint64_t active,
+                          unsigned int *runningClips, CASIO_ChannelMeter *out)
+{
+    for (int i = 0; i < count; i++) {
+        if (!(active & (1ULL << i))) {
+            out[i].peak = out[i].rms = 0;
+            out[i].clipCount = runningClips[i];
+            continue;
+        }
+        double sumSquares;
+        unsigned int clips;
+        out[i].peak = meterChannel(format, buffers[i], bufferSamples, &sumSquares, &clips);
+        out[i].rms = (float)std::sqrt(sumSquares / bufferSamples);
+        runningClips[i] += clips;
+        out[i].clipCount = runningClips[i];
+    }
+}
+
+void meterProcess(MeterBank *bank, CASIO_SampleFormat format, int bufferSamples,
+                  void **inputs, int numInputs, uint64_t activeInputs,
+                  void **outputs, int numOutputs)
+{
+    if (bank->resetRequested.exchange(false, std::memory_order_acquire)) {
+        // (the published slots stay as they are, the next one written starts from zero)
+        bank->bufferCount = 0;
+        memset(bank->inputClips, 0, sizeof(bank->inputClips));
+        memset(bank->outputClips, 0, sizeof(bank->outputClips));
+    }
+
+    // write into the slot readers aren't currently pointed at
+    auto seq = bank->sequence.load(std::memory_order_relaxed);
+    auto slot = &bank->slots[(seq + 1) & 1];
+
+    slot->bufferCount = ++bank->bufferCount;
+    meterChannels(format, bufferSamples, inputs, numInputs, activeInputs, bank->inputClips, slot->inputs);
+    meterChannels(format, bufferSamples, outputs, numOutputs, ~0ULL, bank->outputClips, slot->outputs);
+
+    bank->sequence.store(seq + 1, std::memory_order_release);
+}
+
+void meterRead(MeterBank *bank, MeterSnapshot *out)
+{
+    while (true) {
+        auto before = bank->sequence.load(std::memory_order_acquire);
+        memcpy(out, &bank->slots[before & 1], sizeof(MeterSnapshot));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // the writer only touches this slot again after publishing the *next* sequence
+        if (bank->sequence.load(std::memory_order_relaxed) == before) {
+            return;
+        }
+    }
+}
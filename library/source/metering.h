@@ -0,0 +1,51 @@
+#pragma once
+
+#include "CASIOClient.h"
+
+#include <atomic>
+#include <cstdint>
+
+// per-channel peak / RMS / clip metering, computed on the audio thread in the device's native sample format
+// and published to any number of polling (non-audio) threads through a double-buffered snapshot.
+//
+// the audio thread never waits: it always writes the slot readers are *not* being pointed at, then bumps the sequence.
+// readers copy the current slot and retry if the sequence moved underneath them (a buffer period is milliseconds,
+// a copy is microseconds, so in practice they never loop).
+
+#define METER_MAX_CHANNELS 64
+
+struct MeterSnapshot {
+    uint64_t bufferCount;
+    CASIO_ChannelMeter inputs[METER_MAX_CHANNELS];
+    CASIO_ChannelMeter outputs[METER_MAX_CHANNELS];
+};
+
+struct MeterBank {
+    std::atomic<bool> enabled = false;
+    std::atomic<bool> resetRequested = false; // consumed by the audio thread at the start of meterProcess
+    std::atomic<uint32_t> sequence = 0;
+    MeterSnapshot slots[2];
+
+    // audio-thread only
+    uint64_t bufferCount = 0;
+    unsigned int inputClips[METER_MAX_CHANNELS];
+    unsigned int outputClips[METER_MAX_CHANNELS];
+};
+
+// only while no audio thread can be in meterProcess (device open). otherwise meterRequestReset:
+// the audio thread clears its running counts before the next buffer it meters
+void meterReset(MeterBank *bank);
+void meterRequestReset(MeterBank *bank);
+
+// audio thread: meter one buffer of every channel and publish the result.
+// inputs whose bit is clear in activeInputs (see silence.h) are published as silent without being scanned
+void meterProcess(MeterBank *bank, CASIO_SampleFormat format, int bufferSamples,
+                  void **inputs, int numInputs, uint64_t activeInputs,
+                  void **outputs, int numOutputs);
+
+// any thread: copy out the most recently published snapshot
+void meterRead(MeterBank *bank, MeterSnapshot *out);
+
+// single-channel kernel.
+// returns peak (normalized to full scale), and optionally sum-of-squares (normalized) and the number of clipped samples
+float meterChannel(CASIO_SampleFormat format, const void *buffer, int numSamples, double *sumSquares, unsigned int *clips);
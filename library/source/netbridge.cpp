@@ -0,0 +1,804 @@
+#include "netbridge.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#ifdef _WIN32
+#include <winsock2.h> // (first, so a Windows.h pulled in later doesn't drag in winsock.h)
+#include <ws2tcpip.h>
+#include <timeapi.h>
+typedef SOCKET NetSocket;
+#define closeSocket closesocket
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int NetSocket;
+#define INVALID_SOCKET (-1)
+#define closeSocket close
+#endif
+
+#define NET_BATCH 32 // packets per sendmmsg/recvmmsg
+#define NET_RTP_HEADER 12
+#define NET_POLL_US 500 // how long the network thread waits for packets before checking the send rings again
+#define NET_SEND_RING_BUFFERS 32 // device buffers a send ring holds
+#define NET_MAX_CORRECTION 0.001 // clamp on the fill-level correction of the read step (1000ppm)
+#define NET_REBASE_SECONDS 2 // timestamp jumps bigger than this are treated as a sender restart
+
+static uint64_t netNow() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//============ sockets =======================================================
+
+static bool isMulticast(uint32_t addr) { // host order
+    return (addr >> 28) == 0xE;
+}
+
+static bool parseAddress(const char *address, unsigned short port, sockaddr_in *out) {
+    memset(out, 0, sizeof(*out));
+    out->sin_family = AF_INET;
+    out->sin_port = htons(port);
+    if (!address || !*address) {
+        out->sin_addr.s_addr = htonl(INADDR_ANY);
+        return true;
+    }
+    return inet_pton(AF_INET, address, &out->sin_addr) == 1;
+}
+
+static void setNonBlocking(NetSocket s) {
+#ifdef _WIN32
+    u_long on = 1;
+    ioctlsocket(s, FIONBIO, &on);
+#else
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+static NetSocket openSendSocket(const sockaddr_in *dest) {
+    auto s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+    if (isMulticast(ntohl(dest->sin_addr.s_addr))) {
+        int ttl = 16;
+        char loop = 1; // so a receiver on the same machine hears it
+        setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, (const char *)&ttl, sizeof(ttl));
+        setsockopt(s, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    }
+    setNonBlocking(s);
+    return s;
+}
+
+static NetSocket openReceiveSocket(const sockaddr_in *group) {
+    auto s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+    int on = 1;
+    int bufferSize = 1 << 20;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char *)&bufferSize, sizeof(bufferSize));
+
+    sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = group->sin_port;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(s, (const sockaddr *)&local, sizeof(local)) != 0) {
+        closeSocket(s);
+        return INVALID_SOCKET;
+    }
+    if (isMulticast(ntohl(group->sin_addr.s_addr))) {
+        ip_mreq membership;
+        membership.imr_multiaddr = group->sin_addr;
+        membership.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *)&membership, sizeof(membership)) != 0) {
+            closeSocket(s);
+            return INVALID_SOCKET;
+        }
+    }
+    setNonBlocking(s);
+    return s;
+}
+
+struct PacketBatch {
+    uint8_t data[NET_BATCH][NET_RTP_HEADER + NET_MAX_PAYLOAD];
+    int lengths[NET_BATCH];
+    int count;
+};
+
+static void sendBatch(NetSocket s, const sockaddr_in *dest, PacketBatch *batch) {
+#ifdef __linux__
+    mmsghdr messages[NET_BATCH];
+    iovec vectors[NET_BATCH];
+    memset(messages, 0, sizeof(messages));
+    for (int i = 0; i < batch->count; i++) {
+        vectors[i].iov_base = batch->data[i];
+        vectors[i].iov_len = (size_t)batch->lengths[i];
+        messages[i].msg_hdr.msg_name = (void *)dest;
+        messages[i].msg_hdr.msg_namelen = sizeof(*dest);
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    int sent = 0;
+    while (sent < batch->count) {
+        auto result = sendmmsg(s, messages + sent, (unsigned)(batch->count - sent), 0);
+        if (result <= 0) {
+            break; // (full socket buffer: the rest is lost, like any other udp loss)
+        }
+        sent += result;
+    }
+#else
+    for (int i = 0; i < batch->count; i++) {
+        sendto(s, (const char *)batch->data[i], batch->lengths[i], 0, (const sockaddr *)dest, sizeof(*dest));
+    }
+#endif
+    batch->count = 0;
+}
+
+// calls handle(data, length) for every packet waiting on the socket, without blocking
+template<typename F>
+static void receiveAll(NetSocket s, PacketBatch *batch, F handle) {
+#ifdef __linux__
+    mmsghdr messages[NET_BATCH];
+    iovec vectors[NET_BATCH];
+    while (true) {
+        memset(messages, 0, sizeof(messages));
+        for (int i = 0; i < NET_BATCH; i++) {
+            vectors[i].iov_base = batch->data[i];
+            vectors[i].iov_len = sizeof(batch->data[i]);
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        auto received = recvmmsg(s, messages, NET_BATCH, MSG_DONTWAIT, nullptr);
+        if (received <= 0) {
+            return;
+        }
+        for (int i = 0; i < received; i++) {
+            handle(batch->data[i], (int)messages[i].msg_len);
+        }
+        if (received < NET_BATCH) {
+            return;
+        }
+    }
+#else
+    while (true) {
+        auto received = recv(s, (char *)batch->data[0], (int)sizeof(batch->data[0]), 0);
+        if (received <= 0) {
+            return; // (would block, or an error we can't do anything about here)
+        }
+        handle(batch->data[0], (int)received);
+    }
+#endif
+}
+
+//============ sample conversion =============================================
+
+static int32_t nativeToInt32(CASIO_SampleFormat format, const uint8_t *src) {
+    double v;
+    switch (format) {
+    case CASIO_SampleFormat_Int32:
+        return *(const int32_t *)src;
+    case CASIO_SampleFormat_Float32:
+        v = *(const float *)src;
+        break;
+    case CASIO_SampleFormat_Float64:
+        v = *(const double *)src;
+        break;
+    default:
+        return 0;
+    }
+    v = v > 1.0 ? 1.0 : (v < -1.0 ? -1.0 : v);
+    return (int32_t)(v * 2147483647.0);
+}
+
+static void mixFloat(CASIO_SampleFormat format, void *dst, int i, float v) {
+    switch (format) {
+    case CASIO_SampleFormat_Int32:
+    {
+        auto d = (int32_t *)dst;
+        auto sum = (int64_t)d[i] + (int64_t)((double)v * 2147483647.0);
+        d[i] = sum > INT32_MAX ? INT32_MAX : (sum < INT32_MIN ? INT32_MIN : (int32_t)sum);
+        break;
+    }
+    case CASIO_SampleFormat_Float32:
+        ((float *)dst)[i] += v;
+        break;
+    case CASIO_SampleFormat_Float64:
+        ((double *)dst)[i] += v;
+        break;
+    default:
+        break;
+    }
+}
+
+//============ setup =========================================================
+
+static bool validConfig(const CASIO_StreamConfig *config, int numDeviceChannels) {
+    if (config->bitDepth != 16 && config->bitDepth != 24) {
+        return false;
+    }
+    if (config->numChannels < 1 || config->numChannels > NET_MAX_STREAM_CHANNELS ||
+        config->firstChannel < 0 || config->firstChannel + config->numChannels > numDeviceChannels) {
+        return false;
+    }
+    auto packetSamples = config->packetSamples ? config->packetSamples : 48;
+    return packetSamples > 0 && packetSamples * config->numChannels * (config->bitDepth / 8) <= NET_MAX_PAYLOAD;
+}
+
+static void withDefaults(CASIO_StreamConfig *config) {
+    if (!config->payloadType) {
+        config->payloadType = 96;
+    }
+    if (!config->packetSamples) {
+        config->packetSamples = 48;
+    }
+    if (!config->targetLatencySamples) {
+        config->targetLatencySamples = 3 * config->packetSamples;
+    }
+    config->address = nullptr; // (not ours to keep)
+}
+
+static void networkThread(NetBridge *bridge);
+
+static void startThread(NetBridge *bridge) {
+    bridge->running = true;
+    bridge->thread = std::thread(networkThread, bridge);
+}
+
+static void stopThread(NetBridge *bridge) {
+    if (bridge->thread.joinable()) {
+        bridge->running = false;
+        bridge->thread.join();
+    }
+}
+
+NetBridge *netBridgeCreate(CASIO_SampleFormat format, int bufferSamples, int bytesPerSample, double sampleRate)
+{
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        return nullptr;
+    }
+#endif
+    auto bridge = new NetBridge();
+    bridge->format = format;
+    bridge->bufferSamples = bufferSamples;
+    bridge->bytesPerSample = bytesPerSample;
+    bridge->sampleRate = sampleRate;
+    bridge->clockWindowSamples = 0;
+    bridge->clockWindowNs = 0;
+    bridge->clockSamples = 0;
+    bridge->deviceRate = 0;
+    startThread(bridge);
+    return bridge;
+}
+
+static void destroySend(NetSendStream *stream) {
+    closeSocket((NetSocket)stream->socket);
+    delete stream->ring;
+    delete stream;
+}
+
+static void destroyReceive(NetReceiveStream *stream) {
+    closeSocket((NetSocket)stream->socket);
+    delete[] stream->samples;
+    delete stream;
+}
+
+void netBridgeDestroy(NetBridge *bridge)
+{
+    stopThread(bridge);
+    for (int i = 0; i < NET_MAX_STREAMS; i++) {
+        if (auto stream = bridge->sends[i].detach()) {
+            destroySend(stream);
+        }
+        if (auto stream = bridge->receives[i].detach()) {
+            destroyReceive(stream);
+        }
+    }
+    delete bridge;
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+int netBridgeAddSend(NetBridge *bridge, const CASIO_StreamConfig *config, int numDeviceInputs)
+{
+    sockaddr_in dest;
+    if (!validConfig(config, numDeviceInputs) || !config->address || !parseAddress(config->address, config->port, &dest)) {
+        return -1;
+    }
+    auto socket = openSendSocket(&dest);
+    if (socket == INVALID_SOCKET) {
+        return -1;
+    }
+
+    auto stream = new NetSendStream();
+    stream->config = *config;
+    withDefaults(&stream->config);
+    stream->firstChannel = config->firstChannel;
+    stream->numChannels = config->numChannels;
+    stream->socket = (intptr_t)socket;
+    static_assert(sizeof(stream->destAddr) >= sizeof(sockaddr_in), "destAddr too small");
+    memcpy(stream->destAddr, &dest, sizeof(dest));
+    // each record: uint32 skipped frames | numChannels * one device buffer, channel after channel
+    stream->ring = new ByteRing(NET_SEND_RING_BUFFERS *
+        (sizeof(uint32_t) + (size_t)stream->numChannels * bridge->bufferSamples * bridge->bytesPerSample));
+    std::random_device random; // RFC 3550 wants random initial values
+    stream->sequence = (uint16_t)random();
+    stream->ssrc = random();
+    stream->timestamp = random();
+    stream->pendingFrames = 0;
+    stream->skippedFrames = 0;
+
+    stopThread(bridge);
+    int id = -1;
+    for (int i = 0; i < NET_MAX_STREAMS && id < 0; i++) {
+        if (bridge->sends[i].attach(stream)) {
+            id = i;
+        }
+    }
+    startThread(bridge);
+    if (id < 0) {
+        destroySend(stream);
+    }
+    return id;
+}
+
+int netBridgeAddReceive(NetBridge *bridge, const CASIO_StreamConfig *config, int numDeviceOutputs)
+{
+    sockaddr_in group;
+    if (!validConfig(config, numDeviceOutputs) || !parseAddress(config->address, config->port, &group)) {
+        return -1;
+    }
+    auto socket = openReceiveSocket(&group);
+    if (socket == INVALID_SOCKET) {
+        return -1;
+    }
+
+    auto stream = new NetReceiveStream();
+    stream->config = *config;
+    withDefaults(&stream->config);
+    stream->firstChannel = config->firstChannel;
+    stream->numChannels = config->numChannels;
+    stream->socket = (intptr_t)socket;
+    stream->samples = new float[(size_t)NET_JITTER_CAPACITY * stream->numChannels]();
+    stream->head = 0;
+    stream->started = false;
+    stream->jitter = 0;
+    stream->remoteRate = 0;
+    stream->reading = false;
+    stream->readPos = 0;
+    stream->stalledHead = 0;
+    stream->filteredFill = 0;
+    // the audio thread has to be able to pull a whole device buffer out of it, plus a packet's worth of slack
+    stream->target = std::max(stream->config.targetLatencySamples, bridge->bufferSamples + stream->config.packetSamples);
+    stream->step = 1.0;
+    stream->depth = 0;
+
+    stopThread(bridge);
+    int id = -1;
+    for (int i = 0; i < NET_MAX_STREAMS && id < 0; i++) {
+        if (bridge->receives[i].attach(stream)) {
+            id = NET_RECEIVE_ID_BASE + i;
+        }
+    }
+    startThread(bridge);
+    if (id < 0) {
+        destroyReceive(stream);
+    }
+    return id;
+}
+
+bool netBridgeRemove(NetBridge *bridge, int streamId)
+{
+    bool found = false;
+    stopThread(bridge);
+    if (streamId >= 0 && streamId < NET_MAX_STREAMS) {
+        if (auto stream = bridge->sends[streamId].detach()) {
+            destroySend(stream);
+            found = true;
+        }
+    }
+    else if (streamId >= NET_RECEIVE_ID_BASE && streamId < NET_RECEIVE_ID_BASE + NET_MAX_STREAMS) {
+        if (auto stream = bridge->receives[streamId - NET_RECEIVE_ID_BASE].detach()) {
+            destroyReceive(stream);
+            found = true;
+        }
+    }
+    startThread(bridge);
+    return found;
+}
+
+bool netBridgeGetStats(NetBridge *bridge, int streamId, CASIO_StreamStats *stats)
+{
+    bool found = false;
+    memset(stats, 0, sizeof(*stats));
+    if (streamId >= 0 && streamId < NET_MAX_STREAMS) {
+        bridge->sends[streamId].use([&](NetSendStream *stream) {
+            stats->packets = stream->packets.load(std::memory_order_relaxed);
+            stats->underruns = stream->droppedBuffers.load(std::memory_order_relaxed);
+            found = true;
+        });
+    }
+    else if (streamId >= NET_RECEIVE_ID_BASE && streamId < NET_RECEIVE_ID_BASE + NET_MAX_STREAMS) {
+        bridge->receives[streamId - NET_RECEIVE_ID_BASE].use([&](NetReceiveStream *stream) {
+            stats->packets = stream->packets.load(std::memory_order_relaxed);
+            stats->lostPackets = stream->lostPackets.load(std::memory_order_relaxed);
+            stats->latePackets = stream->latePackets.load(std::memory_order_relaxed);
+            stats->underruns = stream->underruns.load(std::memory_order_relaxed);
+            stats->bufferedSamples = stream->depth.load(std::memory_order_relaxed);
+            stats->targetSamples = stream->targetShared.load(std::memory_order_relaxed);
+            stats->jitterSamples = stream->jitter.load(std::memory_order_relaxed);
+            stats->driftPpm = (stream->step.load(std::memory_order_relaxed) - 1.0) * 1e6;
+            found = true;
+        });
+    }
+    return found;
+}
+
+//============ audio thread ==================================================
+
+void netBridgeCapture(NetBridge *bridge, const CASIO_Event *bufferSwitch)
+{
+    auto &time = bufferSwitch->bufferSwitchEvent.time;
+    auto n = bridge->bufferSamples;
+
+    // measure the device clock, preferably from the driver's own timestamps
+    uint64_t samples, ns;
+    if ((time.flags & CASIO_TimeFlag_Samples) && (time.flags & CASIO_TimeFlag_NanoSecs)) {
+        samples = time.samples;
+        ns = time.nanoSeconds;
+    }
+    else {
+        samples = bridge->clockSamples;
+        ns = netNow();
+    }
+    bridge->clockSamples += n;
+    if (!bridge->clockWindowNs || ns < bridge->clockWindowNs || samples < bridge->clockWindowSamples) {
+        bridge->clockWindowSamples = samples;
+        bridge->clockWindowNs = ns;
+    }
+    else if (ns - bridge->clockWindowNs >= 1000000000ull) {
+        bridge->deviceRate = (double)(samples - bridge->clockWindowSamples) * 1e9 / (double)(ns - bridge->clockWindowNs);
+    }
+
+    for (int i = 0; i < NET_MAX_STREAMS; i++) {
+        bridge->sends[i].use([&](NetSendStream *stream) {
+            auto channelBytes = (size_t)n * bridge->bytesPerSample;
+            auto recordBytes = sizeof(uint32_t) + stream->numChannels * channelBytes;
+            if (stream->ring->writable() < recordBytes) {
+                // the network thread fell behind. remember the gap so the RTP timestamps stay on the device clock
+                stream->skippedFrames += (uint32_t)n;
+                stream->droppedBuffers.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            stream->ring->stage(&stream->skippedFrames, sizeof(uint32_t));
+            for (int c = 0; c < stream->numChannels; c++) {
+                stream->ring->stage(bufferSwitch->bufferSwitchEvent.inputs[stream->firstChannel + c], channelBytes);
+            }
+            stream->ring->publish();
+            stream->skippedFrames = 0;
+        });
+    }
+}
+
+static void playStream(NetBridge *bridge, NetReceiveStream *stream, void **outputs)
+{
+    auto n = bridge->bufferSamples;
+    auto head = stream->head.load(std::memory_order_acquire);
+    auto &config = stream->config;
+
+    // adapt the target depth to the jitter: grow right away, shrink slowly
+    auto minTarget = std::max(config.targetLatencySamples, n + config.packetSamples);
+    auto wanted = std::max(minTarget, config.packetSamples + (int)(4 * stream->jitter.load(std::memory_order_relaxed)));
+    if (wanted > stream->target) {
+        stream->target = wanted;
+    }
+    else if (wanted < stream->target) {
+        stream->target--;
+    }
+    auto target = std::min(stream->target, NET_JITTER_CAPACITY / 2);
+    stream->targetShared.store(target, std::memory_order_relaxed);
+
+    if (!stream->reading) {
+        // (re)buffer: wait for new data to arrive, then start target samples behind it
+        if (head == stream->stalledHead || head < target) {
+            stream->depth.store(0, std::memory_order_relaxed);
+            return;
+        }
+        stream->reading = true;
+        stream->readPos = (double)(head - target);
+        stream->filteredFill = target;
+    }
+
+    auto fill = (double)head - stream->readPos;
+    if (fill > NET_JITTER_CAPACITY - 2 * n) {
+        // way behind (sender jumped ahead, or we were stalled): resync
+        stream->readPos = (double)(head - target);
+        stream->filteredFill = fill = target;
+        stream->underruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    stream->filteredFill += 0.01 * (fill - stream->filteredFill);
+
+    // follow the sender's clock against the device's, and nudge toward the target depth on top of that
+    double step = 1.0;
+    auto remoteRate = stream->remoteRate.load(std::memory_order_relaxed);
+    if (remoteRate > 0 && bridge->deviceRate > 0) {
+        auto ratio = remoteRate / bridge->deviceRate;
+        if (std::fabs(ratio - 1.0) < 0.01) { // anything further off is a measurement problem, not a clock
+            step = ratio;
+        }
+    }
+    auto correction = (stream->filteredFill - target) * 2e-6;
+    step += correction > NET_MAX_CORRECTION ? NET_MAX_CORRECTION : (correction < -NET_MAX_CORRECTION ? -NET_MAX_CORRECTION : correction);
+
+    if (stream->readPos + (n - 1) * step + 2 > (double)head) {
+        // ran dry
+        stream->underruns.fetch_add(1, std::memory_order_relaxed);
+        stream->reading = false;
+        stream->stalledHead = head;
+        stream->depth.store(0, std::memory_order_relaxed);
+        return;
+    }
+
+    const auto mask = NET_JITTER_CAPACITY - 1;
+    auto channels = stream->numChannels;
+    for (int c = 0; c < channels; c++) {
+        auto out = outputs[stream->firstChannel + c];
+        auto pos = stream->readPos;
+        for (int i = 0; i < n; i++, pos += step) {
+            auto index = (int64_t)pos;
+            auto frac = (float)(pos - (double)index);
+            auto a = stream->samples[(index & mask) * channels + c];
+            auto b = stream->samples[((index + 1) & mask) * channels + c];
+            mixFloat(bridge->format, out, i, a + (b - a) * frac);
+        }
+    }
+    stream->readPos += n * step;
+    stream->step.store(step, std::memory_order_relaxed);
+    stream->depth.store((int)((double)head - stream->readPos), std::memory_order_relaxed);
+}
+
+void netBridgePlay(NetBridge *bridge, void **outputs)
+{
+    for (int i = 0; i < NET_MAX_STREAMS; i++) {
+        bridge->receives[i].use([&](NetReceiveStream *stream) {
+            playStream(bridge, stream, outputs);
+        });
+    }
+}
+
+//============ network thread ================================================
+
+static void finishPacket(NetSendStream *stream, PacketBatch *batch, const sockaddr_in *dest) {
+    auto bytesPerFrame = stream->numChannels * (stream->config.bitDepth / 8);
+    auto packet = batch->data[batch->count];
+    packet[0] = 0x80; // version 2, no padding/extension/csrc
+    packet[1] = (uint8_t)(stream->config.payloadType & 0x7F);
+    packet[2] = (uint8_t)(stream->sequence >> 8);
+    packet[3] = (uint8_t)stream->sequence;
+    for (int i = 0; i < 4; i++) {
+        packet[4 + i] = (uint8_t)(stream->timestamp >> (24 - 8 * i));
+        packet[8 + i] = (uint8_t)(stream->ssrc >> (24 - 8 * i));
+    }
+    memcpy(packet + NET_RTP_HEADER, stream->pending, (size_t)stream->pendingFrames * bytesPerFrame);
+    batch->lengths[batch->count++] = NET_RTP_HEADER + stream->pendingFrames * bytesPerFrame;
+
+    stream->sequence++;
+    stream->timestamp += (uint32_t)stream->pendingFrames;
+    stream->pendingFrames = 0;
+    stream->packets.fetch_add(1, std::memory_order_relaxed);
+    if (batch->count == NET_BATCH) {
+        sendBatch((NetSocket)stream->socket, dest, batch);
+    }
+}
+
+static void pumpSend(NetBridge *bridge, NetSendStream *stream, PacketBatch *batch, uint8_t *record) {
+    auto n = bridge->bufferSamples;
+    auto bps = bridge->bytesPerSample;
+    auto bytesOut = stream->config.bitDepth / 8;
+    auto channelBytes = (size_t)n * bps;
+    auto recordBytes = sizeof(uint32_t) + stream->numChannels * channelBytes;
+    auto dest = (const sockaddr_in *)stream->destAddr;
+
+    while (stream->ring->readable() >= recordBytes) {
+        stream->ring->read(record, recordBytes);
+        uint32_t skipped;
+        memcpy(&skipped, record, sizeof(skipped));
+        if (skipped) {
+            if (stream->pendingFrames) {
+                finishPacket(stream, batch, dest); // (a short packet is fine)
+            }
+            stream->timestamp += skipped;
+        }
+
+        auto channels = record + sizeof(uint32_t);
+        for (int f = 0; f < n; f++) {
+            auto out = stream->pending + stream->pendingFrames * stream->numChannels * bytesOut;
+            for (int c = 0; c < stream->numChannels; c++) {
+                auto v = nativeToInt32(bridge->format, channels + c * channelBytes + (size_t)f * bps);
+                // big-endian, most significant bytes first
+                *out++ = (uint8_t)(v >> 24);
+                *out++ = (uint8_t)(v >> 16);
+                if (bytesOut == 3) {
+                    *out++ = (uint8_t)(v >> 8);
+                }
+            }
+            if (++stream->pendingFrames == stream->config.packetSamples) {
+                finishPacket(stream, batch, dest);
+            }
+        }
+    }
+    if (batch->count) {
+        sendBatch((NetSocket)stream->socket, dest, batch);
+    }
+}
+
+static void handlePacket(NetBridge *bridge, NetReceiveStream *stream, const uint8_t *packet, int length) {
+    auto &config = stream->config;
+    if (length < NET_RTP_HEADER || (packet[0] >> 6) != 2 || (packet[1] & 0x7F) != config.payloadType) {
+        return;
+    }
+    auto headerLength = NET_RTP_HEADER + 4 * (packet[0] & 0x0F); // skip csrcs
+    if (packet[0] & 0x10) { // and an extension, if any
+        if (length < headerLength + 4) {
+            return;
+        }
+        headerLength += 4 + 4 * ((packet[headerLength + 2] << 8) | packet[headerLength + 3]);
+    }
+    if (packet[0] & 0x20) { // padding
+        length -= packet[length - 1];
+    }
+    auto bytesPerSample = config.bitDepth / 8;
+    auto bytesPerFrame = stream->numChannels * bytesPerSample;
+    if (length <= headerLength) {
+        return;
+    }
+    auto frames = (length - headerLength) / bytesPerFrame;
+    auto payload = packet + headerLength;
+    auto sequence = (uint16_t)((packet[2] << 8) | packet[3]);
+    auto timestamp = ((uint32_t)packet[4] << 24) | ((uint32_t)packet[5] << 16) | ((uint32_t)packet[6] << 8) | packet[7];
+    auto now = netNow();
+    stream->packets.fetch_add(1, std::memory_order_relaxed);
+
+    auto head = stream->head.load(std::memory_order_relaxed); // (we're the only writer)
+    if (!stream->started) {
+        stream->started = true;
+        stream->baseTimestamp = timestamp - (uint32_t)head;
+        stream->lastFrame = head;
+        stream->lastSequence = (uint16_t)(sequence - 1);
+        stream->rateWindowStart = head;
+        stream->rateWindowNs = now;
+    }
+
+    // unwrap the 32 bit timestamp relative to the last packet
+    auto frame = stream->lastFrame + (int32_t)((timestamp - stream->baseTimestamp) - (uint32_t)stream->lastFrame);
+    if (std::llabs(frame - stream->lastFrame) > (int64_t)(NET_REBASE_SECONDS * bridge->sampleRate)) {
+        // sender restarted: carry on from where we are
+        stream->baseTimestamp = timestamp - (uint32_t)head;
+        frame = head;
+        stream->lastSequence = (uint16_t)(sequence - 1);
+        stream->rateWindowStart = head;
+        stream->rateWindowNs = now;
+        stream->remoteRate.store(0, std::memory_order_relaxed);
+    }
+
+    auto gap = (int16_t)(sequence - (uint16_t)(stream->lastSequence + 1));
+    if (gap < 0) {
+        stream->latePackets.fetch_add(1, std::memory_order_relaxed); // reordered or duplicate
+    }
+    else {
+        stream->lostPackets.fetch_add((uint64_t)gap, std::memory_order_relaxed);
+        stream->lastSequence = sequence;
+
+        // RFC 3550 interarrival jitter, in samples
+        auto transit = (double)now * bridge->sampleRate / 1e9 - (double)frame;
+        if (frame > stream->rateWindowStart) {
+            auto jitter = stream->jitter.load(std::memory_order_relaxed);
+            jitter += (std::fabs(transit - stream->transit) - jitter) / 16;
+            stream->jitter.store(jitter, std::memory_order_relaxed);
+        }
+        stream->transit = transit;
+
+        // the sender's sample rate, averaged over everything since the stream (re)started
+        if (now - stream->rateWindowNs >= 1000000000ull) {
+            stream->remoteRate.store((double)(frame - stream->rateWindowStart) * 1e9 / (double)(now - stream->rateWindowNs),
+                std::memory_order_relaxed);
+        }
+    }
+    if (frame > stream->lastFrame) {
+        stream->lastFrame = frame;
+    }
+
+    if (frame + frames <= head - NET_JITTER_CAPACITY / 2) {
+        stream->latePackets.fetch_add(1, std::memory_order_relaxed); // too old to be any use
+        return;
+    }
+    const auto mask = NET_JITTER_CAPACITY - 1;
+    auto channels = stream->numChannels;
+    // lost packets leave silence behind, not whatever the ring held a lap ago
+    for (auto f = head; f < frame && f < head + NET_JITTER_CAPACITY; f++) {
+        memset(&stream->samples[(f & mask) * channels], 0, sizeof(float) * channels);
+    }
+    for (int f = 0; f < frames; f++) {
+        auto out = &stream->samples[((frame + f) & mask) * channels];
+        auto in = payload + f * bytesPerFrame;
+        for (int c = 0; c < channels; c++, in += bytesPerSample) {
+            auto v = (int32_t)(((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | (bytesPerSample == 3 ? (uint32_t)in[2] << 8 : 0));
+            out[c] = (float)v * (1.0f / 2147483648.0f);
+        }
+    }
+    if (frame + frames > head) {
+        stream->head.store(frame + frames, std::memory_order_release);
+    }
+}
+
+static void networkThread(NetBridge *bridge)
+{
+#ifdef _WIN32
+    timeBeginPeriod(1); // select() timeouts are only as fine as the system timer
+#endif
+    // the thread is restarted whenever streams come or go, so it can hold on to them for its whole life
+    NetSendStream *sends[NET_MAX_STREAMS];
+    NetReceiveStream *receives[NET_MAX_STREAMS];
+    int numSends = 0, numReceives = 0;
+    for (int i = 0; i < NET_MAX_STREAMS; i++) {
+        bridge->sends[i].use([&](NetSendStream *stream) { sends[numSends++] = stream; });
+        bridge->receives[i].use([&](NetReceiveStream *stream) { receives[numReceives++] = stream; });
+    }
+
+    auto batch = new PacketBatch();
+    batch->count = 0;
+    size_t recordBytes = 0;
+    for (int i = 0; i < numSends; i++) {
+        recordBytes = std::max(recordBytes,
+            sizeof(uint32_t) + (size_t)sends[i]->numChannels * bridge->bufferSamples * bridge->bytesPerSample);
+    }
+    auto record = new uint8_t[recordBytes ? recordBytes : 1];
+
+    while (bridge->running.load(std::memory_order_relaxed)) {
+        timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = NET_POLL_US;
+        if (numReceives) {
+            fd_set readable;
+            FD_ZERO(&readable);
+            NetSocket highest = 0;
+            for (int i = 0; i < numReceives; i++) {
+                auto s = (NetSocket)receives[i]->socket;
+                FD_SET(s, &readable);
+                highest = s > highest ? s : highest;
+            }
+            select((int)highest + 1, &readable, nullptr, nullptr, &timeout);
+        }
+        else {
+            std::this_thread::sleep_for(std::chrono::microseconds(NET_POLL_US));
+        }
+
+        for (int i = 0; i < numReceives; i++) {
+            receiveAll((NetSocket)receives[i]->socket, batch, [&](const uint8_t *packet, int length) {
+                handlePacket(bridge, receives[i], packet, length);
+            });
+        }
+        for (int i = 0; i < numSends; i++) {
+            pumpSend(bridge, sends[i], batch, record);
+        }
+    }
+
+    delete[] record;
+    delete batch;
+#ifdef _WIN32
+    timeEndPeriod(1);
+#endif
+}
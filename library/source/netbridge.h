@@ -0,0 +1,113 @@
+#pragma once
+
+#include "CASIOClient.h"
+#include "util/lockfree.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// RTP (AES67-style L16/L24) network bridge.
+//
+// send streams: the audio thread copies the selected inputs, in native format, into a per-stream SPSC ring.
+//   the network thread converts them to big-endian L16/L24, cuts them into RTP packets and sends them in batches
+//   (sendmmsg where available).
+// receive streams: the network thread pulls packets in batches (recvmmsg where available) and writes them into a
+//   per-stream jitter buffer, indexed by RTP timestamp. the audio thread reads it back out through a fractional
+//   read step that tracks the remote clock against the device clock (both measured, the device side from the
+//   bufferSwitch time info), with a small fill-level correction on top, and mixes it into the selected outputs.
+//   the target depth adapts to the measured interarrival jitter.
+//
+// the network thread owns the sockets. adding or removing a stream restarts it, so it never has to
+// synchronize with the control thread; the audio thread only ever touches the rings.
+
+#define NET_MAX_STREAMS 8
+#define NET_MAX_STREAM_CHANNELS 8
+#define NET_JITTER_CAPACITY 16384 // frames per receive stream, power of 2
+#define NET_MAX_PAYLOAD 1440
+
+struct NetSendStream {
+    CASIO_StreamConfig config;
+    int firstChannel, numChannels; // (clamped copies of the config)
+    intptr_t socket;
+    uint8_t destAddr[16]; // sockaddr_in
+    ByteRing *ring;
+
+    // network-thread only
+    uint16_t sequence;
+    uint32_t ssrc;
+    uint32_t timestamp; // RTP timestamp of the next packet
+    int pendingFrames; // frames already packed into pending[]
+    uint8_t pending[NET_MAX_PAYLOAD];
+
+    // audio-thread only
+    uint32_t skippedFrames; // dropped since the last record that made it into the ring
+
+    std::atomic<uint64_t> packets, droppedBuffers;
+};
+
+struct NetReceiveStream {
+    CASIO_StreamConfig config;
+    int firstChannel, numChannels;
+    intptr_t socket;
+    float *samples; // [NET_JITTER_CAPACITY][numChannels], interleaved
+    std::atomic<int64_t> head; // one past the newest frame written, in stream frames
+
+    // network-thread only
+    bool started;
+    uint32_t baseTimestamp;
+    int64_t lastFrame; // extended (unwrapped) frame index of the last packet
+    uint16_t lastSequence;
+    double transit; // for the RFC 3550 jitter estimate
+    int64_t rateWindowStart, rateWindowFrames;
+    uint64_t rateWindowNs;
+
+    // written by the network thread, read by the audio thread
+    std::atomic<double> jitter; // interarrival jitter, in samples
+    std::atomic<double> remoteRate; // measured sender sample rate
+
+    // audio-thread only
+    bool reading;
+    double readPos;
+    double filteredFill;
+    int64_t stalledHead; // head when we last ran dry
+    int target;
+
+    // stats
+    std::atomic<uint64_t> packets, lostPackets, latePackets, underruns;
+    std::atomic<double> step; // latest read step
+    std::atomic<int> depth, targetShared;
+};
+
+struct NetBridge {
+    CASIO_SampleFormat format;
+    int bufferSamples, bytesPerSample;
+    double sampleRate;
+
+    Detachable<NetSendStream> sends[NET_MAX_STREAMS];
+    Detachable<NetReceiveStream> receives[NET_MAX_STREAMS];
+
+    // device clock, measured from the time info (audio thread)
+    uint64_t clockWindowSamples, clockWindowNs;
+    uint64_t clockSamples; // (our own count, for drivers without time info)
+    double deviceRate;
+
+    std::thread thread;
+    std::atomic<bool> running;
+};
+
+NetBridge *netBridgeCreate(CASIO_SampleFormat format, int bufferSamples, int bytesPerSample, double sampleRate);
+void netBridgeDestroy(NetBridge *bridge);
+
+// control thread. return the stream id (>= 0), or -1 on failure
+int netBridgeAddSend(NetBridge *bridge, const CASIO_StreamConfig *config, int numDeviceInputs);
+int netBridgeAddReceive(NetBridge *bridge, const CASIO_StreamConfig *config, int numDeviceOutputs);
+bool netBridgeRemove(NetBridge *bridge, int streamId);
+bool netBridgeGetStats(NetBridge *bridge, int streamId, CASIO_StreamStats *stats);
+
+// audio thread
+void netBridgeCapture(NetBridge *bridge, const CASIO_Event *bufferSwitch); // before the client callback
+void netBridgePlay(NetBridge *bridge, void **outputs); // after it, mixes into the outputs
+
+// receive ids are offset so one id space covers both kinds
+#define NET_RECEIVE_ID_BASE 100
@@ -0,0 +1,140 @@
+// the null host backend: a device without hardware behind it (see backend.h)
+
+#include "engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#define NULL_DEFAULT_CHANNELS 8
+#define NULL_DEFAULT_BUFFER_SIZE 256
+#define NULL_DEFAULT_SAMPLE_RATE 48000.0
+
+// backendData of a null device
+struct NullDevice {
+    std::thread thread;
+    std::atomic<bool> running = false;
+};
+
+static void nullEnumerate(std::vector<CASIO_DeviceID> &ids)
+{
+    auto id = new _CASIO_DeviceID;
+    id->backend = &nullBackend;
+    id->name = "Null Device";
+    ids.push_back(id);
+}
+
+static bool nullOpen(CASIO_Device device, CASIO_DeviceID id)
+{
+    long numInputs = NULL_DEFAULT_CHANNELS, numOutputs = NULL_DEFAULT_CHANNELS, bufferSize = NULL_DEFAULT_BUFFER_SIZE;
+    double sampleRate = NULL_DEFAULT_SAMPLE_RATE;
+    if (auto shape = getenv("CASIO_NULL_DEVICE")) {
+        sscanf(shape, "%ld,%ld,%ld,%lf", &numInputs, &numOutputs, &bufferSize, &sampleRate);
+    }
+    if (numInputs < 0 || numOutputs < 0 || bufferSize < 1 || sampleRate <= 0) {
+        logFormat("bad CASIO_NULL_DEVICE, expected inputs,outputs,bufferSize,sampleRate");
+        return false;
+    }
+
+    snprintf(device->name, sizeof(device->name), "%s", id->name.c_str());
+    device->numInputs = std::min(numInputs, (long)MAX_INPUT_CHANNELS);
+    device->numOutputs = std::min(numOutputs, (long)MAX_OUTPUT_CHANNELS);
+    device->buffer.minSize = device->buffer.maxSize = device->buffer.prefSize = device->buffer.currentSize = bufferSize;
+    device->buffer.granularity = 0;
+    device->sampleRate = sampleRate;
+    device->sampleFormat = CASIO_SampleFormat_Float32;
+    device->sampleSize = sampleFormatSize(device->sampleFormat);
+    engineAllocateBuffers(device);
+    device->backendData = new NullDevice;
+
+    logFormatDev(device, "opened: %ld in / %ld out, %ld samples @ %.2f",
+        device->numInputs, device->numOutputs, device->buffer.currentSize, device->sampleRate);
+    return true;
+}
+
+// stands in for the driver's audio thread. the inputs stay silent
+static void nullThreadProc(CASIO_Device device)
+{
+    auto null = (NullDevice *)device->backendData;
+    auto period = std::chrono::nanoseconds((int64_t)(1e9 * device->buffer.currentSize / device->sampleRate));
+    auto next = std::chrono::steady_clock::now();
+    uint64_t samples = 0;
+    long doubleBufferIndex = 0;
+    while (null->running.load(std::memory_order_relaxed)) {
+        next += period;
+        std::this_thread::sleep_until(next);
+        auto now = std::chrono::steady_clock::now();
+        if (now > next + period) {
+            next = now; // fell behind (debugger, suspended VM...): drop the missed buffers, as a driver would
+        }
+
+        CASIO_Event event = {};
+        event.eventType = CASIO_EventType_BufferSwitch;
+        event.handled = false;
+        event.bufferSwitchEvent.time.flags = CASIO_TimeFlag_NanoSecs | CASIO_TimeFlag_Samples;
+        event.bufferSwitchEvent.time.nanoSeconds = steadyNow();
+        event.bufferSwitchEvent.time.samples = samples;
+        engineBufferSwitch(device, &event, doubleBufferIndex);
+
+        samples += device->buffer.currentSize;
+        doubleBufferIndex ^= 1;
+    }
+}
+
+static bool nullStart(CASIO_Device device)
+{
+    auto null = (NullDevice *)device->backendData;
+    null->running = true;
+    null->thread = std::thread(nullThreadProc, device);
+    logFormatDev(device, "started");
+    return true;
+}
+
+static bool nullStop(CASIO_Device device)
+{
+    auto null = (NullDevice *)device->backendData;
+    null->running = false;
+    if (null->thread.joinable()) { // (not after a failover: CASIO_Start then leaves the backend alone)
+        null->thread.join();
+    }
+    logFormatDev(device, "stopped");
+    return true;
+}
+
+static bool nullSetSampleRate(CASIO_Device device, double sampleRate)
+{
+    if (device->started || sampleRate <= 0) {
+        return false;
+    }
+    device->sampleRate = sampleRate;
+    return true;
+}
+
+static void nullClose(CASIO_Device device)
+{
+    auto null = (NullDevice *)device->backendData;
+    if (null->thread.joinable()) {
+        null->running = false;
+        null->thread.join();
+    }
+    delete null;
+    logFormatDev(device, "closed");
+}
+
+const HostBackend nullBackend = {
+    "null",
+    true,
+    nullptr,
+    nullptr,
+    nullEnumerate,
+    nullOpen,
+    nullClose,
+    nullStart,
+    nullStop,
+    nullSetSampleRate,
+    nullptr,
+    nullptr,
+};
@@ -0,0 +1,173 @@
+#include "schedule.h"
+
+#include <cstring>
+
+//============ gain stage ====================================================
+
+static inline int32_t scaleSample(int32_t x, float gain) {
+    auto y = (double)x * gain;
+    if (y >= 2147483647.0) return 2147483647;
+    if (y <= -2147483648.0) return (int32_t)-2147483648LL;
+    return (int32_t)y;
+}
+static inline float scaleSample(float x, float gain) { return x * gain; }
+static inline double scaleSample(double x, float gain) { return x * gain; }
+
+template<typename T>
+static void applyGain(T *buffer, int from, int to, OutputGain *g)
+{
+    int i = from;
+    // ramping part, per-sample
+    for (; i < to && g->remaining > 0; i++) {
+        g->gain += g->step;
+        if (--g->remaining == 0) {
+            g->gain = g->target; // don't let rounding error accumulate past the end of the ramp
+        }
+        buffer[i] = scaleSample(buffer[i], g->gain);
+    }
+    // settled part
+    if (i < to) {
+        if (g->gain == 0.0f) {
+            memset(buffer + i, 0, sizeof(T) * (to - i));
+        }
+        else if (g->gain != 1.0f) {
+            for (; i < to; i++) {
+                buffer[i] = scaleSample(buffer[i], g->gain);
+            }
+        }
+    }
+}
+
+static void applySegment(Scheduler *s, CASIO_SampleFormat format, void **outputs, int numOutputs, int from, int to)
+{
+    for (int ch = 0; ch < numOutputs; ch++) {
+        auto g = &s->gains[ch];
+        if (g->remaining == 0 && g->gain == 1.0f) {
+            continue; // untouched channel, the common case
+        }
+        switch (format) {
+        case CASIO_SampleFormat_Int32:
+            applyGain((int32_t *)outputs[ch], from, to, g);
+            break;
+        case CASIO_SampleFormat_Float32:
+            applyGain((float *)outputs[ch], from, to, g);
+            break;
+        case CASIO_SampleFormat_Float64:
+            applyGain((double *)outputs[ch], from, to, g);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static void setRamp(OutputGain *g, float target, int fadeSamples)
+{
+    if (fadeSamples <= 0) {
+        g->gain = g->target = target;
+        g->remaining = 0;
+    }
+    else {
+        g->target = target;
+        g->step = (target - g->gain) / fadeSamples;
+        g->remaining = fadeSamples;
+    }
+}
+
+static void startAction(Scheduler *s, const CASIO_ScheduledAction &action, int numOutputs)
+{
+    int first = 0, last = numOutputs - 1;
+    if (action.channel >= 0) {
+        if (action.channel >= numOutputs) {
+            return;
+        }
+        first = last = action.channel;
+    }
+    for (int ch = first; ch <= last; ch++) {
+        auto g = &s->gains[ch];
+        switch (action.type) {
+        case CASIO_Action_OutputStart:
+            g->gain = 0.0f; // always fades in from silence, even if it was already playing
+            setRamp(g, action.gain, action.fadeSamples);
+            break;
+        case CASIO_Action_OutputStop:
+            setRamp(g, 0.0f, action.fadeSamples);
+            break;
+        case CASIO_Action_SetGain:
+            setRamp(g, action.gain, action.fadeSamples);
+            break;
+        default:
+            break; // triggers are handled by the caller, before the client callback
+        }
+    }
+}
+
+//============ scheduling ====================================================
+
+void scheduleReset(Scheduler *s)
+{
+    s->numPending = 0;
+    s->numDue = 0;
+    s->blockStart = s->nextBlockStart = 0;
+    s->position = 0;
+    s->outstanding = 0;
+    for (int i = 0; i < SCHEDULE_MAX_OUTPUTS; i++) {
+        s->gains[i] = { 1.0f, 1.0f, 0.0f, 0 };
+    }
+}
+
+bool schedulePost(Scheduler *s, const CASIO_ScheduledAction &action)
+{
+    if (s->outstanding.fetch_add(1, std::memory_order_acq_rel) >= SCHEDULE_MAX_PENDING) {
+        s->outstanding.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    s->queue.push(action); // (can't fail: the queue holds as many as may be outstanding)
+    return true;
+}
+
+void scheduleBegin(Scheduler *s, uint64_t devicePosition, bool positionValid, int bufferSamples)
+{
+    s->blockStart = positionValid ? devicePosition : s->nextBlockStart;
+    s->nextBlockStart = s->blockStart + bufferSamples;
+    s->position.store(s->blockStart, std::memory_order_relaxed);
+
+    // move newly posted actions into the sorted pending list.
+    // equal positions keep posting order, so eg. a SetGain followed by a Trigger at the same sample stay in that order
+    CASIO_ScheduledAction action;
+    while (s->queue.pop(action)) {
+        int i = s->numPending++;
+        while (i > 0 && s->pending[i - 1].samplePosition > action.samplePosition) {
+            s->pending[i] = s->pending[i - 1];
+            i--;
+        }
+        s->pending[i] = action;
+    }
+
+    s->numDue = 0;
+    while (s->numDue < s->numPending && s->pending[s->numDue].samplePosition < s->nextBlockStart) {
+        s->numDue++;
+    }
+}
+
+void scheduleApply(Scheduler *s, CASIO_SampleFormat format, int bufferSamples, void **outputs, int numOutputs)
+{
+    // split the buffer at each due action's offset, so a change lands on exactly the right sample
+    int pos = 0;
+    int next = 0;
+    while (pos < bufferSamples) {
+        while (next < s->numDue && scheduleOffset(s, s->pending[next]) <= pos) {
+            startAction(s, s->pending[next], numOutputs);
+            next++;
+        }
+        auto end = next < s->numDue ? scheduleOffset(s, s->pending[next]) : bufferSamples;
+        applySegment(s, format, outputs, numOutputs, pos, end);
+        pos = end;
+    }
+
+    // retire, and make room for that many new posts
+    s->numPending -= s->numDue;
+    memmove(s->pending, s->pending + s->numDue, sizeof(CASIO_ScheduledAction) * s->numPending);
+    s->outstanding.fetch_sub(s->numDue, std::memory_order_release);
+    s->numDue = 0;
+}
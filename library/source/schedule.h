@@ -0,0 +1,55 @@
+#pragma once
+
+#include "CASIOClient.h"
+#include "util/lockfree.h"
+
+#include <atomic>
+#include <cstdint>
+
+// sample-accurate scheduled actions, keyed on the device's absolute sample position.
+// control threads post into a lock-free queue, the audio thread moves them into a small sorted pending list
+// and applies whatever falls inside each buffer at its exact offset.
+// a post reserves its place in the pending list up front (scheduleReserve), so an accepted action always runs.
+
+#define SCHEDULE_MAX_PENDING 256
+#define SCHEDULE_QUEUE_SIZE SCHEDULE_MAX_PENDING // (never more queued than can be pending)
+#define SCHEDULE_MAX_OUTPUTS 64
+
+struct OutputGain {
+    float gain; // current
+    float target;
+    float step; // per sample, while ramping
+    int remaining; // samples left in the current ramp
+};
+
+struct Scheduler {
+    BoundedQueue<CASIO_ScheduledAction, SCHEDULE_QUEUE_SIZE> queue;
+    std::atomic<uint64_t> position = 0; // sample position at the start of the most recent buffer
+    std::atomic<int> outstanding = 0; // accepted and not yet retired, queued or pending. at most SCHEDULE_MAX_PENDING
+
+    // audio-thread only
+    CASIO_ScheduledAction pending[SCHEDULE_MAX_PENDING]; // sorted by samplePosition
+    int numPending = 0;
+    int numDue = 0; // leading entries of pending[] that fall inside the current buffer
+    uint64_t blockStart = 0;
+    uint64_t nextBlockStart = 0; // where the next buffer starts if the driver doesn't tell us
+    OutputGain gains[SCHEDULE_MAX_OUTPUTS];
+};
+
+void scheduleReset(Scheduler *s);
+
+// any thread: queue an action, false if SCHEDULE_MAX_PENDING are already waiting to run
+bool schedulePost(Scheduler *s, const CASIO_ScheduledAction &action);
+
+// audio thread, before the client callback: establish this buffer's position and find the actions due inside it.
+// devicePosition/positionValid come from the driver's time info; when it doesn't supply one we count buffers ourselves
+void scheduleBegin(Scheduler *s, uint64_t devicePosition, bool positionValid, int bufferSamples);
+
+// offset of a due action within the current buffer (late actions land at 0)
+inline int scheduleOffset(const Scheduler *s, const CASIO_ScheduledAction &action) {
+    return action.samplePosition > s->blockStart ? (int)(action.samplePosition - s->blockStart) : 0;
+}
+
+// audio thread, after the client callback and before outputReady: run output gain changes/fades
+// at their offsets over the client's output, then retire this buffer's due actions
+void scheduleApply(Scheduler *s, CASIO_SampleFormat format, int bufferSamples, void **outputs, int numOutputs);
@@ -0,0 +1,87 @@
+// client side of a shared device as a device (CASIO_ConnectShared, see shareddevice.h)
+
+#include "engine.h"
+
+#include <cstdio>
+#include <cstring>
+
+static inline SharedClient *clientOf(CASIO_Device device) {
+    return (SharedClient *)device->backendData;
+}
+
+bool sharedBackendOpen(CASIO_Device device, const char *name)
+{
+    auto client = sharedClientConnect(name);
+    if (!client) {
+        logFormat("failed to connect to shared device '%s'", name);
+        return false;
+    }
+    auto h = client->header;
+    device->backendData = client;
+    snprintf(device->name, sizeof(device->name), "%s (shared)", h->name);
+
+    device->numInputs = h->numInputs;
+    device->numOutputs = h->numOutputs;
+    device->buffer.minSize = device->buffer.maxSize = device->buffer.prefSize = device->buffer.currentSize = h->bufferSampleLength;
+    device->buffer.granularity = 0;
+    device->sampleRate = h->sampleRate;
+    device->sampleFormat = (CASIO_SampleFormat)h->sampleFormat;
+    device->sampleSize = sampleFormatSize(device->sampleFormat);
+
+    logFormatDev(device, "connected as client %d", client->slot);
+    return true;
+}
+
+// called on the client thread
+static void processSharedBuffer(void *context, const SharedSlotInfo *info, void **inputs, void **outputs)
+{
+    auto device = (CASIO_Device)context;
+    // the buffers live in shared memory and move around, so just point the device at this round's
+    memcpy(device->bufferPtrs[0].inputs, inputs, sizeof(void *) * device->numInputs);
+    memcpy(device->bufferPtrs[0].outputs, outputs, sizeof(void *) * device->numOutputs);
+
+    CASIO_Event event = {};
+    event.eventType = CASIO_EventType_BufferSwitch;
+    event.handled = false;
+    event.bufferSwitchEvent.time.flags = info->timeFlags;
+    event.bufferSwitchEvent.time.nanoSeconds = info->nanoSeconds;
+    event.bufferSwitchEvent.time.samples = info->samples;
+    event.bufferSwitchEvent.time.tcSamples = info->tcSamples;
+    processBufferSwitch(device, device, &event, 0);
+}
+
+static bool sharedStart(CASIO_Device device)
+{
+    if (!sharedClientStart(clientOf(device), processSharedBuffer, device)) {
+        logFormatDev(device, "failed to start (already running, or evicted)");
+        return false;
+    }
+    return true;
+}
+
+static bool sharedStop(CASIO_Device device)
+{
+    sharedClientStop(clientOf(device));
+    return true;
+}
+
+static void sharedClose(CASIO_Device device)
+{
+    sharedClientDisconnect(clientOf(device));
+    logFormatDev(device, "disconnected");
+}
+
+const HostBackend sharedBackend = {
+    "shared",
+    false,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    sharedClose,
+    sharedStart,
+    sharedStop,
+    nullptr,
+    nullptr,
+    nullptr,
+};
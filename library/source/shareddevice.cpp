@@ -0,0 +1,411 @@
+#include "shareddevice.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#define getCurrentPid() ((uint32_t)GetCurrentProcessId())
+#else
+#include <signal.h>
+#include <unistd.h>
+#define getCurrentPid() ((uint32_t)getpid())
+#endif
+
+#define SHARED_MAX_CHANNELS 64
+#define SHARED_START_GRACE 64 // buffers a started client gets for its first one before misses count (process startup, page faults)
+#define SHARED_WAIT_TIMEOUT_MS 100 // how often a waiting client re-checks whether it should quit
+
+static uint64_t sharedNow() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void signalName(char *out, size_t len, const char *name, int client) {
+    snprintf(out, len, "%s_client%d", name, client);
+}
+
+// (a recycled pid keeps a dead client's slot until that process exits too, which is rare and harmless)
+static bool processAlive(uint32_t pid) {
+#ifdef _WIN32
+    auto process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+    if (!process) {
+        return GetLastError() == ERROR_ACCESS_DENIED;
+    }
+    DWORD code = 0;
+    auto alive = GetExitCodeProcess(process, &code) && code == STILL_ACTIVE;
+    CloseHandle(process);
+    return alive;
+#else
+    return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+// a client that died without disconnecting leaves its slot Paused (or Connected, but those get evicted for missing
+// their buffers). nobody else would ever free it
+static void reclaimDeadSlots(SharedHeader *h) {
+    for (int i = 0; i < CASIO_MAX_SHARED_CLIENTS; i++) {
+        auto c = &h->clients[i];
+        if (c->state.load(std::memory_order_acquire) != SharedClient_Paused || processAlive(c->pid)) {
+            continue;
+        }
+        auto generation = c->generation.load(std::memory_order_acquire);
+        auto expected = (uint32_t)SharedClient_Paused;
+        // (claim it first: between the checks above the slot may have been freed and claimed by a live client)
+        if (c->state.compare_exchange_strong(expected, SharedClient_Claiming, std::memory_order_acq_rel)) {
+            if (c->generation.load(std::memory_order_acquire) == generation && !processAlive(c->pid)) {
+                c->generation.fetch_add(1);
+                c->state.store(SharedClient_Free, std::memory_order_release);
+            }
+            else {
+                c->state.store(SharedClient_Paused, std::memory_order_release);
+            }
+        }
+    }
+}
+
+//============ mixing ========================================================
+
+static void mixInto(CASIO_SampleFormat format, void *dst, const void *src, int n)
+{
+    switch (format) {
+    case CASIO_SampleFormat_Int32:
+    {
+        auto d = (int32_t *)dst;
+        auto s = (const int32_t *)src;
+        for (int i = 0; i < n; i++) {
+            auto sum = (int64_t)d[i] + s[i];
+            d[i] = sum > INT32_MAX ? INT32_MAX : (sum < INT32_MIN ? INT32_MIN : (int32_t)sum);
+        }
+        break;
+    }
+    case CASIO_SampleFormat_Float32:
+    {
+        auto d = (float *)dst;
+        auto s = (const float *)src;
+        for (int i = 0; i < n; i++) {
+            d[i] += s[i];
+        }
+        break;
+    }
+    case CASIO_SampleFormat_Float64:
+    {
+        auto d = (double *)dst;
+        auto s = (const double *)src;
+        for (int i = 0; i < n; i++) {
+            d[i] += s[i];
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+//============ server ========================================================
+
+SharedServer *sharedServerCreate(const char *name, const SharedDeviceInfo *info, int evictAfter)
+{
+    auto headerSize = (sizeof(SharedHeader) + 63) & ~(size_t)63;
+    auto inputsSize = (size_t)SHARED_INPUT_SLOTS * info->numInputs * info->bufferByteLength;
+    auto outputsSize = (size_t)CASIO_MAX_SHARED_CLIENTS * 2 * info->numOutputs * info->bufferByteLength;
+
+    auto server = new SharedServer;
+    if (!shmCreate(&server->shm, name, headerSize + inputsSize + outputsSize)) {
+        delete server;
+        return nullptr;
+    }
+    auto h = new (server->shm.base) SharedHeader();
+    h->version = SHARED_VERSION;
+    h->numInputs = info->numInputs;
+    h->numOutputs = info->numOutputs;
+    h->bufferSampleLength = info->bufferSampleLength;
+    h->bufferByteLength = info->bufferByteLength;
+    h->sampleFormat = info->sampleFormat;
+    h->sampleRate = info->sampleRate;
+    strncpy(h->name, info->name, sizeof(h->name) - 1);
+    h->inputsOffset = headerSize;
+    h->outputsOffset = headerSize + inputsSize;
+    h->seq = 0;
+    h->serverAlive = 1;
+
+    for (int i = 0; i < CASIO_MAX_SHARED_CLIENTS; i++) {
+        char sigName[256];
+        signalName(sigName, sizeof(sigName), name, i);
+        if (!ipcSignalCreate(&server->signals[i], sigName, &h->clients[i].wake)) {
+            for (int j = 0; j < i; j++) {
+                ipcSignalClose(&server->signals[j]);
+            }
+            shmClose(&server->shm, true);
+            delete server;
+            return nullptr;
+        }
+    }
+    server->header = h;
+    server->evictAfter = evictAfter > 0 ? evictAfter : 1;
+
+    // last, so a client never sees a half-initialized header
+    std::atomic_thread_fence(std::memory_order_release);
+    h->magic = SHARED_MAGIC;
+    return server;
+}
+
+void sharedServerDestroy(SharedServer *server)
+{
+    auto h = server->header;
+    h->serverAlive = 0;
+    for (int i = 0; i < CASIO_MAX_SHARED_CLIENTS; i++) {
+        if (h->clients[i].state.load() == SharedClient_Connected) {
+            ipcSignalNotify(&server->signals[i]); // so they notice right away
+        }
+        ipcSignalClose(&server->signals[i]);
+    }
+    shmClose(&server->shm, true);
+    delete server;
+}
+
+void sharedServerPublish(SharedServer *server, const CASIO_Event *bufferSwitch)
+{
+    auto h = server->header;
+    auto &bs = bufferSwitch->bufferSwitchEvent;
+    auto seq = h->seq.load(std::memory_order_relaxed) + 1;
+
+    auto slot = &h->slots[seq % SHARED_INPUT_SLOTS];
+    slot->seq.store(0, std::memory_order_release); // invalid while we overwrite it
+    for (int i = 0; i < h->numInputs; i++) {
+        memcpy(sharedInput(h, seq, i), bs.inputs[i], h->bufferByteLength);
+    }
+    slot->timeFlags = bs.time.flags;
+    slot->nanoSeconds = bs.time.nanoSeconds;
+    slot->samples = bs.time.samples;
+    slot->tcSamples = bs.time.tcSamples;
+    slot->publishedAt = sharedNow();
+    slot->seq.store(seq, std::memory_order_release);
+    h->seq.store(seq, std::memory_order_release);
+
+    for (int i = 0; i < CASIO_MAX_SHARED_CLIENTS; i++) {
+        if (h->clients[i].state.load(std::memory_order_relaxed) == SharedClient_Connected) {
+            ipcSignalNotify(&server->signals[i]);
+        }
+    }
+}
+
+void sharedServerMix(SharedServer *server, void **outputs)
+{
+    auto h = server->header;
+    auto seq = h->seq.load(std::memory_order_relaxed);
+    for (int i = 0; i < CASIO_MAX_SHARED_CLIENTS; i++) {
+        auto c = &h->clients[i];
+        if (c->state.load(std::memory_order_acquire) != SharedClient_Connected) {
+            continue;
+        }
+        auto wanted = seq - 1;
+        auto half = wanted & 1;
+        auto done = c->completedSeq[half].load(std::memory_order_acquire);
+        if (done == 0 && c->completedSeq[half ^ 1].load(std::memory_order_relaxed) == 0 &&
+            (int64_t)(wanted - c->startSeq) < SHARED_START_GRACE) {
+            continue; // just (re)started, hasn't finished its first buffer yet. (one that never does gets evicted all the same)
+        }
+        if (done == wanted) {
+            for (int ch = 0; ch < h->numOutputs; ch++) {
+                mixInto((CASIO_SampleFormat)h->sampleFormat, outputs[ch], sharedOutput(h, i, wanted, ch), h->bufferSampleLength);
+            }
+            auto latency = c->completedAt[half].load(std::memory_order_relaxed) - h->slots[wanted % SHARED_INPUT_SLOTS].publishedAt;
+            c->buffersMixed.fetch_add(1, std::memory_order_relaxed);
+            c->totalLatency.fetch_add(latency, std::memory_order_relaxed);
+            if (latency > c->maxLatency.load(std::memory_order_relaxed)) {
+                c->maxLatency.store(latency, std::memory_order_relaxed);
+            }
+            c->consecutiveMisses = 0;
+        }
+        else {
+            c->buffersMissed.fetch_add(1, std::memory_order_relaxed);
+            if (++c->consecutiveMisses >= (uint32_t)server->evictAfter) {
+                // the client notices the generation change and bows out. the slot is free for somebody else right away
+                c->generation.fetch_add(1);
+                c->completedSeq[0] = c->completedSeq[1] = 0;
+                c->consecutiveMisses = 0;
+                c->state.store(SharedClient_Free, std::memory_order_release);
+                ipcSignalNotify(&server->signals[i]);
+            }
+        }
+    }
+}
+
+void sharedServerGetStats(SharedServer *server, CASIO_SharedClientStats *stats)
+{
+    auto h = server->header;
+    reclaimDeadSlots(h);
+    for (int i = 0; i < CASIO_MAX_SHARED_CLIENTS; i++) {
+        auto c = &h->clients[i];
+        auto mixed = c->buffersMixed.load();
+        auto state = c->state.load();
+        stats[i].connected = state == SharedClient_Connected || state == SharedClient_Paused;
+        stats[i].pid = c->pid;
+        stats[i].buffersMixed = mixed;
+        stats[i].buffersMissed = c->buffersMissed.load();
+        stats[i].averageLatencyNs = mixed ? c->totalLatency.load() / mixed : 0;
+        stats[i].maxLatencyNs = c->maxLatency.load();
+    }
+}
+
+//============ client ========================================================
+
+SharedClient *sharedClientConnect(const char *name)
+{
+    auto client = new SharedClient;
+    if (!shmOpen(&client->shm, name)) {
+        delete client;
+        return nullptr;
+    }
+    auto h = (SharedHeader *)client->shm.base;
+    if (h->magic != SHARED_MAGIC || h->version != SHARED_VERSION || !h->serverAlive.load()) {
+        shmClose(&client->shm, false);
+        delete client;
+        return nullptr;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // claim a slot
+    reclaimDeadSlots(h);
+    int slot = -1;
+    for (int i = 0; i < CASIO_MAX_SHARED_CLIENTS && slot < 0; i++) {
+        auto expected = (uint32_t)SharedClient_Free;
+        auto c = &h->clients[i];
+        if (c->state.compare_exchange_strong(expected, SharedClient_Claiming)) {
+            // the server ignores the slot until it's Connected, so the bookkeeping can be reset safely
+            c->completedSeq[0] = c->completedSeq[1] = 0;
+            c->buffersMixed = 0;
+            c->buffersMissed = 0;
+            c->totalLatency = 0;
+            c->maxLatency = 0;
+            c->pid = getCurrentPid();
+            client->generation = c->generation.fetch_add(1) + 1;
+            c->state.store(SharedClient_Paused, std::memory_order_release);
+            slot = i;
+        }
+    }
+    if (slot < 0) {
+        shmClose(&client->shm, false);
+        delete client;
+        return nullptr;
+    }
+
+    char sigName[256];
+    signalName(sigName, sizeof(sigName), name, slot);
+    if (!ipcSignalOpen(&client->signal, sigName, &h->clients[slot].wake)) {
+        h->clients[slot].state = SharedClient_Free;
+        shmClose(&client->shm, false);
+        delete client;
+        return nullptr;
+    }
+    client->header = h;
+    client->slot = slot;
+    client->running = false;
+    client->evicted = false;
+    return client;
+}
+
+static bool stillOurs(SharedClient *client)
+{
+    auto c = &client->header->clients[client->slot];
+    auto state = c->state.load(std::memory_order_acquire);
+    return (state == SharedClient_Connected || state == SharedClient_Paused) &&
+        c->generation.load(std::memory_order_acquire) == client->generation;
+}
+
+static void clientThreadProc(SharedClient *client, SharedProcessFunc process, void *context)
+{
+    auto h = client->header;
+    auto c = &h->clients[client->slot];
+    void *inputs[SHARED_MAX_CHANNELS];
+    void *outputs[SHARED_MAX_CHANNELS];
+    auto lastSeq = h->seq.load();
+
+    while (client->running.load()) {
+        auto ticket = ipcSignalPrepare(&client->signal);
+        if (!h->serverAlive.load() || !stillOurs(client)) {
+            client->evicted = true;
+            break;
+        }
+        auto seq = h->seq.load(std::memory_order_acquire);
+        if (seq == lastSeq) {
+            ipcSignalWait(&client->signal, ticket, SHARED_WAIT_TIMEOUT_MS);
+            continue;
+        }
+        // always jump to the newest buffer, there's no use working on ones the server has already given up on
+        lastSeq = seq;
+        auto info = &h->slots[seq % SHARED_INPUT_SLOTS];
+        if (info->seq.load(std::memory_order_acquire) != seq) {
+            continue;
+        }
+        for (int i = 0; i < h->numInputs; i++) {
+            inputs[i] = sharedInput(h, seq, i);
+        }
+        for (int i = 0; i < h->numOutputs; i++) {
+            outputs[i] = sharedOutput(h, client->slot, seq, i);
+            memset(outputs[i], 0, h->bufferByteLength); // whatever the client doesn't write gets mixed as silence, not stale audio
+        }
+        process(context, info, inputs, outputs);
+
+        if (!stillOurs(client)) {
+            client->evicted = true; // evicted while processing, the slot may already be somebody else's
+            break;
+        }
+        if (h->seq.load(std::memory_order_acquire) - seq >= SHARED_INPUT_SLOTS) {
+            continue; // took so long the inputs were overwritten underneath us, don't hand in garbage
+        }
+        c->completedAt[seq & 1].store(sharedNow(), std::memory_order_relaxed);
+        c->completedSeq[seq & 1].store(seq, std::memory_order_release);
+    }
+}
+
+bool sharedClientStart(SharedClient *client, SharedProcessFunc process, void *context)
+{
+    if (client->running || !stillOurs(client)) {
+        return false;
+    }
+    // the server skips paused slots, so the completions of an earlier run can be cleared without racing it.
+    // that makes the server treat us as not started until the first buffer is done (for SHARED_START_GRACE buffers at most)
+    auto c = &client->header->clients[client->slot];
+    c->completedSeq[0] = c->completedSeq[1] = 0;
+    c->consecutiveMisses = 0;
+    c->startSeq = client->header->seq.load(std::memory_order_acquire);
+    auto expected = (uint32_t)SharedClient_Paused;
+    if (!c->state.compare_exchange_strong(expected, SharedClient_Connected, std::memory_order_acq_rel)) {
+        return false;
+    }
+    client->running = true;
+    client->thread = std::thread(clientThreadProc, client, process, context);
+    return true;
+}
+
+void sharedClientStop(SharedClient *client)
+{
+    if (client->thread.joinable()) {
+        // pause before the thread stops handing in buffers, or the server counts the gap as misses and evicts us
+        auto c = &client->header->clients[client->slot];
+        auto expected = (uint32_t)SharedClient_Connected;
+        c->state.compare_exchange_strong(expected, SharedClient_Paused, std::memory_order_acq_rel); // (fails if evicted meanwhile)
+        client->running = false;
+        ipcSignalNotify(&client->signal); // wake it if it's waiting
+        client->thread.join();
+    }
+}
+
+void sharedClientDisconnect(SharedClient *client)
+{
+    sharedClientStop(client);
+    if (stillOurs(client)) {
+        auto c = &client->header->clients[client->slot];
+        c->generation.fetch_add(1);
+        c->state.store(SharedClient_Free, std::memory_order_release);
+    }
+    ipcSignalClose(&client->signal);
+    shmClose(&client->shm, false);
+    delete client;
+}
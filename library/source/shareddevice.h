@@ -0,0 +1,126 @@
+#pragma once
+
+#include "CASIOClient.h"
+#include "util/ipc.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// one process owns the device and serves it to others over shared memory.
+//
+// every buffer the server copies the device inputs into a small ring in shared memory and wakes the clients.
+// each client processes that buffer in its own process and writes into its private output slot; the server
+// mixes the output of every client that has finished the *previous* buffer into the device outputs before outputReady.
+// so remote clients always run exactly one buffer behind the device (in exchange, the server never waits on anybody).
+// clients that keep missing that deadline get evicted. a stopped client is paused: skipped, not evicted.
+//
+// layout: SharedHeader | input ring [SHARED_INPUT_SLOTS][numInputs][bufferByteLength]
+//                      | client outputs [CASIO_MAX_SHARED_CLIENTS][2][numOutputs][bufferByteLength]
+
+#define SHARED_MAGIC 0x4F495341 // 'ASIO'
+#define SHARED_VERSION 2
+#define SHARED_INPUT_SLOTS 4
+
+enum SharedClientState : uint32_t {
+    SharedClient_Free = 0,
+    SharedClient_Claiming, // a client is setting the slot up
+    SharedClient_Paused, // connected but not started (or stopped): the server skips it, it's only reclaimed once its process is gone
+    SharedClient_Connected // started, mixed and held to the deadline
+};
+
+struct SharedSlotInfo {
+    std::atomic<uint64_t> seq; // which buffer this slot currently holds
+    uint32_t timeFlags;
+    uint64_t nanoSeconds, samples, tcSamples;
+    uint64_t publishedAt; // steady clock ns, for latency accounting
+};
+
+struct SharedClientSlot {
+    std::atomic<uint32_t> state; // SharedClientState
+    std::atomic<uint32_t> generation; // bumped on every claim/eviction, so a stale client can tell it lost the slot
+    std::atomic<uint32_t> wake; // signal word
+    uint32_t pid;
+    uint64_t startSeq; // the newest buffer when the client started, misses before its first buffer count from there
+    std::atomic<uint64_t> completedSeq[2]; // which buffer's outputs are complete in each output half (seq & 1)
+    std::atomic<uint64_t> completedAt[2];
+
+    // accounting, written by the server only
+    std::atomic<uint64_t> buffersMixed, buffersMissed;
+    std::atomic<uint64_t> totalLatency, maxLatency; // ns, from publish to completion
+    uint32_t consecutiveMisses; // (reset by the client too, while Paused)
+};
+
+struct SharedHeader {
+    uint32_t magic, version;
+    int32_t numInputs, numOutputs;
+    int32_t bufferSampleLength, bufferByteLength;
+    int32_t sampleFormat;
+    double sampleRate;
+    char name[128];
+    uint64_t inputsOffset, outputsOffset;
+
+    std::atomic<uint32_t> serverAlive;
+    std::atomic<uint64_t> seq; // last published buffer, starts at 1
+    SharedSlotInfo slots[SHARED_INPUT_SLOTS];
+    SharedClientSlot clients[CASIO_MAX_SHARED_CLIENTS];
+};
+
+struct SharedDeviceInfo {
+    int numInputs, numOutputs;
+    int bufferSampleLength, bufferByteLength;
+    CASIO_SampleFormat sampleFormat;
+    double sampleRate;
+    const char *name;
+};
+
+inline void *sharedInput(SharedHeader *h, uint64_t seq, int channel) {
+    return (uint8_t *)h + h->inputsOffset +
+        ((seq % SHARED_INPUT_SLOTS) * h->numInputs + channel) * (size_t)h->bufferByteLength;
+}
+inline void *sharedOutput(SharedHeader *h, int client, uint64_t seq, int channel) {
+    return (uint8_t *)h + h->outputsOffset +
+        (((size_t)client * 2 + (seq & 1)) * h->numOutputs + channel) * (size_t)h->bufferByteLength;
+}
+
+//============ server ========================================================
+
+struct SharedServer {
+    SharedMemory shm;
+    SharedHeader *header;
+    IpcSignal signals[CASIO_MAX_SHARED_CLIENTS];
+    int evictAfter; // consecutive missed buffers
+};
+
+SharedServer *sharedServerCreate(const char *name, const SharedDeviceInfo *info, int evictAfter);
+void sharedServerDestroy(SharedServer *server);
+
+// audio thread, before the local client callback: publish this buffer's inputs and wake everybody
+void sharedServerPublish(SharedServer *server, const CASIO_Event *bufferSwitch);
+// audio thread, after the local client callback: mix in whatever the remote clients finished in time
+void sharedServerMix(SharedServer *server, void **outputs);
+
+// (also frees the paused slots of clients whose process has died)
+void sharedServerGetStats(SharedServer *server, CASIO_SharedClientStats *stats);
+
+//============ client ========================================================
+
+// called on the client's thread for every buffer it gets to. inputs/outputs point straight into shared memory
+typedef void (*SharedProcessFunc)(void *context, const SharedSlotInfo *info, void **inputs, void **outputs);
+
+struct SharedClient {
+    SharedMemory shm;
+    SharedHeader *header;
+    IpcSignal signal;
+    int slot;
+    uint32_t generation;
+    std::thread thread;
+    std::atomic<bool> running;
+    std::atomic<bool> evicted;
+};
+
+SharedClient *sharedClientConnect(const char *name);
+void sharedClientDisconnect(SharedClient *client);
+
+bool sharedClientStart(SharedClient *client, SharedProcessFunc process, void *context);
+void sharedClientStop(SharedClient *client);
@@ -0,0 +1,136 @@
+#include "silence.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SILENCE_SSE2
+#include <emmintrin.h>
+#endif
+
+// how many samples to test between early-exit checks (4 vectors)
+#define SILENCE_BLOCK 16
+
+//============ kernels =======================================================
+
+static bool int32HasSignal(const int32_t *src, int n, float threshold)
+{
+    auto scaled = std::fmin((double)threshold * 2147483648.0, 2147483647.0);
+    auto t = (int32_t)scaled;
+    int i = 0;
+#ifdef SILENCE_SSE2
+    const __m128i hi = _mm_set1_epi32(t);
+    const __m128i lo = _mm_set1_epi32(-t);
+    for (; i + SILENCE_BLOCK <= n; i += SILENCE_BLOCK) {
+        auto any = _mm_setzero_si128();
+        for (int j = 0; j < SILENCE_BLOCK; j += 4) {
+            auto x = _mm_loadu_si128((const __m128i *)(src + i + j));
+            any = _mm_or_si128(any, _mm_or_si128(_mm_cmpgt_epi32(x, hi), _mm_cmplt_epi32(x, lo)));
+        }
+        if (_mm_movemask_epi8(any)) {
+            return true;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (src[i] > t || src[i] < -t) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool float32HasSignal(const float *src, int n, float threshold)
+{
+    int i = 0;
+#ifdef SILENCE_SSE2
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    const __m128 t = _mm_set1_ps(threshold);
+    for (; i + SILENCE_BLOCK <= n; i += SILENCE_BLOCK) {
+        auto any = _mm_setzero_ps();
+        for (int j = 0; j < SILENCE_BLOCK; j += 4) {
+            auto a = _mm_and_ps(_mm_loadu_ps(src + i + j), absMask);
+            any = _mm_or_ps(any, _mm_cmpgt_ps(a, t));
+        }
+        if (_mm_movemask_ps(any)) {
+            return true;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (std::fabs(src[i]) > threshold) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool float64HasSignal(const double *src, int n, float threshold)
+{
+    int i = 0;
+#ifdef SILENCE_SSE2
+    const __m128d absMask = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+    const __m128d t = _mm_set1_pd(threshold);
+    for (; i + SILENCE_BLOCK <= n; i += SILENCE_BLOCK) {
+        auto any = _mm_setzero_pd();
+        for (int j = 0; j < SILENCE_BLOCK; j += 2) {
+            auto a = _mm_and_pd(_mm_loadu_pd(src + i + j), absMask);
+            any = _mm_or_pd(any, _mm_cmpgt_pd(a, t));
+        }
+        if (_mm_movemask_pd(any)) {
+            return true;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (std::fabs(src[i]) > threshold) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool silenceChannelHasSignal(CASIO_SampleFormat format, const void *buffer, int numSamples, float threshold)
+{
+    switch (format) {
+    case CASIO_SampleFormat_Int32:
+        return int32HasSignal((const int32_t *)buffer, numSamples, threshold);
+    case CASIO_SampleFormat_Float32:
+        return float32HasSignal((const float *)buffer, numSamples, threshold);
+    case CASIO_SampleFormat_Float64:
+        return float64HasSignal((const double *)buffer, numSamples, threshold);
+    default:
+        return true; // can't tell, so don't let anybody skip it
+    }
+}
+
+//============ detector ======================================================
+
+void silenceReset(SilenceDetector *det)
+{
+    // channels start out active, and have to earn their way to silent
+    memset(det->silentSamples, 0, sizeof(det->silentSamples));
+}
+
+uint64_t silenceProcess(SilenceDetector *det, CASIO_SampleFormat format, int bufferSamples, void **inputs, int numInputs)
+{
+    if (!det->enabled.load(std::memory_order_relaxed)) {
+        return allChannelsMask(numInputs);
+    }
+    auto threshold = det->threshold.load(std::memory_order_relaxed);
+    auto holdSamples = det->holdSamples.load(std::memory_order_relaxed);
+
+    uint64_t mask = 0;
+    for (int i = 0; i < numInputs; i++) {
+        if (silenceChannelHasSignal(format, inputs[i], bufferSamples, threshold)) {
+            det->silentSamples[i] = 0;
+        }
+        else if (det->silentSamples[i] <= holdSamples) {
+            det->silentSamples[i] += bufferSamples; // stops counting once past the hold, no need to go further
+        }
+        if (det->silentSamples[i] <= holdSamples) {
+            mask |= 1ULL << i;
+        }
+    }
+    return mask;
+}
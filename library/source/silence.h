@@ -0,0 +1,34 @@
+#pragma once
+
+#include "CASIOClient.h"
+
+#include <atomic>
+#include <cstdint>
+
+// cheap per-channel silence detection for inputs, run on the audio thread right after capture.
+// a channel counts as active while it has had any sample above the threshold within the hold time;
+// everything downstream (metering, client processing, ...) can then skip the channels that aren't.
+
+#define SILENCE_MAX_CHANNELS 64
+
+struct SilenceDetector {
+    std::atomic<bool> enabled = false;
+    std::atomic<float> threshold = 0.0f; // normalized to full scale, 0 = digital silence only
+    std::atomic<int64_t> holdSamples = 0;
+
+    // audio-thread only
+    int64_t silentSamples[SILENCE_MAX_CHANNELS]; // consecutive samples below threshold, per channel
+};
+
+void silenceReset(SilenceDetector *det);
+
+// audio thread: returns a bitmask of active channels (bit i = input i).
+// with detection disabled every opened channel is reported active
+uint64_t silenceProcess(SilenceDetector *det, CASIO_SampleFormat format, int bufferSamples, void **inputs, int numInputs);
+
+// true if any sample in the buffer exceeds the threshold. stops scanning at the first one that does
+bool silenceChannelHasSignal(CASIO_SampleFormat format, const void *buffer, int numSamples, float threshold);
+
+inline uint64_t allChannelsMask(int numChannels) {
+    return numChannels >= 64 ? ~0ULL : ((1ULL << numChannels) - 1);
+}
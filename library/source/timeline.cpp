@@ -0,0 +1,183 @@
+#include "timeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+struct TimelineRecord {
+    const char *name;
+    uint64_t start, end;
+    char detail[TIMELINE_DETAIL_LENGTH];
+};
+
+struct TimelineRing {
+    TimelineRecord *records;
+    std::atomic<uint64_t> written; // total ever written, the ring keeps the last ringSize of them
+};
+
+std::atomic<bool> timelineEnabled = false;
+
+static TimelineRing rings[TIMELINE_MAX_THREADS];
+static std::atomic<int> ringSize = 0; // published (release) after the records are allocated, 0 = not yet
+static std::mutex enableLock;
+static std::atomic<uint64_t> ringsInUse = 0; // bit per ring, claimed by a live thread
+static std::atomic<int> ringsUsed = 0; // rings ever claimed, the ones export looks at
+static_assert(TIMELINE_MAX_THREADS <= 64, "ringsInUse is a 64-bit mask");
+
+// a thread's ring, handed back when the thread exits so a later thread can carry on in it
+struct ThreadRing {
+    int index = -1; // -2 = all rings were taken, this thread isn't recorded
+    ~ThreadRing() {
+        if (index >= 0) {
+            ringsInUse.fetch_and(~(1ULL << index), std::memory_order_release);
+        }
+    }
+};
+static thread_local ThreadRing threadRing;
+
+static int claimRing()
+{
+    auto inUse = ringsInUse.load(std::memory_order_relaxed);
+    for (;;) {
+        int index = 0;
+        while (index < TIMELINE_MAX_THREADS && (inUse & (1ULL << index))) {
+            index++;
+        }
+        if (index == TIMELINE_MAX_THREADS) {
+            return -2;
+        }
+        if (ringsInUse.compare_exchange_weak(inUse, inUse | (1ULL << index), std::memory_order_acquire)) {
+            auto used = ringsUsed.load(std::memory_order_relaxed);
+            while (used < index + 1 && !ringsUsed.compare_exchange_weak(used, index + 1)) {
+            }
+            return index;
+        }
+    }
+}
+
+uint64_t timelineNow()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool timelineEnable(bool enable, int spansPerThread)
+{
+    std::lock_guard lock(enableLock);
+    if (enable && ringSize.load(std::memory_order_relaxed) == 0) {
+        auto size = spansPerThread > 0 ? spansPerThread : TIMELINE_DEFAULT_SPANS;
+        for (auto &ring : rings) {
+            ring.records = new TimelineRecord[size];
+            ring.written = 0;
+        }
+        ringSize.store(size, std::memory_order_release);
+    }
+    timelineEnabled.store(enable, std::memory_order_release);
+    return true;
+}
+
+void timelineEnd(const char *name, const char *detail, uint64_t start)
+{
+    if (start == 0 || !timelineEnabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    // the enabled flag is only a hint, the acquire on ringSize is what makes the records safe to touch
+    auto size = ringSize.load(std::memory_order_acquire);
+    if (size == 0) {
+        return;
+    }
+    auto end = timelineNow();
+    if (threadRing.index == -1) {
+        threadRing.index = claimRing();
+    }
+    if (threadRing.index < 0) {
+        return;
+    }
+    // single writer per ring, so no CAS needed
+    auto ring = &rings[threadRing.index];
+    auto n = ring->written.load(std::memory_order_relaxed);
+    auto record = &ring->records[n % size];
+    record->name = name;
+    record->start = start;
+    record->end = end;
+    if (detail) {
+        strncpy(record->detail, detail, TIMELINE_DETAIL_LENGTH - 1);
+        record->detail[TIMELINE_DETAIL_LENGTH - 1] = 0;
+    }
+    else {
+        record->detail[0] = 0;
+    }
+    ring->written.store(n + 1, std::memory_order_release);
+}
+
+static void writeJsonString(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        auto c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(f, "\\%c", c);
+        }
+        else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        }
+        else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+bool timelineExport(const char *path)
+{
+    uint64_t size = ringSize.load(std::memory_order_acquire);
+    if (size == 0) {
+        return false;
+    }
+    auto f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+
+    // spans still being written while we export may come out torn. export after stopping if that matters
+    auto numRings = ringsUsed.load(std::memory_order_acquire);
+
+    // timestamps relative to the earliest surviving span, so the viewer doesn't start at system boot. that's not
+    // necessarily a ring's oldest record: enclosing spans are recorded after the spans inside them
+    uint64_t written[TIMELINE_MAX_THREADS];
+    uint64_t origin = UINT64_MAX;
+    for (int t = 0; t < numRings; t++) {
+        written[t] = rings[t].written.load(std::memory_order_acquire);
+        for (auto i = written[t] > size ? written[t] - size : 0; i < written[t]; i++) {
+            origin = std::min(origin, rings[t].records[i % size].start);
+        }
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    for (int t = 0; t < numRings; t++) {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}", first ? "" : ",\n", t, t);
+        first = false;
+
+        auto from = written[t] > size ? written[t] - size : 0;
+        for (auto i = from; i < written[t]; i++) {
+            auto &record = rings[t].records[i % size];
+            fprintf(f, ",\n{\"name\":");
+            writeJsonString(f, record.name);
+            fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", t,
+                // (signed: a record torn by a thread still writing may hold anything)
+                (int64_t)(record.start - origin) / 1000.0, (int64_t)(record.end - record.start) / 1000.0);
+            if (record.detail[0]) {
+                fprintf(f, ",\"args\":{\"device\":");
+                writeJsonString(f, record.detail);
+                fputc('}', f);
+            }
+            fputc('}', f);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// opt-in timeline of what every thread in the library is doing and when: per-thread fixed-size rings of
+// timestamped spans, written without locks or allocation, exported to Chrome trace event JSON on demand.
+// (that format also loads directly in the Perfetto UI)
+//
+// rings are allocated on the first enable and kept for the life of the process, since driver threads
+// may still be holding on to theirs. a thread claims a ring the first time it records a span and hands it
+// back when it exits, so at most TIMELINE_MAX_THREADS threads are recorded at the same time (spans from
+// threads beyond that are dropped). a ring reused by a later thread keeps the earlier thread's spans.
+
+#define TIMELINE_MAX_THREADS 64
+#define TIMELINE_DETAIL_LENGTH 32
+#define TIMELINE_DEFAULT_SPANS 65536
+
+extern std::atomic<bool> timelineEnabled;
+
+bool timelineEnable(bool enable, int spansPerThread);
+bool timelineExport(const char *path);
+
+uint64_t timelineNow();
+
+// name must be a string literal (or otherwise live forever), detail is copied
+void timelineEnd(const char *name, const char *detail, uint64_t start);
+
+// returns 0 when the timeline is off, which makes the matching timelineEnd() a no-op
+inline uint64_t timelineBegin() {
+    return timelineEnabled.load(std::memory_order_relaxed) ? timelineNow() : 0;
+}
+
+// scoped version, for places without gotos jumping over it
+struct TimelineSpan {
+    const char *name;
+    const char *detail;
+    uint64_t start;
+
+    TimelineSpan(const char *name, const char *detail) : name(name), detail(detail), start(timelineBegin()) {}
+    ~TimelineSpan() { timelineEnd(name, detail, start); }
+};
+
+#define TIMELINE_CONCAT2(a, b) a##b
+#define TIMELINE_CONCAT(a, b) TIMELINE_CONCAT2(a, b)
+#define TIMELINE_SPAN(name, detail) TimelineSpan TIMELINE_CONCAT(timelineSpan_, __LINE__)(name, detail)
@@ -0,0 +1,185 @@
+// recorded traces as devices (CASIO_OpenTrace): the file-driven backend
+
+#include "engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+// backendData of a trace device
+struct TraceDevice {
+    TraceReader *reader;
+    std::thread thread; // while started
+    std::atomic<bool> stopping = false;
+};
+
+bool traceBackendOpen(CASIO_Device device, const char *path)
+{
+    auto reader = traceReaderOpen(path);
+    if (!reader) {
+        logFormat("failed to open trace %s", path);
+        return false;
+    }
+    auto &props = reader->props;
+    // the replay buffers are sized from the format, the records from bufferByteLength: they have to agree
+    auto format = (CASIO_SampleFormat)props.sampleFormat;
+    if (sampleFormatSize(format) == 0 || props.bufferByteLength != props.bufferSampleLength * sampleFormatSize(format)) {
+        logFormat("trace %s has inconsistent properties (format %d, %d samples / %d bytes)", path,
+            props.sampleFormat, props.bufferSampleLength, props.bufferByteLength);
+        traceReaderClose(reader);
+        return false;
+    }
+
+    snprintf(device->name, sizeof(device->name), "%s (trace)", props.name);
+    device->numInputs = std::min((long)props.numInputs, (long)MAX_INPUT_CHANNELS);
+    device->numOutputs = std::min((long)props.numOutputs, (long)MAX_OUTPUT_CHANNELS);
+    device->buffer.minSize = device->buffer.maxSize = device->buffer.prefSize = device->buffer.currentSize = props.bufferSampleLength;
+    device->buffer.granularity = 0;
+    device->sampleRate = props.sampleRate;
+    device->inputLatency = props.inputLatency;
+    device->outputLatency = props.outputLatency;
+    device->sampleFormat = format;
+    device->sampleSize = sampleFormatSize(device->sampleFormat);
+    engineAllocateBuffers(device);
+
+    auto trace = new TraceDevice;
+    trace->reader = reader;
+    device->backendData = trace;
+
+    logFormatDev(device, "trace opened: %ld in / %ld out, %ld samples @ %.2f",
+        device->numInputs, device->numOutputs, device->buffer.currentSize, device->sampleRate);
+    return true;
+}
+
+static void traceReplay(CASIO_Device device, bool realtime)
+{
+    auto trace = (TraceDevice *)device->backendData;
+    auto reader = trace->reader;
+    auto bufferByteLength = reader->props.bufferByteLength;
+    auto start = std::chrono::steady_clock::now();
+    long doubleBufferIndex = 0;
+    int count = 0, invalid = 0;
+
+    traceReaderRewind(reader);
+    TraceRecordHeader header;
+    std::vector<uint8_t> payload;
+    while (!trace->stopping.load(std::memory_order_relaxed) && traceReadRecord(reader, &header, payload)) {
+        if (realtime) {
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(header.timestamp));
+        }
+        if (!traceRecordValid(reader, &header, payload)) {
+            invalid++; // (a damaged record, the next one still starts where its length says)
+            continue;
+        }
+        switch (header.type) {
+        case TraceRecord_BufferSwitch:
+        {
+            TraceBufferSwitch body;
+            memcpy(&body, payload.data(), sizeof(body));
+            auto src = payload.data() + sizeof(body);
+            for (int i = 0; i < device->numInputs; i++) {
+                auto dst = device->bufferPtrs[doubleBufferIndex].inputs[i];
+                if (body.storedInputs & (1ULL << i)) {
+                    memcpy(dst, src, bufferByteLength);
+                    src += bufferByteLength;
+                }
+                else {
+                    memset(dst, 0, bufferByteLength);
+                }
+            }
+            CASIO_Event event = {};
+            event.eventType = CASIO_EventType_BufferSwitch;
+            event.handled = false;
+            event.bufferSwitchEvent.time.flags = body.timeFlags;
+            event.bufferSwitchEvent.time.nanoSeconds = body.nanoSeconds;
+            event.bufferSwitchEvent.time.samples = body.samples;
+            event.bufferSwitchEvent.time.tcSamples = body.tcSamples;
+            processBufferSwitch(device, device, &event, doubleBufferIndex);
+            doubleBufferIndex ^= 1;
+            count++;
+            break;
+        }
+        case TraceRecord_AsioMessage:
+        {
+            TraceAsioMessage body;
+            memcpy(&body, payload.data(), sizeof(body));
+            engineHostMessage(device, body.selector, body.value);
+            break;
+        }
+        case TraceRecord_SampleRateChanged:
+        {
+            TraceSampleRate body;
+            memcpy(&body, payload.data(), sizeof(body));
+            if (body.sampleRate > 0) {
+                device->sampleRate = body.sampleRate;
+            }
+            engineSampleRateChanged(device, body.sampleRate);
+            break;
+        }
+        default:
+            break; // unknown record from a newer version, skip it
+        }
+    }
+    if (invalid) {
+        logFormatDev(device, "replay finished, %d buffers (%d damaged records skipped)", count, invalid);
+    }
+    else {
+        logFormatDev(device, "replay finished, %d buffers", count);
+    }
+}
+
+bool traceBackendReplay(CASIO_Device device, bool realtime)
+{
+    if (device->started) {
+        logFormatDev(device, "already replaying, stop it first");
+        return false;
+    }
+    traceReplay(device, realtime);
+    return true;
+}
+
+static bool traceStart(CASIO_Device device)
+{
+    auto trace = (TraceDevice *)device->backendData;
+    trace->stopping = false;
+    trace->thread = std::thread(traceReplay, device, true);
+    return true;
+}
+
+static bool traceStop(CASIO_Device device)
+{
+    auto trace = (TraceDevice *)device->backendData;
+    trace->stopping = true;
+    if (trace->thread.joinable()) {
+        trace->thread.join();
+    }
+    return true;
+}
+
+static void traceClose(CASIO_Device device)
+{
+    auto trace = (TraceDevice *)device->backendData;
+    if (trace->thread.joinable()) {
+        traceStop(device);
+    }
+    traceReaderClose(trace->reader);
+    delete trace;
+    logFormatDev(device, "trace closed");
+}
+
+const HostBackend traceBackend = {
+    "trace",
+    false,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    traceClose,
+    traceStart,
+    traceStop,
+    nullptr,
+    nullptr,
+    nullptr,
+};
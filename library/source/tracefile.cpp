@@ -0,0 +1,239 @@
+#include "tracefile.h"
+#include "silence.h"
+
+#include <bit>
+#include <cstring>
+
+#define TRACE_MIN_RING_BYTES (4 * 1024 * 1024)
+#define TRACE_RING_SECONDS 2
+#define TRACE_COPY_CHUNK (64 * 1024)
+
+static uint64_t traceNow(TraceWriter *w) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - w->start).count();
+}
+
+//============ writer ========================================================
+
+static void writerThreadProc(TraceWriter *w)
+{
+    // merges the two sources back into timestamp order as it goes.
+    // (each is already in order by itself, so holding one record from each is enough)
+    auto chunk = new uint8_t[TRACE_COPY_CHUNK];
+    TraceEventRecord event;
+    bool haveEvent = false;
+    TraceRecordHeader header;
+    bool haveHeader = false;
+    while (true) {
+        if (!haveEvent) {
+            haveEvent = w->events.pop(event);
+        }
+        if (!haveHeader && w->ring->readable() > 0) {
+            // records are published whole, so the payload is guaranteed to be there too
+            w->ring->read(&header, sizeof(header));
+            haveHeader = true;
+        }
+        if (!haveEvent && !haveHeader) {
+            if (!w->running.load()) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            continue;
+        }
+        if (haveEvent && (!haveHeader || event.header.timestamp <= header.timestamp)) {
+            fwrite(&event.header, sizeof(event.header), 1, w->file);
+            fwrite(&event.asioMessage, event.header.length, 1, w->file); // (union, same address for either)
+            haveEvent = false;
+            continue;
+        }
+        fwrite(&header, sizeof(header), 1, w->file);
+        for (uint32_t remaining = header.length; remaining > 0; ) {
+            auto n = w->ring->read(chunk, remaining < TRACE_COPY_CHUNK ? remaining : TRACE_COPY_CHUNK);
+            fwrite(chunk, n, 1, w->file);
+            remaining -= (uint32_t)n;
+        }
+        haveHeader = false;
+    }
+    delete[] chunk;
+}
+
+TraceWriter *traceWriterOpen(const char *path, const TraceProperties *props, bool skipSilentInputs)
+{
+    auto file = fopen(path, "wb");
+    if (!file) {
+        return nullptr;
+    }
+    uint32_t version = TRACE_VERSION;
+    fwrite(TRACE_MAGIC, 8, 1, file);
+    fwrite(&version, sizeof(version), 1, file);
+    fwrite(props, sizeof(TraceProperties), 1, file);
+
+    // enough to ride out a couple of seconds of disk stall with every input stored
+    auto bytesPerSecond = (size_t)(props->sampleRate * props->numInputs * props->bufferByteLength / props->bufferSampleLength);
+    auto ringBytes = bytesPerSecond * TRACE_RING_SECONDS;
+    if (ringBytes < TRACE_MIN_RING_BYTES) {
+        ringBytes = TRACE_MIN_RING_BYTES;
+    }
+
+    auto w = new TraceWriter;
+    w->file = file;
+    w->ring = new ByteRing(ringBytes);
+    w->skipSilentInputs = skipSilentInputs;
+    w->numInputs = props->numInputs;
+    w->bufferByteLength = props->bufferByteLength;
+    w->start = std::chrono::steady_clock::now();
+    w->running = true;
+    w->dropped = 0;
+    w->thread = std::thread(writerThreadProc, w);
+    return w;
+}
+
+unsigned int traceWriterClose(TraceWriter *w)
+{
+    w->running = false;
+    w->thread.join();
+    fclose(w->file);
+    auto dropped = w->dropped.load();
+    delete w->ring;
+    delete w;
+    return dropped;
+}
+
+void traceWriteBufferSwitch(TraceWriter *w, const CASIO_Event *event)
+{
+    auto &bs = event->bufferSwitchEvent;
+
+    TraceBufferSwitch body = {};
+    body.timeFlags = bs.time.flags;
+    body.nanoSeconds = bs.time.nanoSeconds;
+    body.samples = bs.time.samples;
+    body.tcSamples = bs.time.tcSamples;
+    body.activeInputs = bs.activeInputs;
+    body.storedInputs = allChannelsMask(w->numInputs);
+    if (w->skipSilentInputs) {
+        body.storedInputs &= bs.activeInputs;
+    }
+
+    TraceRecordHeader header;
+    header.type = TraceRecord_BufferSwitch;
+    header.length = (uint32_t)(sizeof(body) + std::popcount(body.storedInputs) * (size_t)w->bufferByteLength);
+    header.timestamp = traceNow(w);
+
+    if (w->ring->writable() < sizeof(header) + header.length) {
+        w->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    w->ring->stage(&header, sizeof(header));
+    w->ring->stage(&body, sizeof(body));
+    for (int i = 0; i < w->numInputs; i++) {
+        if (body.storedInputs & (1ULL << i)) {
+            w->ring->stage(bs.inputs[i], w->bufferByteLength);
+        }
+    }
+    w->ring->publish();
+}
+
+void traceWriteAsioMessage(TraceWriter *w, long selector, long value)
+{
+    TraceEventRecord record;
+    record.header.type = TraceRecord_AsioMessage;
+    record.header.length = sizeof(TraceAsioMessage);
+    record.header.timestamp = traceNow(w);
+    record.asioMessage.selector = (int32_t)selector;
+    record.asioMessage.value = (int32_t)value;
+    if (!w->events.push(record)) {
+        w->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void traceWriteSampleRate(TraceWriter *w, double sampleRate)
+{
+    TraceEventRecord record;
+    record.header.type = TraceRecord_SampleRateChanged;
+    record.header.length = sizeof(TraceSampleRate);
+    record.header.timestamp = traceNow(w);
+    record.sampleRate.sampleRate = sampleRate;
+    if (!w->events.push(record)) {
+        w->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+//============ reader ========================================================
+
+TraceReader *traceReaderOpen(const char *path)
+{
+    auto file = fopen(path, "rb");
+    if (!file) {
+        return nullptr;
+    }
+    char magic[8];
+    uint32_t version;
+    TraceProperties props;
+    if (fread(magic, 8, 1, file) != 1 || memcmp(magic, TRACE_MAGIC, 8) != 0 ||
+        fread(&version, sizeof(version), 1, file) != 1 || version != TRACE_VERSION ||
+        fread(&props, sizeof(props), 1, file) != 1)
+    {
+        fclose(file);
+        return nullptr;
+    }
+    props.name[sizeof(props.name) - 1] = 0;
+    if (props.numInputs < 0 || props.numInputs > TRACE_MAX_INPUTS || props.numOutputs < 0 ||
+        props.bufferSampleLength <= 0 || props.bufferByteLength <= 0 || props.bufferByteLength % props.bufferSampleLength != 0)
+    {
+        fclose(file);
+        return nullptr;
+    }
+
+    auto r = new TraceReader;
+    r->file = file;
+    r->props = props;
+    r->firstRecord = ftell(file);
+    return r;
+}
+
+void traceReaderClose(TraceReader *r)
+{
+    fclose(r->file);
+    delete r;
+}
+
+bool traceReadRecord(TraceReader *r, TraceRecordHeader *header, std::vector<uint8_t> &payload)
+{
+    if (fread(header, sizeof(TraceRecordHeader), 1, r->file) != 1) {
+        return false;
+    }
+    auto maxLength = sizeof(TraceBufferSwitch) + (size_t)r->props.numInputs * r->props.bufferByteLength;
+    if (header->length > maxLength) {
+        return false;
+    }
+    payload.resize(header->length);
+    return header->length == 0 || fread(payload.data(), header->length, 1, r->file) == 1;
+}
+
+void traceReaderRewind(TraceReader *r)
+{
+    fseek(r->file, r->firstRecord, SEEK_SET);
+}
+
+bool traceRecordValid(const TraceReader *r, const TraceRecordHeader *header, const std::vector<uint8_t> &payload)
+{
+    switch (header->type) {
+    case TraceRecord_BufferSwitch:
+    {
+        if (payload.size() < sizeof(TraceBufferSwitch)) {
+            return false;
+        }
+        TraceBufferSwitch body;
+        memcpy(&body, payload.data(), sizeof(body));
+        if (body.storedInputs & ~allChannelsMask(r->props.numInputs)) {
+            return false;
+        }
+        return payload.size() >= sizeof(body) + std::popcount(body.storedInputs) * (size_t)r->props.bufferByteLength;
+    }
+    case TraceRecord_AsioMessage:
+        return payload.size() >= sizeof(TraceAsioMessage);
+    case TraceRecord_SampleRateChanged:
+        return payload.size() >= sizeof(TraceSampleRate);
+    default:
+        return true; // unknown types are skipped anyway
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "CASIOClient.h"
+#include "util/lockfree.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// compact binary session traces, for reproducing field problems offline.
+//
+// file layout (all little-endian, native struct packing of the fixed-size structs below):
+//   "CASIOTRC" | uint32 version | TraceProperties
+//   then any number of records: TraceRecordHeader | payload[header.length]
+//
+// the audio thread only ever stages records into a preallocated ring; a writer thread moves them to disk.
+// if the disk can't keep up, records are dropped (and counted) rather than blocking the callback.
+
+#define TRACE_MAGIC "CASIOTRC"
+#define TRACE_VERSION 1
+#define TRACE_MAX_INPUTS 64 // storedInputs is a 64-bit mask
+
+enum TraceRecordType : uint32_t {
+    TraceRecord_BufferSwitch = 1,
+    TraceRecord_AsioMessage,
+    TraceRecord_SampleRateChanged
+};
+
+struct TraceProperties {
+    int32_t numInputs, numOutputs;
+    int32_t bufferSampleLength, bufferByteLength;
+    int32_t sampleFormat; // CASIO_SampleFormat
+    int32_t reserved;
+    double sampleRate;
+    int32_t inputLatency, outputLatency;
+    char name[128];
+};
+
+struct TraceRecordHeader {
+    uint32_t type; // TraceRecordType
+    uint32_t length; // of the payload that follows
+    uint64_t timestamp; // nanoseconds since capture start
+};
+
+struct TraceBufferSwitch {
+    uint32_t timeFlags; // CASIO_TimeFlags
+    uint32_t reserved;
+    uint64_t nanoSeconds, samples, tcSamples;
+    uint64_t activeInputs;
+    uint64_t storedInputs; // which inputs follow, bufferByteLength bytes each, in channel order. the rest replay as silence
+};
+
+struct TraceAsioMessage {
+    int32_t selector, value;
+};
+
+struct TraceSampleRate {
+    double sampleRate;
+};
+
+//============ writer ========================================================
+
+struct TraceEventRecord { // asioMessage / sample rate records, which can arrive on any driver thread
+    TraceRecordHeader header;
+    union {
+        TraceAsioMessage asioMessage;
+        TraceSampleRate sampleRate;
+    };
+};
+
+struct TraceWriter {
+    FILE *file;
+    ByteRing *ring; // bufferSwitch records, from the audio thread
+    BoundedQueue<TraceEventRecord, 64> events;
+    bool skipSilentInputs;
+    int numInputs, bufferByteLength;
+    std::chrono::steady_clock::time_point start;
+    std::thread thread;
+    std::atomic<bool> running;
+    std::atomic<unsigned int> dropped;
+};
+
+// skipSilentInputs: only store inputs that are in the bufferSwitch's activeInputs mask (see CASIO_SetSilenceDetection)
+TraceWriter *traceWriterOpen(const char *path, const TraceProperties *props, bool skipSilentInputs);
+// flushes everything and returns the number of records that had to be dropped
+unsigned int traceWriterClose(TraceWriter *w);
+
+void traceWriteBufferSwitch(TraceWriter *w, const CASIO_Event *event);
+void traceWriteAsioMessage(TraceWriter *w, long selector, long value);
+void traceWriteSampleRate(TraceWriter *w, double sampleRate);
+
+//============ reader ========================================================
+
+struct TraceReader {
+    FILE *file;
+    TraceProperties props;
+    long firstRecord; // file offset
+};
+
+// null if the file isn't a trace, or its properties don't make sense (more than TRACE_MAX_INPUTS, zero buffer length, ...)
+TraceReader *traceReaderOpen(const char *path);
+void traceReaderClose(TraceReader *r);
+// false at end of file (or on a truncated final record, which is what a crash mid-capture leaves behind),
+// or on a record longer than any this version writes for these properties (a corrupt length).
+// payloads aren't checked against their type, see traceRecordValid
+bool traceReadRecord(TraceReader *r, TraceRecordHeader *header, std::vector<uint8_t> &payload);
+void traceReaderRewind(TraceReader *r); // back to the first record
+// whether a payload is long enough for its record type, including the inputs a bufferSwitch says it stores
+bool traceRecordValid(const TraceReader *r, const TraceRecordHeader *header, const std::vector<uint8_t> &payload);
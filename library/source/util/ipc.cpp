@@ -0,0 +1,235 @@
+#include "ipc.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+#endif
+
+//============ shared memory =================================================
+
+#ifdef _WIN32
+
+bool shmCreate(SharedMemory *shm, const char *name, size_t size)
+{
+    char fullName[256];
+    snprintf(fullName, sizeof(fullName), "Local\\CASIO_%s", name);
+    auto mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+        (DWORD)((UINT64)size >> 32), (DWORD)(size & 0xFFFFFFFF), fullName);
+    if (!mapping) {
+        return false;
+    }
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping); // somebody's already serving under this name
+        return false;
+    }
+    auto base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!base) {
+        CloseHandle(mapping);
+        return false;
+    }
+    memset(base, 0, size);
+    shm->mapping = mapping;
+    shm->base = base;
+    shm->size = size;
+    return true;
+}
+
+bool shmOpen(SharedMemory *shm, const char *name)
+{
+    char fullName[256];
+    snprintf(fullName, sizeof(fullName), "Local\\CASIO_%s", name);
+    auto mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, fullName);
+    if (!mapping) {
+        return false;
+    }
+    auto base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (!base) {
+        CloseHandle(mapping);
+        return false;
+    }
+    MEMORY_BASIC_INFORMATION info;
+    VirtualQuery(base, &info, sizeof(info));
+    shm->mapping = mapping;
+    shm->base = base;
+    shm->size = info.RegionSize;
+    return true;
+}
+
+void shmClose(SharedMemory *shm, bool owner)
+{
+    UnmapViewOfFile(shm->base);
+    CloseHandle(shm->mapping);
+    shm->base = nullptr;
+    shm->mapping = nullptr;
+}
+
+#else
+
+bool shmCreate(SharedMemory *shm, const char *name, size_t size)
+{
+    snprintf(shm->name, sizeof(shm->name), "/CASIO_%s", name);
+    auto fd = shm_open(shm->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        shm_unlink(shm->name);
+        return false;
+    }
+    auto base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(shm->name);
+        return false;
+    }
+    shm->base = base; // (ftruncate already zero-filled it)
+    shm->size = size;
+    return true;
+}
+
+bool shmOpen(SharedMemory *shm, const char *name)
+{
+    snprintf(shm->name, sizeof(shm->name), "/CASIO_%s", name);
+    auto fd = shm_open(shm->name, O_RDWR, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    auto base = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    shm->base = base;
+    shm->size = (size_t)st.st_size;
+    return true;
+}
+
+void shmClose(SharedMemory *shm, bool owner)
+{
+    munmap(shm->base, shm->size);
+    if (owner) {
+        shm_unlink(shm->name);
+    }
+    shm->base = nullptr;
+}
+
+#endif
+
+//============ signals =======================================================
+
+#ifdef _WIN32
+
+bool ipcSignalCreate(IpcSignal *sig, const char *name, std::atomic<uint32_t> *word)
+{
+    char fullName[256];
+    snprintf(fullName, sizeof(fullName), "Local\\CASIO_%s", name);
+    sig->word = word;
+    sig->event = CreateEventA(NULL, FALSE, FALSE, fullName); // auto-reset
+    return sig->event != nullptr;
+}
+
+bool ipcSignalOpen(IpcSignal *sig, const char *name, std::atomic<uint32_t> *word)
+{
+    char fullName[256];
+    snprintf(fullName, sizeof(fullName), "Local\\CASIO_%s", name);
+    sig->word = word;
+    sig->event = OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, fullName);
+    return sig->event != nullptr;
+}
+
+void ipcSignalClose(IpcSignal *sig)
+{
+    if (sig->event) {
+        CloseHandle(sig->event);
+        sig->event = nullptr;
+    }
+}
+
+void ipcSignalNotify(IpcSignal *sig)
+{
+    sig->word->fetch_add(1, std::memory_order_release);
+    SetEvent(sig->event);
+}
+
+uint32_t ipcSignalPrepare(IpcSignal *sig)
+{
+    return sig->word->load(std::memory_order_acquire); // (the event stays set until consumed, so this is just informational)
+}
+
+void ipcSignalWait(IpcSignal *sig, uint32_t ticket, int timeoutMs)
+{
+    WaitForSingleObject(sig->event, (DWORD)timeoutMs);
+}
+
+#else
+
+bool ipcSignalCreate(IpcSignal *sig, const char * /*name*/, std::atomic<uint32_t> *word)
+{
+    sig->word = word; // (the futex lives in the shared word itself, nothing to name)
+    return true;
+}
+
+bool ipcSignalOpen(IpcSignal *sig, const char * /*name*/, std::atomic<uint32_t> *word)
+{
+    sig->word = word;
+    return true;
+}
+
+void ipcSignalClose(IpcSignal *sig)
+{
+    sig->word = nullptr;
+}
+
+void ipcSignalNotify(IpcSignal *sig)
+{
+    sig->word->fetch_add(1, std::memory_order_release);
+#ifdef __linux__
+    // not FUTEX_PRIVATE_FLAG: the waiter is in another process
+    syscall(SYS_futex, (uint32_t *)sig->word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+uint32_t ipcSignalPrepare(IpcSignal *sig)
+{
+    return sig->word->load(std::memory_order_acquire);
+}
+
+void ipcSignalWait(IpcSignal *sig, uint32_t ticket, int timeoutMs)
+{
+#ifdef __linux__
+    struct timespec timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (long)(timeoutMs % 1000) * 1000000;
+    // returns immediately if the word has already moved past the ticket
+    syscall(SYS_futex, (uint32_t *)sig->word, FUTEX_WAIT, ticket, &timeout, nullptr, 0);
+#else
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (sig->word->load(std::memory_order_acquire) == ticket && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+#endif
+}
+
+#endif
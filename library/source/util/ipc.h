@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// minimal cross-process primitives: named shared memory, and a wakeup signal.
+//   windows: file mapping + named auto-reset event
+//   linux:   shm_open/mmap + futex on a word that lives in the shared memory itself
+//   other:   shm_open/mmap + short sleeps (no futex)
+
+struct SharedMemory {
+    void *base = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void *mapping = nullptr; // HANDLE
+#else
+    char name[128];
+#endif
+};
+
+bool shmCreate(SharedMemory *shm, const char *name, size_t size);
+bool shmOpen(SharedMemory *shm, const char *name);
+// owner = the creator, which also removes the name (posix)
+void shmClose(SharedMemory *shm, bool owner);
+
+struct IpcSignal {
+    std::atomic<uint32_t> *word = nullptr; // in shared memory
+#ifdef _WIN32
+    void *event = nullptr; // HANDLE
+#endif
+};
+
+bool ipcSignalCreate(IpcSignal *sig, const char *name, std::atomic<uint32_t> *word);
+bool ipcSignalOpen(IpcSignal *sig, const char *name, std::atomic<uint32_t> *word);
+void ipcSignalClose(IpcSignal *sig);
+
+// never blocks, fine to call from the audio thread
+void ipcSignalNotify(IpcSignal *sig);
+
+// waiting side: take a ticket *before* checking for work, then wait on it if there was none.
+// a notify that lands in between makes the wait return immediately, so nothing is lost.
+uint32_t ipcSignalPrepare(IpcSignal *sig);
+void ipcSignalWait(IpcSignal *sig, uint32_t ticket, int timeoutMs);
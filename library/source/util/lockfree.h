@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+// bounded multi-producer / multi-consumer queue (Dmitry Vyukov's design).
+// fixed storage, no allocation after construction, push/pop never block -- they just fail when full/empty.
+// safe to use from the audio thread on either side.
+
+template<typename T, size_t N>
+class BoundedQueue {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of 2");
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+    alignas(64) Cell cells[N];
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+
+public:
+    BoundedQueue() {
+        for (size_t i = 0; i < N; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos.store(0, std::memory_order_relaxed);
+    }
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    bool push(const T &value) {
+        Cell *cell;
+        auto pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[pos & (N - 1)];
+            auto seq = cell->sequence.load(std::memory_order_acquire);
+            auto diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                return false; // full
+            }
+            else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &value) {
+        Cell *cell;
+        auto pos = dequeuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[pos & (N - 1)];
+            auto seq = cell->sequence.load(std::memory_order_acquire);
+            auto diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                return false; // empty
+            }
+            else {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        value = cell->data;
+        cell->sequence.store(pos + N, std::memory_order_release);
+        return true;
+    }
+};
+
+// single-producer / single-consumer byte ring.
+// the producer stages a record in as many pieces as it likes and publishes them all at once,
+// so the consumer never sees half a record. storage is allocated once, up front.
+
+class ByteRing {
+    uint8_t *data;
+    size_t capacity;
+    alignas(64) std::atomic<size_t> head; // total bytes published
+    alignas(64) std::atomic<size_t> tail; // total bytes consumed
+    size_t staged; // producer-only: head + whatever's been staged since the last publish
+
+    void copyIn(size_t pos, const void *src, size_t len) {
+        auto offset = pos % capacity;
+        auto first = len < capacity - offset ? len : capacity - offset;
+        memcpy(data + offset, src, first);
+        memcpy(data, (const uint8_t *)src + first, len - first);
+    }
+    void copyOut(size_t pos, void *dst, size_t len) const {
+        auto offset = pos % capacity;
+        auto first = len < capacity - offset ? len : capacity - offset;
+        memcpy(dst, data + offset, first);
+        memcpy((uint8_t *)dst + first, data, len - first);
+    }
+
+public:
+    explicit ByteRing(size_t capacity) : data(new uint8_t[capacity]), capacity(capacity), head(0), tail(0), staged(0) {}
+    ~ByteRing() { delete[] data; }
+    ByteRing(const ByteRing &) = delete;
+    ByteRing &operator=(const ByteRing &) = delete;
+
+    // producer side
+    size_t writable() const {
+        return capacity - (staged - tail.load(std::memory_order_acquire));
+    }
+    void stage(const void *src, size_t len) { // caller checks writable() first
+        copyIn(staged, src, len);
+        staged += len;
+    }
+    void publish() {
+        head.store(staged, std::memory_order_release);
+    }
+
+    // consumer side
+    size_t readable() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+    }
+    size_t read(void *dst, size_t len) {
+        auto available = readable();
+        if (len > available) {
+            len = available;
+        }
+        auto pos = tail.load(std::memory_order_relaxed);
+        copyOut(pos, dst, len);
+        tail.store(pos + len, std::memory_order_release);
+        return len;
+    }
+};
+
+// an optional object that realtime callbacks use while a control thread may attach/detach it at any time.
+// callbacks bracket every use, and detach() waits for the brackets in flight to drain before handing the object back
+// (so the caller can safely destroy it). the callback side never waits.
+
+template<typename T>
+class Detachable {
+    std::atomic<T *> ptr = nullptr;
+    std::atomic<int> users = 0;
+
+public:
+    template<typename F>
+    void use(F func) {
+        users++;
+        if (auto p = ptr.load()) {
+            func(p);
+        }
+        users--;
+    }
+
+    bool attached() const { return ptr.load() != nullptr; }
+
+    // false if something was already attached
+    bool attach(T *p) {
+        T *expected = nullptr;
+        return ptr.compare_exchange_strong(expected, p);
+    }
+
+    T *detach() {
+        return replace(nullptr);
+    }
+
+    // swaps in p (which may be null) without a gap, and hands back the old object once nothing uses it anymore
+    T *replace(T *p) {
+        auto old = ptr.exchange(p);
+        while (users.load() != 0) {
+            std::this_thread::yield();
+        }
+        return old;
+    }
+};
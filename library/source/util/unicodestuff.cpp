@@ -1,8 +1,10 @@
 #include "unicodestuff.h"
 
+#include <assert.h>
+
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
-#include <assert.h>
 
 std::wstring utf8_to_wstring(const std::string &str) {
 	auto bufferSize = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, NULL, 0);
@@ -31,3 +33,67 @@ std::string wstring_to_utf8(const std::wstring &str) {
 
 	return ret;
 }
+
+#else
+
+// wchar_t is UTF-32 everywhere else. invalid sequences become U+FFFD
+
+std::wstring utf8_to_wstring(const std::string &str) {
+	std::wstring ret;
+	ret.reserve(str.size());
+	size_t i = 0;
+	while (i < str.size()) {
+		auto c = (unsigned char)str[i];
+		int extra = c < 0x80 ? 0 : (c >> 5) == 0x6 ? 1 : (c >> 4) == 0xE ? 2 : (c >> 3) == 0x1E ? 3 : -1;
+		if (extra < 0 || i + extra >= str.size()) {
+			ret += (wchar_t)0xFFFD;
+			i++;
+			continue;
+		}
+		char32_t code = extra ? c & (0x3F >> extra) : c;
+		int j = 1;
+		for (; j <= extra && ((unsigned char)str[i + j] >> 6) == 0x2; j++) {
+			code = (code << 6) | ((unsigned char)str[i + j] & 0x3F);
+		}
+		if (j <= extra) {
+			ret += (wchar_t)0xFFFD;
+			i += j;
+			continue;
+		}
+		ret += (wchar_t)code;
+		i += extra + 1;
+	}
+	return ret;
+}
+
+std::string wstring_to_utf8(const std::wstring &str) {
+	std::string ret;
+	ret.reserve(str.size());
+	for (auto wc : str) {
+		auto c = (char32_t)wc;
+		if (c > 0x10FFFF || (c >= 0xD800 && c < 0xE000)) {
+			c = 0xFFFD;
+		}
+		if (c < 0x80) {
+			ret += (char)c;
+		}
+		else if (c < 0x800) {
+			ret += (char)(0xC0 | (c >> 6));
+			ret += (char)(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000) {
+			ret += (char)(0xE0 | (c >> 12));
+			ret += (char)(0x80 | ((c >> 6) & 0x3F));
+			ret += (char)(0x80 | (c & 0x3F));
+		}
+		else {
+			ret += (char)(0xF0 | (c >> 18));
+			ret += (char)(0x80 | ((c >> 12) & 0x3F));
+			ret += (char)(0x80 | ((c >> 6) & 0x3F));
+			ret += (char)(0x80 | (c & 0x3F));
+		}
+	}
+	return ret;
+}
+
+#endif
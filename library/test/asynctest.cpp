@@ -0,0 +1,115 @@
+// the coroutine layer (CASIOAsync.h) against the null backend
+
+#include "CASIOAsync.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#define CHECK(x) do { if (!(x)) { printf("FAILED: %s (line %d)\n", #x, __LINE__); exit(1); } } while (0)
+
+static casio::Task<CASIO_DeviceID> findNullDevice(casio::Runtime &runtime)
+{
+    for (auto &info : co_await runtime.enumerate()) {
+        if (info.name == "Null Device") {
+            co_return info.id;
+        }
+    }
+    co_return nullptr;
+}
+
+// a few blocks in order, then a stop token cancels the wait
+static casio::Task<int> readBlocks(casio::Runtime &runtime, CASIO_DeviceID id)
+{
+    auto device = co_await runtime.open(id);
+    std::exception_ptr error;
+    int blocks = 0;
+    try {
+        co_await device->start();
+        uint64_t last = 0;
+        for (; blocks < 10; blocks++) {
+            auto block = co_await device->next_block();
+            CHECK(block.sequence > last);
+            CHECK(block.frames == device->properties().bufferSampleLength);
+            last = block.sequence;
+        }
+
+        std::stop_source source;
+        std::jthread canceller([&source] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            source.request_stop();
+        });
+        bool cancelled = false;
+        try {
+            while (true) {
+                co_await device->next_block(source.get_token());
+            }
+        }
+        catch (const casio::Cancelled &) {
+            cancelled = true;
+        }
+        CHECK(cancelled);
+        co_await device->stop();
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    co_await device->close();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    co_return blocks;
+}
+
+// waits for blocks until the device stops underneath it
+static casio::Task<int> waitUntilStopped(casio::Device *device)
+{
+    int blocks = 0;
+    try {
+        while (true) {
+            co_await device->next_block();
+            blocks++;
+        }
+    }
+    catch (const casio::Cancelled &) {
+    }
+    co_return blocks;
+}
+
+int main()
+{
+    casio::Runtime runtime;
+    auto id = casio::sync_wait(findNullDevice(runtime));
+    CHECK(id != nullptr);
+
+    CHECK(casio::sync_wait(readBlocks(runtime, id)) == 10);
+
+    auto device = casio::sync_wait(runtime.open(id));
+    casio::sync_wait(device->start());
+    int waited = -1;
+    std::thread waiter([&] { waited = casio::sync_wait(waitUntilStopped(device.get())); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    casio::sync_wait(device->stop());
+    waiter.join();
+    CHECK(waited > 0);
+
+    // stop() racing a waiter that is just registering: it comes back cancelled either way, never hangs
+    for (int i = 0; i < 100; i++) {
+        casio::sync_wait(device->start());
+        std::thread racer([&] { casio::sync_wait(waitUntilStopped(device.get())); });
+        casio::sync_wait(device->stop());
+        racer.join();
+    }
+    casio::sync_wait(device->close());
+    device.reset();
+
+    // dropped while running, without a close: closed and deleted on the control thread, no waiting here
+    auto dropped = casio::sync_wait(runtime.open(id));
+    casio::sync_wait(dropped->start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    dropped.reset();
+    CHECK(casio::sync_wait(readBlocks(runtime, id)) == 10); // (and the device can be opened again)
+    printf("OK\n");
+    return 0;
+}
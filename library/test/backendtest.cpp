@@ -0,0 +1,155 @@
+// runs the hardware-free backends (null, trace) through the device lifecycle. plain asserts, exit code for ctest
+
+#include "CASIOClient.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+#define CHECK(x) do { if (!(x)) { printf("FAILED: %s (line %d)\n", #x, __LINE__); exit(1); } } while (0)
+
+// userData of every device opened here
+struct Counter {
+    std::atomic<int> buffers = 0;
+    std::atomic<bool> hangOnce = false; // block one callback, so the watchdog fires
+};
+
+static int CASIO_CDECL callback(CASIO_Event *event, CASIO_Device /*device*/, void *userData)
+{
+    if (event->eventType == CASIO_EventType_Log) {
+        printf("  %s\n", event->logEvent.message);
+        return 0;
+    }
+    auto counter = (Counter *)userData;
+    if (event->eventType == CASIO_EventType_BufferSwitch && counter) {
+        counter->buffers++;
+        if (counter->hangOnce.exchange(false)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+    }
+    event->handled = true;
+    return 0;
+}
+
+static void sleepMs(int ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static CASIO_DeviceID nullDeviceId()
+{
+    CASIO_DeviceInfo *infos;
+    int count;
+    CHECK(CASIO_EnumerateDevices(&infos, &count) == 0);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(infos[i].name, "Null Device") == 0) {
+            return infos[i].id;
+        }
+    }
+    CHECK(!"no null device");
+    return nullptr;
+}
+
+static void testNullDevice(CASIO_DeviceID id)
+{
+    Counter counter;
+    CASIO_Device device;
+    CHECK(CASIO_OpenDevice(id, &counter, &device) == 0);
+    CASIO_DeviceProperties props;
+    double sampleRate;
+    CHECK(CASIO_GetProperties(device, &props, &sampleRate) == 0);
+    CHECK(props.bufferSampleLength > 0 && sampleRate > 0);
+
+    // twice, a device can be restarted
+    for (int run = 0; run < 2; run++) {
+        auto before = counter.buffers.load();
+        CHECK(CASIO_Start(device) == 0);
+        sleepMs(200);
+        CHECK(CASIO_Stop(device) == 0);
+        CHECK(counter.buffers > before + 5);
+    }
+    auto stopped = counter.buffers.load();
+    sleepMs(50);
+    CHECK(counter.buffers == stopped);
+    CHECK(CASIO_CloseDevice(device) == 0);
+}
+
+static void testTraceReplay(CASIO_DeviceID id, const std::string &path)
+{
+    Counter live;
+    CASIO_Device device;
+    CHECK(CASIO_OpenDevice(id, &live, &device) == 0);
+    CHECK(CASIO_StartTraceCapture(device, path.c_str(), false) == 0);
+    CHECK(CASIO_Start(device) == 0);
+    sleepMs(200);
+    CHECK(CASIO_Stop(device) == 0);
+    CHECK(CASIO_StopTraceCapture(device) == 0);
+    CHECK(CASIO_CloseDevice(device) == 0);
+    CHECK(live.buffers > 0);
+
+    Counter replayed;
+    CASIO_Device trace;
+    CHECK(CASIO_OpenTrace(path.c_str(), &replayed, &trace) == 0);
+    CHECK(CASIO_ReplayTrace(trace, false) == 0);
+    CHECK(replayed.buffers == live.buffers);
+    CHECK(CASIO_ReplayTrace(trace, false) == 0); // starts over
+    CHECK(replayed.buffers == 2 * live.buffers);
+
+    // realtime replay through the ordinary start/stop
+    CHECK(CASIO_Start(trace) == 0);
+    CHECK(CASIO_ReplayTrace(trace, false) == -1);
+    sleepMs(100);
+    CHECK(CASIO_Stop(trace) == 0);
+    CHECK(replayed.buffers > 2 * live.buffers);
+    CHECK(CASIO_CloseDevice(trace) == 0);
+
+    CHECK(CASIO_OpenTrace((path + ".missing").c_str(), nullptr, &trace) == -1);
+}
+
+// after a failover CASIO_Start only flags the primary as started, so its stop must cope with a backend that never ran
+static void testFailoverRestart(CASIO_DeviceID id)
+{
+    Counter counter;
+    CASIO_Device device;
+    CHECK(CASIO_OpenDevice(id, &counter, &device) == 0);
+    CHECK(CASIO_SetStandby(device, id, 50) == 0);
+    CHECK(CASIO_Start(device) == 0);
+    sleepMs(50);
+    counter.hangOnce = true;
+    sleepMs(400);
+    CASIO_FailoverStatus status;
+    CHECK(CASIO_GetFailoverStatus(device, &status) == 0);
+    CHECK(status.failedOver && status.reason == CASIO_Failover_Watchdog);
+
+    CHECK(CASIO_Stop(device) == 0);
+    CHECK(CASIO_Start(device) == 0);
+    auto before = counter.buffers.load();
+    sleepMs(100);
+    CHECK(counter.buffers > before); // the standby carries on
+    CHECK(CASIO_Stop(device) == 0);
+    CHECK(CASIO_CloseDevice(device) == 0);
+}
+
+int main()
+{
+    auto path = (std::filesystem::temp_directory_path() / "casio_backendtest.trace").string();
+    CHECK(CASIO_Init(callback) == 0);
+    auto id = nullDeviceId();
+
+    printf("null device\n");
+    testNullDevice(id);
+    printf("trace capture and replay\n");
+    testTraceReplay(id, path);
+    printf("failover restart\n");
+    testFailoverRestart(id);
+
+    CHECK(CASIO_Shutdown() == 0);
+    std::filesystem::remove(path);
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,131 @@
+// a processing graph on a null device: a diamond and fan-in sums over several threads, and a cycle that's refused
+
+#include "CASIOClient.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#define CHECK(x) do { if (!(x)) { printf("FAILED: %s (line %d)\n", #x, __LINE__); exit(1); } } while (0)
+
+// userData of the device. the graph runs right after the callback: the inputs written here go through it this buffer,
+// and the outputs seen here are what it wrote the last time this half of the double buffer came round
+struct Run {
+    int frames;
+    std::atomic<int> buffers = 0;
+    std::atomic<int> wrong = 0; // outputs that weren't exactly what the graph should make of the inputs
+};
+
+// every sample dyadic and small, so the sums below are exact
+static float input0(int i) { return (float)(i % 64) / 64.0f; }
+static const float input1 = 0.5f;
+
+static int CASIO_CDECL callback(CASIO_Event *event, CASIO_Device /*device*/, void *userData)
+{
+    auto run = (Run *)userData;
+    if (event->eventType == CASIO_EventType_BufferSwitch && run) {
+        auto inputs = (float **)event->bufferSwitchEvent.inputs;
+        auto outputs = (float **)event->bufferSwitchEvent.outputs;
+        bool match = true;
+        for (int i = 0; i < run->frames; i++) {
+            // out0 = -(2 * in0 + 3 * in0), through the diamond. out1 = in1 + 2 * in0, two wires into the sink
+            match = match && outputs[0][i] == -5 * input0(i) && outputs[1][i] == input1 + 2 * input0(i);
+            inputs[0][i] = input0(i);
+            inputs[1][i] = input1;
+        }
+        if (!match && run->buffers >= 2) { // (the first time round each half holds no output yet)
+            run->wrong++;
+        }
+        run->buffers++;
+    }
+    event->handled = true;
+    return 0;
+}
+
+// context = the gain. one input (several wires into it are summed by the graph), one output
+static void CASIO_CDECL gain(void *context, const float *const *inputs, float *const *outputs, int frames)
+{
+    auto g = *(const float *)context;
+    for (int i = 0; i < frames; i++) {
+        outputs[0][i] = g * inputs[0][i];
+    }
+}
+
+static CASIO_DeviceID nullDeviceId()
+{
+    CASIO_DeviceInfo *infos;
+    int count;
+    CHECK(CASIO_EnumerateDevices(&infos, &count) == 0);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(infos[i].name, "Null Device") == 0) {
+            return infos[i].id;
+        }
+    }
+    CHECK(!"no null device");
+    return nullptr;
+}
+
+// how many of the next buffers came out wrong
+static int runFor(Run *run, int ms)
+{
+    auto buffers = run->buffers.load(), wrong = run->wrong.load();
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    CHECK(run->buffers - buffers > 5);
+    return run->wrong - wrong;
+}
+
+int main()
+{
+    CHECK(CASIO_Init(callback) == 0);
+    Run run;
+    CASIO_Device device;
+    CHECK(CASIO_OpenDevice(nullDeviceId(), &run, &device) == 0);
+    CASIO_DeviceProperties props;
+    double sampleRate;
+    CHECK(CASIO_GetProperties(device, &props, &sampleRate) == 0);
+    CHECK(props.sampleFormat == CASIO_SampleFormat_Float32);
+    run.frames = props.bufferSampleLength;
+
+    CASIO_Graph graph;
+    CHECK(CASIO_GraphCreate(device, 3, &graph) == 0); // the audio thread and 2 workers
+    float two = 2, three = 3, minus = -1;
+    auto in0 = CASIO_GraphAddSource(graph, 0);
+    auto in1 = CASIO_GraphAddSource(graph, 1);
+    auto a = CASIO_GraphAddProcessor(graph, 1, 1, gain, &two);
+    auto b = CASIO_GraphAddProcessor(graph, 1, 1, gain, &three);
+    auto c = CASIO_GraphAddProcessor(graph, 1, 1, gain, &minus);
+    auto out0 = CASIO_GraphAddSink(graph, 0);
+    auto out1 = CASIO_GraphAddSink(graph, 1);
+    CHECK(in0 >= 0 && in1 >= 0 && a >= 0 && b >= 0 && c >= 0 && out0 >= 0 && out1 >= 0);
+    CHECK(CASIO_GraphAddSink(graph, 0) == -1); // (one per output)
+
+    CHECK(CASIO_GraphConnect(graph, in0, 0, a, 0) == 0);
+    CHECK(CASIO_GraphConnect(graph, in0, 0, b, 0) == 0);
+    CHECK(CASIO_GraphConnect(graph, a, 0, c, 0) == 0); // a and b summed into c
+    CHECK(CASIO_GraphConnect(graph, b, 0, c, 0) == 0);
+    CHECK(CASIO_GraphConnect(graph, c, 0, out0, 0) == 0);
+    CHECK(CASIO_GraphConnect(graph, in1, 0, out1, 0) == 0); // and into the second sink
+    CHECK(CASIO_GraphConnect(graph, a, 0, out1, 0) == 0);
+    CHECK(CASIO_GraphCommit(graph) == 0);
+
+    CHECK(CASIO_Start(device) == 0);
+    CHECK(runFor(&run, 200) == 0);
+
+    // c back into a: refused, and the committed graph carries on as it was
+    CHECK(CASIO_GraphConnect(graph, c, 0, a, 0) == 0);
+    CHECK(CASIO_GraphCommit(graph) == -1);
+    CHECK(runFor(&run, 200) == 0);
+    CHECK(CASIO_GraphDisconnect(graph, c, 0, a, 0) == 0);
+    CHECK(CASIO_GraphCommit(graph) == 0);
+    CHECK(runFor(&run, 200) == 0);
+
+    CHECK(CASIO_Stop(device) == 0);
+    CHECK(CASIO_GraphDestroy(graph) == 0);
+    CHECK(CASIO_CloseDevice(device) == 0);
+    CHECK(CASIO_Shutdown() == 0);
+    printf("OK\n");
+    return 0;
+}
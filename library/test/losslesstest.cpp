@@ -0,0 +1,133 @@
+// lossless capture of a null device, decoded back to WAV and compared byte for byte
+
+#include "CASIOClient.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CHECK(x) do { if (!(x)) { printf("FAILED: %s (line %d)\n", #x, __LINE__); exit(1); } } while (0)
+
+#define CHANNELS 8
+#define WAV_HEADER_BYTES 68 // RIFF, WAVE_FORMAT_EXTENSIBLE fmt chunk, data chunk header
+
+static uint32_t noise(uint64_t frame, int channel)
+{
+    auto x = frame * 0x9E3779B97F4A7C15ULL + (uint64_t)channel * 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 31;
+    x *= 0x94D049BB133111EBULL;
+    return (uint32_t)(x >> 32);
+}
+
+// a different kind of block on every channel. exact (integer times 2^-31) unless said otherwise
+static float sample(int channel, uint64_t frame)
+{
+    switch (channel) {
+    case 1: return 0.5f; // constant
+    case 2: return (float)std::lround(20000 * sin(frame * 0.01)) / 32768.0f; // 16 bit in 32: shifted
+    case 3: return (float)(int32_t)(noise(frame, channel) & 0xFFFFFF00) / 2147483648.0f; // full-scale 24 bit noise
+    case 4: return 1e-6f * (float)(frame % 997 + 1) / 3.0f; // finer than 2^-31: stays verbatim
+    case 5: return (float)((int)(noise(frame, channel) % 64) - 32) / 128.0f; // 8 bit noise
+    default: return 0; // silent
+    }
+}
+
+struct Capture {
+    int frames;
+    std::atomic<uint64_t> buffers = 0;
+};
+
+static int CASIO_CDECL callback(CASIO_Event *event, CASIO_Device /*device*/, void *userData)
+{
+    auto capture = (Capture *)userData;
+    if (event->eventType == CASIO_EventType_BufferSwitch && capture) {
+        // the capture has already taken this buffer's inputs, and the null device never touches them: what's written
+        // here is captured two buffers on, when this half of the double buffer comes round again
+        auto first = (capture->buffers + 2) * capture->frames;
+        for (int ch = 0; ch < CHANNELS; ch++) {
+            for (int i = 0; i < capture->frames; i++) {
+                ((float *)event->bufferSwitchEvent.inputs[ch])[i] = sample(ch, first + i);
+            }
+        }
+        capture->buffers++;
+    }
+    event->handled = true;
+    return 0;
+}
+
+static CASIO_DeviceID nullDeviceId()
+{
+    CASIO_DeviceInfo *infos;
+    int count;
+    CHECK(CASIO_EnumerateDevices(&infos, &count) == 0);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(infos[i].name, "Null Device") == 0) {
+            return infos[i].id;
+        }
+    }
+    CHECK(!"no null device");
+    return nullptr;
+}
+
+int main()
+{
+    auto dir = std::filesystem::temp_directory_path();
+    auto path = (dir / "casio_losslesstest.lac").string();
+    auto wavPath = (dir / "casio_losslesstest.wav").string();
+    CHECK(CASIO_Init(callback) == 0);
+
+    Capture capture;
+    CASIO_Device device;
+    CHECK(CASIO_OpenDevice(nullDeviceId(), &capture, &device) == 0);
+    CASIO_DeviceProperties props;
+    double sampleRate;
+    CHECK(CASIO_GetProperties(device, &props, &sampleRate) == 0);
+    CHECK(props.numInputs == CHANNELS && props.sampleFormat == CASIO_SampleFormat_Float32);
+    capture.frames = props.bufferSampleLength;
+
+    // a few blocks, the last one partial
+    CHECK(CASIO_StartLosslessCapture(device, path.c_str(), 2) == 0);
+    CHECK(CASIO_StartLosslessCapture(device, path.c_str(), 2) == -1);
+    CHECK(CASIO_Start(device) == 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    CHECK(CASIO_Stop(device) == 0);
+    CASIO_CaptureStats stats;
+    CHECK(CASIO_StopLosslessCapture(device, &stats) == 0);
+    CHECK(CASIO_CloseDevice(device) == 0);
+
+    auto frames = capture.buffers * capture.frames;
+    printf("%llu frames, ratio %.2f\n", (unsigned long long)stats.frames, stats.compressionRatio);
+    CHECK(stats.droppedFrames == 0 && stats.writeErrors == 0);
+    CHECK(stats.frames == frames);
+    CHECK(stats.compressionRatio > 1.5); // (three silent channels, a constant and two with few bits used)
+
+    // the first two buffers were captured before the callback filled them in
+    std::vector<float> expected(frames * CHANNELS);
+    for (uint64_t f = 2 * capture.frames; f < frames; f++) {
+        for (int ch = 0; ch < CHANNELS; ch++) {
+            expected[f * CHANNELS + ch] = sample(ch, f);
+        }
+    }
+    CHECK(CASIO_DecodeLosslessCapture(path.c_str(), wavPath.c_str()) == 0);
+    std::ifstream wav(wavPath, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(wav)), std::istreambuf_iterator<char>());
+    CHECK(bytes.size() == WAV_HEADER_BYTES + expected.size() * sizeof(float));
+    CHECK(memcmp(bytes.data(), "RIFF", 4) == 0 && memcmp(bytes.data() + WAV_HEADER_BYTES - 8, "data", 4) == 0);
+    CHECK(memcmp(bytes.data() + WAV_HEADER_BYTES, expected.data(), expected.size() * sizeof(float)) == 0);
+
+    CHECK(CASIO_Shutdown() == 0);
+    wav.close();
+    std::filesystem::remove(path);
+    std::filesystem::remove(wavPath);
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,133 @@
+// an L24 stream from one null device to another over 127.0.0.1
+
+#include "CASIOClient.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#define CHECK(x) do { if (!(x)) { printf("FAILED: %s (line %d)\n", #x, __LINE__); exit(1); } } while (0)
+
+// what the sender's inputs hold: exact in 24 bits, and a third channel that isn't sent
+static const float sent[3] = {0.25f, -0.5f, 0.75f};
+
+// userData of both devices
+struct Side {
+    bool sender;
+    int frames;
+    std::atomic<int> buffers = 0;
+    std::atomic<int> matching = 0; // receiver: buffers that were all stream, sample for sample
+};
+
+static int CASIO_CDECL callback(CASIO_Event *event, CASIO_Device /*device*/, void *userData)
+{
+    auto side = (Side *)userData;
+    if (event->eventType == CASIO_EventType_BufferSwitch && side) {
+        auto &bs = event->bufferSwitchEvent;
+        if (side->sender) {
+            // (the null device never touches its inputs: this is what goes out the next time round)
+            for (int ch = 0; ch < 3; ch++) {
+                for (int i = 0; i < side->frames; i++) {
+                    ((float *)bs.inputs[ch])[i] = sent[ch];
+                }
+            }
+        }
+        else {
+            // what the stream played into this buffer last time round. then clear it for the next one
+            bool match = true;
+            for (int i = 0; i < side->frames; i++) {
+                match = match && fabsf(((float *)bs.outputs[0])[i] - sent[0]) < 1e-6f &&
+                    fabsf(((float *)bs.outputs[1])[i] - sent[1]) < 1e-6f && ((float *)bs.outputs[2])[i] == 0;
+            }
+            if (match) {
+                side->matching++;
+            }
+            for (int ch = 0; ch < 3; ch++) {
+                memset(bs.outputs[ch], 0, side->frames * sizeof(float));
+            }
+        }
+        side->buffers++;
+    }
+    event->handled = true;
+    return 0;
+}
+
+static CASIO_DeviceID nullDeviceId()
+{
+    CASIO_DeviceInfo *infos;
+    int count;
+    CHECK(CASIO_EnumerateDevices(&infos, &count) == 0);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(infos[i].name, "Null Device") == 0) {
+            return infos[i].id;
+        }
+    }
+    CHECK(!"no null device");
+    return nullptr;
+}
+
+static CASIO_Device open(CASIO_DeviceID id, Side *side)
+{
+    CASIO_Device device;
+    CHECK(CASIO_OpenDevice(id, side, &device) == 0);
+    CASIO_DeviceProperties props;
+    double sampleRate;
+    CHECK(CASIO_GetProperties(device, &props, &sampleRate) == 0);
+    CHECK(props.sampleFormat == CASIO_SampleFormat_Float32 && props.numInputs >= 3 && props.numOutputs >= 3);
+    side->frames = props.bufferSampleLength;
+    return device;
+}
+
+int main()
+{
+    CHECK(CASIO_Init(callback) == 0);
+    auto id = nullDeviceId();
+    Side sender, receiver;
+    sender.sender = true;
+    receiver.sender = false;
+    auto from = open(id, &sender);
+    auto to = open(id, &receiver);
+
+    CASIO_StreamConfig config = {};
+    config.port = (unsigned short)(40000 + getpid() % 10000); // (parallel test runs)
+    config.firstChannel = 0;
+    config.numChannels = 2;
+    config.bitDepth = 24;
+    int receiveId, sendId;
+    CHECK(CASIO_AddReceiveStream(to, &config, &receiveId) == 0);
+    config.address = "127.0.0.1";
+    CHECK(CASIO_AddSendStream(from, &config, &sendId) == 0);
+
+    CHECK(CASIO_Start(to) == 0);
+    CHECK(CASIO_Start(from) == 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    CHECK(CASIO_Stop(from) == 0);
+    CHECK(CASIO_Stop(to) == 0);
+
+    CASIO_StreamStats stats;
+    CHECK(CASIO_GetStreamStats(from, sendId, &stats) == 0);
+    CHECK(stats.packets > 0);
+    CHECK(CASIO_GetStreamStats(to, receiveId, &stats) == 0);
+    CHECK(stats.packets > 0);
+    printf("%d of %d buffers received intact\n", receiver.matching.load(), receiver.buffers.load());
+    CHECK(receiver.matching > receiver.buffers / 2); // (the first ones while the jitter buffer fills don't)
+
+    CHECK(CASIO_RemoveStream(from, sendId) == 0);
+    CHECK(CASIO_RemoveStream(to, receiveId) == 0);
+    CHECK(CASIO_CloseDevice(from) == 0);
+    CHECK(CASIO_CloseDevice(to) == 0);
+    CHECK(CASIO_Shutdown() == 0);
+    printf("OK\n");
+    return 0;
+}
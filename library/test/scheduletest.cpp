@@ -0,0 +1,101 @@
+// scheduled actions on the null device: every accepted action runs, the rest are refused up front
+
+#include "CASIOClient.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#define CHECK(x) do { if (!(x)) { printf("FAILED: %s (line %d)\n", #x, __LINE__); exit(1); } } while (0)
+
+#define MAX_PENDING 256 // (as documented on CASIO_ScheduleAction)
+
+static std::atomic<int> triggers = 0;
+static std::atomic<bool> outOfOrder = false;
+static uint64_t lastTriggered = 0; // audio thread only
+
+static int CASIO_CDECL callback(CASIO_Event *event, CASIO_Device /*device*/, void * /*userData*/)
+{
+    if (event->eventType == CASIO_EventType_ScheduledAction) {
+        auto position = event->scheduledActionEvent.action->samplePosition;
+        if (position < lastTriggered) {
+            outOfOrder = true;
+        }
+        lastTriggered = position;
+        triggers++;
+    }
+    event->handled = true;
+    return 0;
+}
+
+static CASIO_DeviceID nullDeviceId()
+{
+    CASIO_DeviceInfo *infos;
+    int count;
+    CHECK(CASIO_EnumerateDevices(&infos, &count) == 0);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(infos[i].name, "Null Device") == 0) {
+            return infos[i].id;
+        }
+    }
+    CHECK(!"no null device");
+    return nullptr;
+}
+
+static void sleepMs(int ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+int main()
+{
+    CHECK(CASIO_Init(callback) == 0);
+    CASIO_Device device;
+    CHECK(CASIO_OpenDevice(nullDeviceId(), nullptr, &device) == 0);
+    CHECK(CASIO_Start(device) == 0);
+    sleepMs(20);
+    uint64_t now;
+    CHECK(CASIO_GetSamplePosition(device, &now) == 0);
+
+    // most of the room taken by actions far in the future, which stay pending for the whole test
+    CASIO_ScheduledAction action = {};
+    action.type = CASIO_Action_SetGain;
+    action.channel = 0;
+    action.gain = 1.0f;
+    action.samplePosition = now + 1000000000ULL;
+    for (int i = 0; i < 200; i++) {
+        CHECK(CASIO_ScheduleAction(device, &action) == 0);
+    }
+    sleepMs(20); // (moved into the pending list by now)
+
+    // then more than fit: exactly the rest is accepted, in reverse order to exercise the sorting
+    action.type = CASIO_Action_Trigger;
+    int accepted = 0;
+    for (int i = 0; i < 100; i++) {
+        action.samplePosition = now + 9600 - i * 10;
+        if (CASIO_ScheduleAction(device, &action) == 0) {
+            accepted++;
+        }
+    }
+    CHECK(accepted == MAX_PENDING - 200);
+
+    // and every one of them runs, in position order
+    sleepMs(300);
+    CHECK(triggers == accepted);
+    CHECK(!outOfOrder);
+
+    // their room is free again
+    action.samplePosition = 0; // (already passed: runs on the next buffer)
+    CHECK(CASIO_ScheduleAction(device, &action) == 0);
+    sleepMs(50);
+    CHECK(triggers == accepted + 1);
+
+    CHECK(CASIO_Stop(device) == 0);
+    CHECK(CASIO_CloseDevice(device) == 0);
+    CHECK(CASIO_Shutdown() == 0);
+    printf("OK\n");
+    return 0;
+}
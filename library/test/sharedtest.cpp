@@ -0,0 +1,132 @@
+// a served null device and its clients: ones that hang or die without disconnecting don't keep their slot
+
+#include "CASIOClient.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define CHECK(x) do { if (!(x)) { printf("FAILED: %s (line %d)\n", #x, __LINE__); exit(1); } } while (0)
+
+#define EVICT_AFTER 4
+
+// userData of the in-process client: its first buffer doesn't come back until released
+static std::atomic<bool> released = false;
+static std::atomic<int> hung = 0;
+
+static int CASIO_CDECL callback(CASIO_Event *event, CASIO_Device /*device*/, void *userData)
+{
+    if (event->eventType == CASIO_EventType_BufferSwitch && userData == &hung) {
+        hung++;
+        while (!released) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    event->handled = true;
+    return 0;
+}
+
+static void sleepMs(int ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static CASIO_DeviceID nullDeviceId()
+{
+    CASIO_DeviceInfo *infos;
+    int count;
+    CHECK(CASIO_EnumerateDevices(&infos, &count) == 0);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(infos[i].name, "Null Device") == 0) {
+            return infos[i].id;
+        }
+    }
+    CHECK(!"no null device");
+    return nullptr;
+}
+
+static bool connectedPid(CASIO_Device server, unsigned int pid)
+{
+    CASIO_SharedClientStats stats[CASIO_MAX_SHARED_CLIENTS];
+    CHECK(CASIO_GetSharedClientStats(server, stats) == 0);
+    for (auto &s : stats) {
+        if (s.connected && s.pid == pid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// started, but never hands in a single buffer: evicted once the startup grace is over
+static void testHungClient(CASIO_Device server, const std::string &name)
+{
+    CASIO_Device client;
+    CHECK(CASIO_ConnectShared(name.c_str(), &hung, &client) == 0);
+    CHECK(CASIO_Start(client) == 0);
+    sleepMs(1000); // (grace and evictAfter together are well under 100 buffers, about half a second)
+    CHECK(hung > 0);
+    CHECK(!connectedPid(server, (unsigned int)getpid()));
+
+    released = true;
+    CASIO_Stop(client); // (may report the eviction)
+    CASIO_CloseDevice(client);
+}
+
+#ifndef _WIN32
+// another process connects and exits without disconnecting: its paused slot is given back
+static void testDeadClient(CASIO_Device server, const std::string &name, const char *self)
+{
+    auto child = fork();
+    CHECK(child >= 0);
+    if (child == 0) {
+        execl(self, self, "connect", name.c_str(), (char *)nullptr);
+        _exit(2);
+    }
+    int status;
+    CHECK(waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(!connectedPid(server, (unsigned int)child));
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    CHECK(CASIO_Init(callback) == 0);
+    if (argc == 3 && strcmp(argv[1], "connect") == 0) {
+        // the dying client of testDeadClient
+        CASIO_Device client;
+        _exit(CASIO_ConnectShared(argv[2], nullptr, &client) == 0 ? 0 : 1);
+    }
+
+    auto name = "casio_sharedtest_" + std::to_string(getpid());
+    CASIO_Device server;
+    CHECK(CASIO_OpenDevice(nullDeviceId(), nullptr, &server) == 0);
+    CHECK(CASIO_ServeDevice(server, name.c_str(), EVICT_AFTER) == 0);
+    CHECK(CASIO_Start(server) == 0);
+
+    printf("hung client\n");
+    testHungClient(server, name);
+#ifndef _WIN32
+    printf("dead client\n");
+    testDeadClient(server, name, argv[0]);
+#endif
+
+    CHECK(CASIO_Stop(server) == 0);
+    CHECK(CASIO_StopServing(server) == 0);
+    CHECK(CASIO_CloseDevice(server) == 0);
+    CHECK(CASIO_Shutdown() == 0);
+    printf("OK\n");
+    return 0;
+}
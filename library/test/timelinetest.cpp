@@ -0,0 +1,86 @@
+// timeline export from a running null device
+
+#include "CASIOClient.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#define CHECK(x) do { if (!(x)) { printf("FAILED: %s (line %d)\n", #x, __LINE__); exit(1); } } while (0)
+
+static int CASIO_CDECL callback(CASIO_Event *event, CASIO_Device /*device*/, void * /*userData*/)
+{
+    event->handled = true;
+    return 0;
+}
+
+static CASIO_DeviceID nullDeviceId()
+{
+    CASIO_DeviceInfo *infos;
+    int count;
+    CHECK(CASIO_EnumerateDevices(&infos, &count) == 0);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(infos[i].name, "Null Device") == 0) {
+            return infos[i].id;
+        }
+    }
+    CHECK(!"no null device");
+    return nullptr;
+}
+
+// every span's "ts", and how many there were
+static int checkTimestamps(const std::string &path)
+{
+    std::ifstream file(path);
+    std::stringstream json;
+    json << file.rdbuf();
+    auto text = json.str();
+    CHECK(text.find("\"traceEvents\"") != std::string::npos);
+
+    int spans = 0;
+    for (auto pos = text.find("\"ts\":"); pos != std::string::npos; pos = text.find("\"ts\":", pos + 1)) {
+        auto ts = strtod(text.c_str() + pos + 5, nullptr);
+        if (ts < 0 || ts > 1e9) { // (an hour, in microseconds: far beyond this test)
+            printf("bad timestamp %f\n", ts);
+            CHECK(false);
+        }
+        spans++;
+    }
+    return spans;
+}
+
+int main()
+{
+    auto path = (std::filesystem::temp_directory_path() / "casio_timelinetest.json").string();
+    CHECK(CASIO_Init(callback) == 0);
+    CHECK(CASIO_ExportTimeline(path.c_str()) == -1); // never enabled
+
+    CASIO_Device device;
+    CHECK(CASIO_OpenDevice(nullDeviceId(), nullptr, &device) == 0);
+    CHECK(CASIO_Start(device) == 0);
+
+    // enabled while running: the first record of the audio thread's ring is an inner span, the enclosing
+    // bufferSwitch span (which started earlier) comes after it
+    CHECK(CASIO_EnableTimeline(true, 0) == 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(CASIO_ExportTimeline(path.c_str()) == 0);
+    CHECK(checkTimestamps(path) > 10);
+
+    // and with the control thread's spans (CASIO_Stop encloses the backend stop)
+    CHECK(CASIO_Stop(device) == 0);
+    CHECK(CASIO_ExportTimeline(path.c_str()) == 0);
+    CHECK(checkTimestamps(path) > 10);
+
+    CHECK(CASIO_CloseDevice(device) == 0);
+    CHECK(CASIO_EnableTimeline(false, 0) == 0);
+    CHECK(CASIO_Shutdown() == 0);
+    std::filesystem::remove(path);
+    printf("OK\n");
+    return 0;
+}